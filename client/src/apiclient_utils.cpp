@@ -1,6 +1,7 @@
 #include "apiclient_utils.hpp"
 
 #include <rapidjson/document.h>
+#include <rapidjson/memorystream.h>
 #include <rapidjson/stringbuffer.h>
 #include <rapidjson/writer.h>
 
@@ -197,12 +198,13 @@ args_t parse(const std::string &string)
 namespace cli_utils
 {
 
-std::string parse_msg_response(input::cmd_t cmd, const std::string &json, std::vector<msg_response_t> &response)
+std::string parse_msg_response(input::cmd_t cmd, boost::string_ref json, std::vector<msg_response_t> &response)
 {
     unused_args(cmd);
 
+    rapidjson::MemoryStream stream(json.data(), json.size());
     rapidjson::Document document;
-    if (document.Parse(json.data()).HasParseError())
+    if (document.ParseStream(stream).HasParseError())
     {
         std::string err = "bad request, invalid json";
         return err;
@@ -269,12 +271,13 @@ std::string parse_msg_response(input::cmd_t cmd, const std::string &json, std::v
     return "";
 }
 
-std::string parse_response_aswer(input::cmd_t cmd, const std::string &json, response_t &response)
+std::string parse_response_aswer(input::cmd_t cmd, boost::string_ref json, response_t &response)
 {
     unused_args(cmd);
 
+    rapidjson::MemoryStream stream(json.data(), json.size());
     rapidjson::Document document;
-    if (document.Parse(json.data()).HasParseError())
+    if (document.ParseStream(stream).HasParseError())
     {
         std::string response = "bad request, invalid json";
         return response;
@@ -304,20 +307,31 @@ std::string parse_response_aswer(input::cmd_t cmd, const std::string &json, resp
         response.server_ts = it->value.GetUint64();
     }
 
+    it = document.FindMember("token");
+    if (it != document.MemberEnd() && it->value.IsString())
+    {
+        response.token = it->value.GetString();
+    }
+
     return "";
 }
 
-std::string build_request(const std::string &resource, const std::string &content_type, const std::string &body)
+std::string build_request(const std::string &resource, const std::string &content_type, const std::string &body,
+                          const std::string &accept)
 {
     std::string request = "POST " + resource + " HTTP/1.1\r\n";
     request += (std::string("Content-Length: ") + std::to_string(body.size()) + std::string("\r\n"));
     request += "Content-Type: " + content_type + "\r\n";
+    if (!accept.empty())
+    {
+        request += "Accept: " + accept + "\r\n";
+    }
     request += "\r\n";
     request += body;
     return request;
 }
 
-std::string build_user_history_msg_body(uint64_t from, const std::string &name, uint64_t count, const std::string &pass)
+std::string build_user_history_msg_body(uint64_t from, const std::string &name, uint64_t count, const std::string &token)
 {
     rapidjson::StringBuffer buffer;
     rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
@@ -332,8 +346,8 @@ std::string build_user_history_msg_body(uint64_t from, const std::string &name,
     writer.Key("count");
     writer.Uint64(count);
 
-    writer.Key("password");
-    writer.String(pass.c_str());
+    writer.Key("token");
+    writer.String(token.c_str());
 
     writer.EndObject();
     return std::string(buffer.GetString(), buffer.GetSize());
@@ -360,7 +374,7 @@ std::string build_user_send_msg_body(uint64_t from,
                                      uint64_t ts,
                                      const std::string &to,
                                      const std::string &msg,
-                                     const std::string &pass)
+                                     const std::string &token)
 {
     rapidjson::StringBuffer buffer;
     rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
@@ -381,8 +395,8 @@ std::string build_user_send_msg_body(uint64_t from,
     writer.Key("message");
     writer.String(msg.c_str());
 
-    writer.Key("password");
-    writer.String(pass.c_str());
+    writer.Key("token");
+    writer.String(token.c_str());
 
     writer.EndObject();
     return std::string(buffer.GetString(), buffer.GetSize());
@@ -392,7 +406,7 @@ std::string build_groups_msg_body(uint64_t from,
                                   const std::string &groupname,
                                   const std::string &username,
                                   const std::string &message,
-                                  const std::string &pass)
+                                  const std::string &token)
 {
     rapidjson::StringBuffer buffer;
     rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
@@ -416,8 +430,8 @@ std::string build_groups_msg_body(uint64_t from,
         writer.String(message.c_str());
     }
 
-    writer.Key("password");
-    writer.String(pass.c_str());
+    writer.Key("token");
+    writer.String(token.c_str());
 
     writer.EndObject();
     return std::string(buffer.GetString(), buffer.GetSize());
@@ -3,6 +3,7 @@
 #include <vector>
 
 #include <boost/optional.hpp>
+#include <boost/utility/string_ref.hpp>
 
 #include "common/common.hpp"
 
@@ -107,6 +108,7 @@ struct response_t
     uint64_t chatid    = 0;
     uint64_t heartbit  = 0;
     uint64_t server_ts = 0;
+    std::string token;          // of session, it is sent instead of password
 };
 
 struct msg_response_t
@@ -118,12 +120,13 @@ struct msg_response_t
 };
 
 
-std::string parse_response_aswer(input::cmd_t cmd, const std::string &json, response_t &response);
-std::string parse_msg_response(input::cmd_t cmd, const std::string &json, std::vector<msg_response_t> &response);
+std::string parse_response_aswer(input::cmd_t cmd, boost::string_ref json, response_t &response);
+std::string parse_msg_response(input::cmd_t cmd, boost::string_ref json, std::vector<msg_response_t> &response);
 
 std::string build_request(const std::string &resource,
                           const std::string &content_type,
-                          const std::string &body);
+                          const std::string &body,
+                          const std::string &accept = "");
 
 std::string build_user_pass_body(const std::string &user,
                                  const std::string &pass);
@@ -132,16 +135,16 @@ std::string build_user_send_msg_body(uint64_t from,
                                      uint64_t ts,
                                      const std::string &to,
                                      const std::string &msg,
-                                     const std::string &pass);
+                                     const std::string &token);
 
-std::string build_user_history_msg_body(uint64_t from, const std::string &name, uint64_t count, const std::string &pass);
+std::string build_user_history_msg_body(uint64_t from, const std::string &name, uint64_t count, const std::string &token);
 
 
 std::string build_groups_msg_body(uint64_t from,
                                   const std::string &groupname,
                                   const std::string &username,
                                   const std::string &message,
-                                  const std::string &pass);
+                                  const std::string &token);
 
 
 }  // namespace cli_utils
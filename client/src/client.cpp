@@ -18,6 +18,7 @@
 #include "client.hpp"
 #include "common/utils.hpp"
 #include "common/sysutils.hpp"
+#include "net/websocket.hpp"
 
 #include "o2logger/src/o2logger.hpp"
 using namespace o2logger; // NOLINT
@@ -25,8 +26,8 @@ using namespace o2logger; // NOLINT
 
 std::atomic<bool> g_NeedStop(false);
 
-Client::Client(const std::string& host, int port, const std::string &user, const std::string &password) :
-    m_IoThread(std::make_unique<IoThread>("")),
+Client::Client(const std::string& host, int port, const std::string &user, const std::string &password, bool websocket) :
+    m_IoThread(std::make_unique<IoThread>()),
     m_Timeout(m_IoThread->ioService()),
     m_Host(host),
     m_Port(port),
@@ -37,6 +38,7 @@ Client::Client(const std::string& host, int port, const std::string &user, const
     m_Ui = std::unique_ptr<AbstractUi>(new ConsoleUi(m_EvWorker));
 
     m_Ssl = true;
+    m_WebSocket = websocket;
     m_Http = createConnect(m_Ssl);
     m_HttpIdle = createConnect(m_Ssl);
     m_TimedOut = false;
@@ -52,15 +54,57 @@ Client::~Client()
 {
 }
 
-void Client::sendRequest(input::cmd_t cmd, const std::string &req)
+void Client::sendRequest(input::cmd_t cmd, common::cmd_t api_cmd, const std::string &body)
 {
     m_LastCmd = cmd;
+    if (m_WebSocket)
+    {
+        sendMessage(api_cmd, body);
+        return;
+    }
+
+    std::string req = cli_utils::build_request(common::cmd2string(api_cmd), "application/json", body);
     m_Http->asyncRequest(req, [this](const ConnectionError &error)
                               {
                                 onHttpWrite(error);
                               });
 }
 
+void Client::sendMessage(common::cmd_t api_cmd, const std::string &body)
+/*
+ *  websocket request: "/v1/user/login\n{...}", responses come in order of requests
+ */
+{
+    OutBuffer message;
+    message.append(common::cmd2string(api_cmd) + "\n" + body);
+    m_Http->asyncWriteMessage(std::move(message), [](const ConnectionError &error)
+                              {
+                                if (error.code)
+                                {
+                                    loge("websocket write error: ", error.asString());
+                                }
+                              });
+}
+
+void Client::startIdle()
+/*
+ *  after login server pushes new messages: over separate http connection
+ *  or over the same websocket
+ */
+{
+    if (m_WebSocket)
+    {
+        sendMessage(common::cmd_t::IDLE, cli_utils::build_user_send_msg_body(m_SelfId, m_HeartBit, "", "", m_Token));
+        return;
+    }
+
+    if (!m_HttpIdle->isOpen())
+    {
+        m_HttpIdle->asyncConnect(m_Host, m_Port,
+            boost::bind(&Client::onHttpIdleConnect, this, boost::asio::placeholders::error));
+    }
+}
+
 void Client::onUserInput(Event &&event)
 {
     // TODO: actually, it needs to be buffered
@@ -77,10 +121,8 @@ void Client::onUserInput(Event &&event)
         else
         {
             std::string body = cli_utils::build_user_send_msg_body(m_SelfId, 0, m_State.user,
-                                    event.msg, m_Password);
-            std::string req = cli_utils::build_request(common::cmd2string(common::cmd_t::MESSAGE_SEND),
-                                                    "application/json", body);
-            sendRequest(input::cmd_t::DIRECT_MSG_USER, req);
+                                    event.msg, m_Token);
+            sendRequest(input::cmd_t::DIRECT_MSG_USER, common::cmd_t::MESSAGE_SEND, body);
             return;
         }
     }
@@ -107,40 +149,31 @@ void Client::onUserInput(Event &&event)
     else if (args.cmd == input::cmd_t::REGISTER_USER)
     {
         std::string body = cli_utils::build_user_pass_body(args.reg.name, args.reg.pass);
-        std::string req = cli_utils::build_request(common::cmd2string(common::cmd_t::USER_CREATE),
-                                                    "application/json", body);
-        sendRequest(input::cmd_t::REGISTER_USER, req);
+        sendRequest(input::cmd_t::REGISTER_USER, common::cmd_t::USER_CREATE, body);
     }
     else if (args.cmd == input::cmd_t::LOGIN)
     {
         std::string body = cli_utils::build_user_pass_body(args.login.name, args.login.pass);
-        std::string req = cli_utils::build_request(common::cmd2string(common::cmd_t::USER_LOGIN),
-                                                    "application/json", body);
-        sendRequest(input::cmd_t::LOGIN, req);
+        sendRequest(input::cmd_t::LOGIN, common::cmd_t::USER_LOGIN, body);
+        m_User = args.login.name;
         m_Password = args.login.pass;
     }
     else if (args.cmd == input::cmd_t::DIRECT_MSG_USER)
     {
         std::string body = cli_utils::build_user_send_msg_body(m_SelfId, 0, args.direct.name,
-                                args.direct.message, m_Password);
-        std::string req = cli_utils::build_request(common::cmd2string(common::cmd_t::MESSAGE_SEND),
-                                                    "application/json", body);
-        sendRequest(input::cmd_t::DIRECT_MSG_USER, req);
+                                args.direct.message, m_Token);
+        sendRequest(input::cmd_t::DIRECT_MSG_USER, common::cmd_t::MESSAGE_SEND, body);
     }
     else if (args.cmd == input::cmd_t::HISTORY_USER)
     {
         std::string body = cli_utils::build_user_history_msg_body(m_SelfId, args.history.name, args.history.count,
-                                m_Password);
-        std::string req = cli_utils::build_request(common::cmd2string(common::cmd_t::USER_HISTORY),
-                                                    "application/json", body);
-        sendRequest(input::cmd_t::HISTORY_USER, req);
+                                m_Token);
+        sendRequest(input::cmd_t::HISTORY_USER, common::cmd_t::USER_HISTORY, body);
     }
     else if (args.cmd == input::cmd_t::STATUS_USER)
     {
-        std::string body = cli_utils::build_user_history_msg_body(m_SelfId, args.status.name, 0, m_Password);
-        std::string req = cli_utils::build_request(common::cmd2string(common::cmd_t::USER_STATUS),
-                                                    "application/json", body);
-        sendRequest(input::cmd_t::STATUS_USER, req);
+        std::string body = cli_utils::build_user_history_msg_body(m_SelfId, args.status.name, 0, m_Token);
+        sendRequest(input::cmd_t::STATUS_USER, common::cmd_t::USER_STATUS, body);
     }
     else if (args.cmd == input::cmd_t::CHAT_WITH_USER)
     {
@@ -150,26 +183,20 @@ void Client::onUserInput(Event &&event)
     }
     else if (args.cmd == input::cmd_t::REGISTER_GROUP)
     {
-        std::string body = cli_utils::build_groups_msg_body(m_SelfId, args.group.groupname, "", "", m_Password);
-        std::string req = cli_utils::build_request(common::cmd2string(common::cmd_t::CHAT_CREATE),
-                                                    "application/json", body);
-        sendRequest(input::cmd_t::REGISTER_GROUP, req);
+        std::string body = cli_utils::build_groups_msg_body(m_SelfId, args.group.groupname, "", "", m_Token);
+        sendRequest(input::cmd_t::REGISTER_GROUP, common::cmd_t::CHAT_CREATE, body);
     }
     else if (args.cmd == input::cmd_t::ADD_TO_GROUP)
     {
         std::string body = cli_utils::build_groups_msg_body(m_SelfId, args.group.groupname, args.group.username, "",
-                                m_Password);
-        std::string req = cli_utils::build_request(common::cmd2string(common::cmd_t::CHAT_ADDUSER),
-                                                    "application/json", body);
-        sendRequest(input::cmd_t::ADD_TO_GROUP, req);
+                                m_Token);
+        sendRequest(input::cmd_t::ADD_TO_GROUP, common::cmd_t::CHAT_ADDUSER, body);
     }
     else if (args.cmd == input::cmd_t::DIRECT_MSG_GROUP)
     {
         std::string body = cli_utils::build_groups_msg_body(m_SelfId, args.direct.name, "", args.direct.message,
-                                m_Password);
-        std::string req = cli_utils::build_request(common::cmd2string(common::cmd_t::MESSAGE_SEND_CHAT),
-                                                    "application/json", body);
-        sendRequest(input::cmd_t::DIRECT_MSG_GROUP, req);
+                                m_Token);
+        sendRequest(input::cmd_t::DIRECT_MSG_GROUP, common::cmd_t::MESSAGE_SEND_CHAT, body);
     }
     else
     {
@@ -188,6 +215,8 @@ boost::shared_ptr<AsyncHttpClient> Client::createConnect(bool use_ssl)
     {
         socket = boost::make_shared<TcpClient>(m_IoThread->ioService(), false, /*timeout*/ 10);
     }
+    // history of chat could be much longer than any request of server
+    socket->recvBuffer().setLimit(16 * 1024 * 1024);
     return boost::make_shared<AsyncHttpClient>(socket);
 }
 
@@ -195,6 +224,7 @@ void Client::handleStop()
 {
     logi("stopped by signal");
     g_NeedStop = true;
+    m_EvWorker.stop();
     m_IoThread->stop();
 }
 
@@ -239,12 +269,30 @@ void Client::onHttpConnect(const ConnectionError &e)
 
     m_Ui->showMsg("connected to server: " + m_Host + ":" + std::to_string(m_Port));
 
+    if (m_WebSocket)
+    {
+        m_WsKey = websocket::make_key();
+        m_Http->asyncRequest(websocket::upgrade_request("/v1/ws", m_Host, m_WsKey),
+            [this](const ConnectionError &error)
+            {
+                if (error.code)
+                {
+                    loge("websocket upgrade error: ", error.asString());
+                    return;
+                }
+                m_Http->asyncResponse(
+                    [this](const ConnectionError &error, const HttpReply &reply)
+                    {
+                        onUpgradeRead(error, reply);
+                    });
+            });
+        return;
+    }
+
     if (!m_User.empty() && !m_Password.empty())
     {
         std::string body = cli_utils::build_user_pass_body(m_User, m_Password);
-        std::string req = cli_utils::build_request(common::cmd2string(common::cmd_t::USER_LOGIN),
-                "application/json", body);
-        sendRequest(input::cmd_t::LOGIN, req);
+        sendRequest(input::cmd_t::LOGIN, common::cmd_t::USER_LOGIN, body);
     }
 }
 
@@ -277,20 +325,33 @@ void Client::onHttpRead(const ConnectionError &error, const HttpReply &reply)
         return;
     }
 
-    if (reply._status != 200)
+    onResponse(reply._status, reply.body());
+}
+
+void Client::onResponse(int status, boost::string_ref body)
+{
+    if (status == 401 && !m_User.empty() && !m_Password.empty())
+    {
+        // token of session is expired: login again, command is not repeated
+        m_Ui->showMsg("session expired, login again");
+        sendRequest(input::cmd_t::LOGIN, common::cmd_t::USER_LOGIN, cli_utils::build_user_pass_body(m_User, m_Password));
+        return;
+    }
+
+    if (status != 200)
     {
-        m_Ui->showMsg(std::to_string(reply._status));
-        m_Ui->showMsg(reply._body);
+        m_Ui->showMsg(std::to_string(status));
+        m_Ui->showMsg(body.to_string());
         return;
     }
 
-    logd2("reply: ", reply._body);
+    logd2("reply: ", body);
     m_Ui->showMsg("200 OK");
 
     if (m_LastCmd == input::cmd_t::LOGIN)
     {
         cli_utils::response_t resp;
-        std::string err = cli_utils::parse_response_aswer(m_LastCmd, reply._body, resp);
+        std::string err = cli_utils::parse_response_aswer(m_LastCmd, body, resp);
         if (!err.empty())
         {
             m_Ui->showMsg(err);
@@ -299,12 +360,9 @@ void Client::onHttpRead(const ConnectionError &error, const HttpReply &reply)
         m_SelfId     = resp.uid;
         m_SelfChatId = resp.chatid;
         m_HeartBit   = resp.heartbit;
+        m_Token      = resp.token;
 
-        if (!m_HttpIdle->isOpen())
-        {
-            m_HttpIdle->asyncConnect(m_Host, m_Port,
-                boost::bind(&Client::onHttpIdleConnect, this, boost::asio::placeholders::error));
-        }
+        startIdle();
     }
     else if (m_LastCmd == input::cmd_t::DIRECT_MSG_USER)
     {
@@ -312,7 +370,7 @@ void Client::onHttpRead(const ConnectionError &error, const HttpReply &reply)
     else if (m_LastCmd == input::cmd_t::HISTORY_USER)
     {
         std::vector<cli_utils::msg_response_t> response;
-        std::string err = cli_utils::parse_msg_response(input::cmd_t::NONE, reply._body, response);
+        std::string err = cli_utils::parse_msg_response(input::cmd_t::NONE, body, response);
         if (!err.empty())
         {
             m_Ui->showMsg("error: " + err);
@@ -332,7 +390,7 @@ void Client::onHttpRead(const ConnectionError &error, const HttpReply &reply)
     else if (m_LastCmd == input::cmd_t::STATUS_USER)
     {
         cli_utils::response_t resp;
-        std::string err = cli_utils::parse_response_aswer(m_LastCmd, reply._body, resp);
+        std::string err = cli_utils::parse_response_aswer(m_LastCmd, body, resp);
         if (!err.empty())
         {
             m_Ui->showMsg(err);
@@ -356,6 +414,27 @@ void Client::onHttpRead(const ConnectionError &error, const HttpReply &reply)
     }
 }
 
+void Client::onPush(boost::string_ref body)
+{
+    logd2("+msg: ", body);
+    std::vector<cli_utils::msg_response_t> response;
+    std::string err = cli_utils::parse_msg_response(input::cmd_t::NONE, body, response);
+    if (!err.empty())
+    {
+        m_Ui->showMsg("error: " + err);
+        return;
+    }
+
+    for (const auto &r : response)
+    {
+        ui::Message msg;
+        msg.from = r.from;
+        msg.to = r.to;
+        msg.message = r.msg;
+        m_Ui->showMsg(msg);
+    }
+}
+
 void Client::onHttpIdleConnect(const ConnectionError &e)
 {
     if (e.code)
@@ -368,9 +447,9 @@ void Client::onHttpIdleConnect(const ConnectionError &e)
         return;
     }
 
-    std::string body = cli_utils::build_user_send_msg_body(m_SelfId, m_HeartBit, "", "", m_Password);
+    std::string body = cli_utils::build_user_send_msg_body(m_SelfId, m_HeartBit, "", "", m_Token);
     std::string req = cli_utils::build_request(common::cmd2string(common::cmd_t::IDLE),
-                                                    "application/json", body);
+                                                    "application/json", body, "text/event-stream");
 
     m_HttpIdle->asyncRequest(req, [this](const ConnectionError &error)
                                   {
@@ -411,11 +490,14 @@ void Client::onHttpIdleRead(const ConnectionError &error, const HttpReply &reply
     if (is_error)
     {
         m_Ui->showMsg("connection is broken, please relogin");
-        m_IdleState = false;
-        m_HttpIdle = createConnect(m_Ssl);
-        m_Http = createConnect(m_Ssl);
-        m_Http->asyncConnect(m_Host, m_Port,
-                boost::bind(&Client::onHttpConnect, this, boost::asio::placeholders::error));
+        reconnect();
+        return;
+    }
+
+    if (reply.getHeader(http::header_t::CONTENT_TYPE) == "text/event-stream")
+    {
+        // one endless response, ack and pushes are its events
+        readIdleEvents();
         return;
     }
 
@@ -424,28 +506,11 @@ void Client::onHttpIdleRead(const ConnectionError &error, const HttpReply &reply
         // after connect, server should answer with 200 OK status,
         // so this is not message, just ack
         m_IdleState = true;
-        logd2("+IDLE: ", reply._body);
+        logd2("+IDLE: ", reply.body());
     }
     else
     {
-        logd2("+msg: ", reply._body);
-        std::vector<cli_utils::msg_response_t> response;
-        std::string err = cli_utils::parse_msg_response(input::cmd_t::NONE, reply._body, response);
-        if (!err.empty())
-        {
-            m_Ui->showMsg("error: " + err);
-        }
-        else
-        {
-            for (const auto &r : response)
-            {
-                ui::Message msg;
-                msg.from = r.from;
-                msg.to = r.to;
-                msg.message = r.msg;
-                m_Ui->showMsg(msg);
-            }
-        }
+        onPush(reply.body());
     }
 
     // start idle
@@ -456,3 +521,148 @@ void Client::onHttpIdleRead(const ConnectionError &error, const HttpReply &reply
         });
 }
 
+void Client::readIdleEvents()
+{
+    m_HttpIdle->asyncReadChunk(
+        [this](const ConnectionError &error, boost::string_ref chunk)
+        {
+            onIdleEvents(error, chunk);
+        });
+}
+
+void Client::onIdleEvents(const ConnectionError &error, boost::string_ref chunk)
+/*
+ *  chunk of event stream: "data: {...}\n\n" events, ":\n\n" is ping
+ */
+{
+    if (error.code)
+    {
+        f::loge("http idle events [e: {0}]", error.asString());
+        m_Ui->showMsg("connection is broken, please relogin");
+        reconnect();
+        return;
+    }
+
+    while (!chunk.empty())
+    {
+        size_t end = chunk.find("\n\n");
+        boost::string_ref event = chunk.substr(0, end);
+        chunk.remove_prefix(end == boost::string_ref::npos ? chunk.size() : end + 2);
+
+        const char data[] = "data: ";
+        if (event.starts_with("event: error\n"))
+        {
+            f::loge("http idle error event: {0}", event);
+        }
+        else if (event.starts_with(data))
+        {
+            event.remove_prefix(sizeof(data) - 1);
+            onIdleEvent(event);
+        }
+    }
+
+    readIdleEvents();
+}
+
+void Client::onIdleEvent(boost::string_ref data)
+{
+    if (!m_IdleState)
+    {
+        // the first event is ack of idle request
+        m_IdleState = true;
+        logd2("+IDLE: ", data);
+        return;
+    }
+    onPush(data);
+}
+
+void Client::onUpgradeRead(const ConnectionError &error, const HttpReply &reply)
+{
+    m_Timeout.cancel();
+
+    if (error.code)
+    {
+        f::loge("websocket upgrade read [e: {0}]", error.asString());
+        reconnect();
+        return;
+    }
+
+    if (reply._status != 101 ||
+        reply.getHeader(http::header_t::SEC_WEBSOCKET_ACCEPT) != websocket::accept_key(m_WsKey))
+    {
+        f::loge("websocket upgrade is refused [status: {0}]", reply._status);
+        m_Ui->showMsg("server does not accept websocket: " + std::to_string(reply._status));
+        return;
+    }
+
+    bool deflate = websocket::deflate_offered(reply.getHeader(http::header_t::SEC_WEBSOCKET_EXTENSIONS));
+    m_Http->startWebSocket(true, deflate);
+    logi("websocket is started, deflate: ", deflate);
+    readMessage();
+
+    if (!m_User.empty() && !m_Password.empty())
+    {
+        std::string body = cli_utils::build_user_pass_body(m_User, m_Password);
+        sendRequest(input::cmd_t::LOGIN, common::cmd_t::USER_LOGIN, body);
+    }
+}
+
+void Client::readMessage()
+{
+    m_Http->asyncReadMessage(
+        [this](const ConnectionError &error, boost::string_ref message)
+        {
+            onMessage(error, message);
+        });
+}
+
+void Client::onMessage(const ConnectionError &error, boost::string_ref message)
+/*
+ *  server message: "<status> <resource>\n<json>" - response, "push\n<json>" - new messages
+ */
+{
+    if (error.code)
+    {
+        f::loge("websocket read [e: {0}]", error.asString());
+        m_Ui->showMsg("connection is broken, please relogin");
+        reconnect();
+        return;
+    }
+
+    size_t pos = message.find('\n');
+    boost::string_ref head = message.substr(0, pos);
+    boost::string_ref body = pos == boost::string_ref::npos ? boost::string_ref() : message.substr(pos + 1);
+
+    if (head == "push")
+    {
+        onPush(body);
+    }
+    else
+    {
+        size_t space = head.find(' ');
+        int status = atoi(head.substr(0, space).to_string().c_str());
+        boost::string_ref resource = space == boost::string_ref::npos ? boost::string_ref() : head.substr(space + 1);
+
+        if (resource == common::cmd2string(common::cmd_t::IDLE))
+        {
+            // ack of idle: pushes go over this connection since now
+            m_IdleState = status == 200;
+            logd2("+IDLE: ", body);
+        }
+        else
+        {
+            onResponse(status, body);
+        }
+    }
+
+    readMessage();
+}
+
+void Client::reconnect()
+{
+    m_IdleState = false;
+    m_HttpIdle = createConnect(m_Ssl);
+    m_Http = createConnect(m_Ssl);
+    m_Http->asyncConnect(m_Host, m_Port,
+            boost::bind(&Client::onHttpConnect, this, boost::asio::placeholders::error));
+}
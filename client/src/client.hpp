@@ -15,7 +15,7 @@
 class Client: private boost::noncopyable
 {
 public:
-    Client(const std::string& address, int port, const std::string &user, const std::string &password);
+    Client(const std::string& address, int port, const std::string &user, const std::string &password, bool websocket);
     ~Client();
 
     void run();
@@ -38,16 +38,29 @@ private:
 
 private:
     void onUserInput(Event &&e);
-    void sendRequest(input::cmd_t cmd, const std::string &req);
+    void sendRequest(input::cmd_t cmd, common::cmd_t api_cmd, const std::string &body);
+    void sendMessage(common::cmd_t api_cmd, const std::string &body);
+    void startIdle();
 
 private:
     void onHttpConnect(const ConnectionError &e);
     void onHttpWrite(const ConnectionError &error);
     void onHttpRead(const ConnectionError &error, const HttpReply &reply);
+    void onResponse(int status, boost::string_ref body);
+    void onPush(boost::string_ref body);
 
     void onHttpIdleConnect(const ConnectionError &e);
     void onHttpIdleWrite(const ConnectionError &error);
     void onHttpIdleRead(const ConnectionError &error, const HttpReply &reply);
+    void readIdleEvents();
+    void onIdleEvents(const ConnectionError &error, boost::string_ref chunk);
+    void onIdleEvent(boost::string_ref data);
+
+    // websocket mode: commands, responses and pushes go over one connection
+    void onUpgradeRead(const ConnectionError &error, const HttpReply &reply);
+    void readMessage();
+    void onMessage(const ConnectionError &error, boost::string_ref message);
+    void reconnect();
 
 private:
     boost::shared_ptr<AsyncHttpClient> createConnect(bool use_ssl);
@@ -63,6 +76,8 @@ private:
     bool m_TimedOut;
     bool m_Ssl       = true;
     bool m_IdleState = false;
+    bool m_WebSocket = false;
+    std::string m_WsKey;                    // of upgrade request
 
     std::unique_ptr<AbstractUi> m_Ui;
     EventsWorker m_EvWorker;
@@ -72,7 +87,8 @@ private:
 
     input::cmd_t m_LastCmd = input::cmd_t::NONE;
     std::string m_User;
-    std::string m_Password;
+    std::string m_Password;                 // is sent only by login, next requests carry token of session
+    std::string m_Token;
     uint64_t m_SelfId     = 0;
     uint64_t m_SelfChatId = 0;
     uint64_t m_HeartBit   = 0;
@@ -19,7 +19,8 @@ std::ostream& operator<<(std::ostream &os, const Event &ev)
 }
 
 EventsWorker::EventsWorker(size_t workers) :
-    m_Workers(workers)
+    m_Workers(workers),
+    m_Queue(1024)
 {
 }
 
@@ -38,9 +39,8 @@ void EventsWorker::processQueue()
     while (!g_NeedStop)
     {
         Event event;
-        if (!m_Queue.getTask(event))
+        if (!m_Queue.pop(event, std::chrono::milliseconds(1000)))
         {
-            std::this_thread::sleep_for(std::chrono::milliseconds(10));
             continue;
         }
 
@@ -65,6 +65,11 @@ void EventsWorker::run()
     }
 }
 
+void EventsWorker::stop()
+{
+    m_Queue.wakeAll();
+}
+
 void EventsWorker::join()
 {
     for (auto &thread : m_Threads)
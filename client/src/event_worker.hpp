@@ -1,8 +1,9 @@
 #pragma once
 
 #include <thread>
+#include <vector>
 
-#include "common/lock_queue.hpp"
+#include "common/mpmc_queue.hpp"
 
 
 namespace event
@@ -43,6 +44,7 @@ public:
     EventsWorker(size_t workers);
     void putEvent(Event &&event);
     void run();
+    void stop();
     void join();
     void registerOnInputCallback(std::function<void(Event &&event)> &&callback);
 
@@ -51,7 +53,7 @@ private:
 
 private:
     size_t m_Workers;
-    Queue<Event> m_Queue;
+    MpmcQueue<Event> m_Queue;
     std::vector<std::thread> m_Threads;
 
     std::function<void(Event &&event)> m_OnUserInput;
@@ -46,6 +46,7 @@ int main(int argc, char *argv[])
     opt->add("syslog", "", "write logs into syslog", false);
     opt->add("user", "u", "user", "");
     opt->add("password", "p", "password", "");
+    opt->add("websocket", "", "one websocket connection instead of two http ones", false);
 
     try
     {
@@ -75,7 +76,8 @@ int main(int argc, char *argv[])
         Client c(ip_parts[0],
                  std::stoi(ip_parts[1]),
                  opt->get<std::string>("user"),
-                 opt->get<std::string>("password"));
+                 opt->get<std::string>("password"),
+                 opt->get<bool>("websocket"));
         c.run();
     }
     catch (const std::exception &e)
@@ -1,7 +1,13 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
 #include <string>
 
+#include <strings.h>
+
+#include <boost/utility/string_ref.hpp>
+
 namespace common
 {
 
@@ -25,25 +31,178 @@ enum class cmd_t : uint16_t
     CMD_LAST
 };
 
+// what server does with request of route
+enum class route_t : uint8_t
+{
+    API,            // body is parsed and request goes to database worker
+    IDLE,           // connection gets pushes after answer
+    WEBSOCKET,      // connection is upgraded
+    RESERVED        // resource is known, but it is not served yet
+};
+
+// parameters of request body, bit mask
+enum param_t : uint16_t
+{
+    P_NONE      = 0,
+    P_PASSWORD  = 1 << 0,
+    P_USER      = 1 << 1,
+    P_UID       = 1 << 2,
+    P_CHATNAME  = 1 << 3,
+    P_ADDUSER   = 1 << 4,
+    P_MESSAGE   = 1 << 5,
+    P_TO        = 1 << 6,
+    P_HEARTBIT  = 1 << 7,
+    P_COUNT     = 1 << 8,
+    P_TOKEN     = 1 << 9,
+
+    // request of logged in user: session token or, as before sessions, password
+    P_CREDENTIALS = P_PASSWORD | P_TOKEN
+};
+
+struct Route
+{
+    const char *resource;
+    const char *method;
+    cmd_t cmd;
+    route_t kind;
+    uint16_t required;      // param_t
+    uint16_t optional;
+};
+
+/*
+ * All endpoints of api: the only place, where resource is bound to command,
+ * its handling and parameters. Server finds route by perfect hash of resource,
+ * which is built at compile time, client takes resource of command from here.
+ */
+constexpr Route ROUTES[] = {
+    { "/v1/message/send",     "post", cmd_t::MESSAGE_SEND,      route_t::API,       P_UID | P_MESSAGE | P_TO,                    P_CREDENTIALS },
+    { "/v1/message/sendchat", "post", cmd_t::MESSAGE_SEND_CHAT, route_t::API,       P_UID | P_MESSAGE | P_CHATNAME,              P_CREDENTIALS },
+    { "/v1/user/create",      "post", cmd_t::USER_CREATE,       route_t::API,       P_PASSWORD | P_USER,                         P_NONE },
+    { "/v1/user/login",       "post", cmd_t::USER_LOGIN,        route_t::API,       P_PASSWORD | P_USER,                         P_NONE },
+    { "/v1/user/history",     "post", cmd_t::USER_HISTORY,      route_t::API,       P_UID | P_USER,                              P_CREDENTIALS | P_COUNT },
+    { "/v1/user/status",      "post", cmd_t::USER_STATUS,       route_t::API,       P_UID | P_USER,                              P_CREDENTIALS | P_COUNT },
+    { "/v1/chat/create",      "post", cmd_t::CHAT_CREATE,       route_t::API,       P_UID | P_CHATNAME,                          P_CREDENTIALS },
+    { "/v1/group/history",    "post", cmd_t::CHAT_HISTORY,      route_t::API,       P_UID,                                       P_CREDENTIALS },
+    { "/v1/chat/status",      "post", cmd_t::CHAT_STATUS,       route_t::RESERVED,  P_NONE,                                      P_NONE },
+    { "/v1/chat/adduser",     "post", cmd_t::CHAT_ADDUSER,      route_t::API,       P_UID | P_CHATNAME | P_ADDUSER,              P_CREDENTIALS },
+    { "/v1/message/recent",   "post", cmd_t::MESSAGE_RECENT,    route_t::RESERVED,  P_NONE,                                      P_NONE },
+    { "/v1/idle",             "post", cmd_t::IDLE,              route_t::IDLE,      P_UID,                                       P_CREDENTIALS | P_HEARTBIT },
+    { "/v1/ws",               "get",  cmd_t::CMD_LAST,          route_t::WEBSOCKET, P_NONE,                                      P_NONE },
+};
+
+constexpr size_t ROUTE_COUNT = sizeof(ROUTES) / sizeof(ROUTES[0]);
+constexpr size_t ROUTE_SLOTS = 32;      // power of two
+
+namespace detail
+{
+
+constexpr char lower(char c)
+{
+    return c >= 'A' && c <= 'Z' ? static_cast<char>(c + ('a' - 'A')) : c;
+}
+
+constexpr size_t length(const char *s)
+{
+    size_t size = 0;
+    while (s[size])
+    {
+        ++size;
+    }
+    return size;
+}
+
+// fnv-1a of lowercased resource, seed is chosen so that routes do not collide
+constexpr uint32_t route_hash(const char *s, size_t size, uint32_t seed)
+{
+    uint32_t h = 2166136261u ^ seed;
+    for (size_t i = 0; i < size; ++i)
+    {
+        h = (h ^ static_cast<uint8_t>(lower(s[i]))) * 16777619u;
+    }
+    return h;
+}
+
+constexpr size_t route_slot(const char *s, size_t size, uint32_t seed)
+{
+    return route_hash(s, size, seed) & (ROUTE_SLOTS - 1);
+}
+
+constexpr bool is_perfect(uint32_t seed)
+{
+    bool used[ROUTE_SLOTS] = {};
+    for (size_t i = 0; i < ROUTE_COUNT; ++i)
+    {
+        size_t slot = route_slot(ROUTES[i].resource, length(ROUTES[i].resource), seed);
+        if (used[slot])
+        {
+            return false;
+        }
+        used[slot] = true;
+    }
+    return true;
+}
+
+constexpr uint32_t find_seed()
+{
+    uint32_t seed = 0;
+    while (!is_perfect(seed))
+    {
+        ++seed;
+    }
+    return seed;
+}
+
+struct RouteIndex
+{
+    uint8_t slots[ROUTE_SLOTS];                                 // route + 1, 0 - empty slot
+    uint8_t commands[static_cast<size_t>(cmd_t::CMD_LAST)];     // route + 1 by command
+};
+
+constexpr RouteIndex make_index(uint32_t seed)
+{
+    RouteIndex index = {};
+    for (size_t i = 0; i < ROUTE_COUNT; ++i)
+    {
+        index.slots[route_slot(ROUTES[i].resource, length(ROUTES[i].resource), seed)] = i + 1;
+        if (ROUTES[i].cmd != cmd_t::CMD_LAST)
+        {
+            index.commands[static_cast<size_t>(ROUTES[i].cmd)] = i + 1;
+        }
+    }
+    return index;
+}
+
+constexpr uint32_t ROUTE_SEED = find_seed();
+constexpr RouteIndex ROUTE_INDEX = make_index(ROUTE_SEED);
+
+}   // namespace detail
+
+// case-insensitive, without allocations; nullptr - unknown resource
+inline const Route *find_route(boost::string_ref resource)
+{
+    uint8_t i = detail::ROUTE_INDEX.slots[detail::route_slot(resource.data(), resource.size(), detail::ROUTE_SEED)];
+    if (i == 0)
+    {
+        return nullptr;
+    }
+
+    const Route &route = ROUTES[i - 1];
+    if (detail::length(route.resource) != resource.size() ||
+        ::strncasecmp(route.resource, resource.data(), resource.size()) != 0)
+    {
+        return nullptr;
+    }
+    return &route;
+}
+
 inline std::string cmd2string(common::cmd_t cmd)
 {
-    switch (cmd)
-    {
-        case cmd_t::MESSAGE_SEND:        return "/v1/message/send";
-        case cmd_t::MESSAGE_SEND_CHAT:   return "/v1/message/sendchat";
-        case cmd_t::USER_CREATE:         return "/v1/user/create";
-        case cmd_t::USER_LOGIN:          return "/v1/user/login";
-        case cmd_t::CHAT_CREATE:         return "/v1/chat/create";
-        case cmd_t::USER_HISTORY:        return "/v1/user/history";
-        case cmd_t::CHAT_HISTORY:        return "/v1/group/history";
-        case cmd_t::USER_STATUS:         return "/v1/user/status";
-        case cmd_t::CHAT_STATUS:         return "/v1/chat/status";
-        case cmd_t::CHAT_ADDUSER:        return "/v1/chat/adduser";
-        case cmd_t::MESSAGE_RECENT:      return "/v1/message/recent";
-        case cmd_t::IDLE:                return "/v1/idle";
-        case cmd_t::CMD_LAST:            return "undefined_cmd";
-    };
-    return "undefined_cmd";
+    size_t c = static_cast<size_t>(cmd);
+    if (c >= static_cast<size_t>(cmd_t::CMD_LAST) || detail::ROUTE_INDEX.commands[c] == 0)
+    {
+        return "undefined_cmd";
+    }
+    return ROUTES[detail::ROUTE_INDEX.commands[c] - 1].resource;
 }
 
 enum class ApiStatusCode: uint16_t
@@ -1,31 +1,80 @@
 #pragma once
 
+#include <array>
+#include <cstdint>
+#include <string>
 
-namespace
+#include <boost/utility/string_ref.hpp>
+
+
+namespace http
+{
+
+// headers, which are interned by parser; others are kept only as raw views
+enum class header_t : uint8_t
 {
-    std::function<bool(const std::string&, const std::string&)> string_comparator =
-                            [](const std::string &lhs, const std::string &rhs)
-                            {
-                                return ::strcasecmp(lhs.c_str(), rhs.c_str()) < 0;
-                            };
-}
+    CONTENT_LENGTH,
+    CONTENT_TYPE,
+    TRANSFER_ENCODING,
+    CONTENT_ENCODING,
+    ACCEPT,
+
+    // websocket upgrade
+    UPGRADE,
+    SEC_WEBSOCKET_KEY,
+    SEC_WEBSOCKET_ACCEPT,
+    SEC_WEBSOCKET_EXTENSIONS,
+
+    COUNT
+};
+
+}   // namespace http
 
 
 struct HttpReply
 {
-    HttpReply() : _status(0), _parsedHeaders(string_comparator) {}
+    HttpReply() : _status(0) {}
+
+    bool hasHeader(http::header_t header) const { return _hasHeader[static_cast<size_t>(header)]; }
+    const std::string &getHeader(http::header_t header) const { return _knownHeaders[static_cast<size_t>(header)]; }
 
-    bool hasHeader(const std::string &header) const;
-    std::string getHeader(const std::string &header) const;
-    std::string asString() const { return _headers + std::string("\n\n") + _body; }
+    // keeps capacity of strings, so reply could be reused for next message
+    void clear()
+    {
+        _status = 0;
+        _bodyView.clear();
+        _bodyStorage.clear();
+        _method.clear();
+        _resource.clear();
+        _hasHeader.fill(false);
+        for (auto &header : _knownHeaders)
+        {
+            header.clear();
+        }
+    }
+
+    void shrinkToFit()
+    {
+        clear();
+        std::string().swap(_bodyStorage);
+        std::string().swap(_method);
+        std::string().swap(_resource);
+        for (auto &header : _knownHeaders)
+        {
+            std::string().swap(header);
+        }
+    }
+
+    // NB: usually points into receive buffer, so it is valid only inside of response handler
+    boost::string_ref body() const { return _bodyStorage.empty() ? _bodyView : boost::string_ref(_bodyStorage); }
 
     int _status;
-    std::string _headers;
-    std::string _body;
+    boost::string_ref _bodyView;        // content-length body, as received
+    std::string _bodyStorage;           // body, which was assembled from chunks or unzipped
 
     std::string _method;
     std::string _resource;
 
-    std::map<std::string, std::string, std::function<bool(const std::string&, const std::string&)>> _parsedHeaders;
+    std::array<bool, static_cast<size_t>(http::header_t::COUNT)> _hasHeader{};
+    std::array<std::string, static_cast<size_t>(http::header_t::COUNT)> _knownHeaders;
 };
-
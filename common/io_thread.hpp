@@ -1,8 +1,12 @@
 #pragma once
 
 #include <boost/asio/io_service.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <atomic>
 #include <thread>
+#include <time.h>
 
+#include "timer_wheel.hpp"
 #include "o2logger/src/o2logger.hpp"
 using namespace o2logger;
 
@@ -10,19 +14,11 @@ using namespace o2logger;
 class IoThread
 {
 public:
-    explicit IoThread(const std::string &sert) :
-        m_Context(m_IoService, boost::asio::ssl::context::sslv23),
+    IoThread() :
+        m_LoadTimer(m_IoService),
+        m_Timers(m_IoService),
         m_Redbull(m_IoService)
     {
-        m_Context.set_options(boost::asio::ssl::context::default_workarounds
-            | boost::asio::ssl::context::no_sslv2
-            | boost::asio::ssl::context::single_dh_use);
-
-        if (!sert.empty())
-        {
-            m_Context.use_certificate_chain_file(sert);
-            m_Context.use_private_key_file(sert, boost::asio::ssl::context::pem);
-        }
     }
 
     boost::asio::io_service &ioService()
@@ -30,14 +26,30 @@ public:
         return m_IoService;
     }
 
-    boost::asio::ssl::context &sslContext()
+    // timers of connections, served by the thread
+    TimerWheel &timers()
     {
-        return m_Context;
+        return m_Timers;
     }
 
+    /*
+     * Load of thread: count of live connections and cpu time,
+     * spent by thread in handlers during last seconds (thread sleeps in epoll otherwise)
+     */
+    void connectionOpened() { ++m_Connections; }
+    void connectionClosed() { --m_Connections; }
+    uint64_t connections() const { return m_Connections; }
+    uint64_t busyUsPerSec() const { return m_BusyUsPerSec; }
+
+    // every millisecond of cpu per second costs as one connection
+    uint64_t loadScore() const { return m_Connections + m_BusyUsPerSec / 1000; }
+
     void start()
     {
         m_IoService.reset();
+        m_LoadTimer.expires_from_now(std::chrono::seconds(1));
+        m_LoadTimer.async_wait([this](const boost::system::error_code &e) { measureLoad(e); });
+
         m_Thread = std::thread(
             [this]()
             {
@@ -59,6 +71,28 @@ public:
     }
 
 private:
+    void measureLoad(const boost::system::error_code &e)
+    {
+        if (e == boost::asio::error::operation_aborted)
+        {
+            return;
+        }
+
+        // runs in the io thread itself, so thread cpu clock is clock of this thread
+        struct timespec ts;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        uint64_t cpu_us = ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+
+        if (m_LastCpuUs)
+        {
+            m_BusyUsPerSec = (m_BusyUsPerSec + (cpu_us - m_LastCpuUs)) / 2;
+        }
+        m_LastCpuUs = cpu_us;
+
+        m_LoadTimer.expires_from_now(std::chrono::seconds(1));
+        m_LoadTimer.async_wait([this](const boost::system::error_code &e) { measureLoad(e); });
+    }
+
     void run()
     {
         while (!m_IoService.stopped())
@@ -83,8 +117,14 @@ private:
     }
 
 private:
+    // NB: declared before io service - connections could be closed while io service is destroyed
+    std::atomic<uint64_t> m_Connections{0};
+    std::atomic<uint64_t> m_BusyUsPerSec{0};
+    uint64_t m_LastCpuUs = 0;
+
     boost::asio::io_service m_IoService;
-    boost::asio::ssl::context m_Context;
+    boost::asio::steady_timer m_LoadTimer;
+    TimerWheel m_Timers;                    // NB: after io service, releases connections before it
 
     std::thread m_Thread;
 
@@ -0,0 +1,263 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <climits>
+#include <cstdint>
+
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+/*
+ * Bounded lock-free multi-producer/multi-consumer queue (D. Vyukov's scheme).
+ * Items are only moved in and out. Consumers sleep on futex while queue is empty,
+ * producers - while it is full, so there is no polling.
+ */
+template<typename T>
+class MpmcQueue
+{
+public:
+    explicit MpmcQueue(size_t capacity);           // rounded up to power of two
+    MpmcQueue(const MpmcQueue &) = delete;
+    MpmcQueue &operator=(const MpmcQueue &) = delete;
+
+    // t is moved only if true is returned
+    bool tryPush(T &&t);
+    bool tryPop(T &t);
+
+    void push(T &&t);                               // wait while queue is full
+    bool pop(T &t, std::chrono::milliseconds timeout);
+
+    void wakeAll();
+
+private:
+    struct Cell
+    {
+        std::atomic<size_t> seq;
+        T data;
+    };
+
+    static constexpr size_t CACHELINE = 64;
+
+    static void futexWait(std::atomic<int> &word, int expected, std::chrono::nanoseconds timeout);
+    static void futexWake(std::atomic<int> &word, int count);
+
+    static void notify(std::atomic<int> &word, std::atomic<int> &waiters);
+
+    template<class Ready>
+    static bool wait(std::atomic<int> &word, std::atomic<int> &waiters,
+                     std::chrono::steady_clock::time_point deadline, Ready ready);
+
+private:
+    std::unique_ptr<Cell[]> m_Cells;
+    size_t m_Mask;
+
+    char m_Pad0[CACHELINE];
+    std::atomic<size_t> m_Head;                     // push position
+    char m_Pad1[CACHELINE];
+    std::atomic<size_t> m_Tail;                     // pop position
+    char m_Pad2[CACHELINE];
+
+    std::atomic<int> m_NotEmpty;                    // futex words, changed on each push/pop
+    std::atomic<int> m_PopWaiters;
+    std::atomic<int> m_NotFull;
+    std::atomic<int> m_PushWaiters;
+};
+
+
+// implementation
+
+template<typename T>
+MpmcQueue<T>::MpmcQueue(size_t capacity) :
+    m_Head(0),
+    m_Tail(0),
+    m_NotEmpty(0),
+    m_PopWaiters(0),
+    m_NotFull(0),
+    m_PushWaiters(0)
+{
+    size_t size = 2;
+    while (size < capacity)
+    {
+        size <<= 1;
+    }
+
+    m_Cells.reset(new Cell[size]);
+    m_Mask = size - 1;
+
+    for (size_t i = 0; i < size; ++i)
+    {
+        m_Cells[i].seq.store(i, std::memory_order_relaxed);
+    }
+}
+
+template<typename T>
+bool MpmcQueue<T>::tryPush(T &&t)
+{
+    Cell *cell = nullptr;
+    size_t pos = m_Head.load(std::memory_order_relaxed);
+    for (;;)
+    {
+        cell = &m_Cells[pos & m_Mask];
+        size_t seq = cell->seq.load(std::memory_order_acquire);
+        intptr_t dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+        if (dif == 0)
+        {
+            if (m_Head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (dif < 0)
+        {
+            return false;       // full
+        }
+        else
+        {
+            pos = m_Head.load(std::memory_order_relaxed);
+        }
+    }
+
+    cell->data = std::move(t);
+    cell->seq.store(pos + 1, std::memory_order_release);
+
+    notify(m_NotEmpty, m_PopWaiters);
+    return true;
+}
+
+template<typename T>
+bool MpmcQueue<T>::tryPop(T &t)
+{
+    Cell *cell = nullptr;
+    size_t pos = m_Tail.load(std::memory_order_relaxed);
+    for (;;)
+    {
+        cell = &m_Cells[pos & m_Mask];
+        size_t seq = cell->seq.load(std::memory_order_acquire);
+        intptr_t dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+        if (dif == 0)
+        {
+            if (m_Tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (dif < 0)
+        {
+            return false;       // empty
+        }
+        else
+        {
+            pos = m_Tail.load(std::memory_order_relaxed);
+        }
+    }
+
+    t = std::move(cell->data);
+    cell->seq.store(pos + m_Mask + 1, std::memory_order_release);
+
+    notify(m_NotFull, m_PushWaiters);
+    return true;
+}
+
+template<typename T>
+void MpmcQueue<T>::push(T &&t)
+{
+    if (tryPush(std::move(t)))
+    {
+        return;
+    }
+
+    for (;;)
+    {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(100);
+        if (wait(m_NotFull, m_PushWaiters, deadline, [this, &t]() { return tryPush(std::move(t)); }))
+        {
+            return;
+        }
+    }
+}
+
+template<typename T>
+bool MpmcQueue<T>::pop(T &t, std::chrono::milliseconds timeout)
+{
+    if (tryPop(t))
+    {
+        return true;
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    return wait(m_NotEmpty, m_PopWaiters, deadline, [this, &t]() { return tryPop(t); });
+}
+
+template<typename T>
+void MpmcQueue<T>::wakeAll()
+{
+    m_NotEmpty.fetch_add(1);
+    m_NotFull.fetch_add(1);
+    futexWake(m_NotEmpty, INT_MAX);
+    futexWake(m_NotFull, INT_MAX);
+}
+
+template<typename T>
+void MpmcQueue<T>::notify(std::atomic<int> &word, std::atomic<int> &waiters)
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    word.fetch_add(1, std::memory_order_relaxed);
+    if (waiters.load(std::memory_order_relaxed))
+    {
+        futexWake(word, 1);
+    }
+}
+
+template<typename T>
+template<class Ready>
+bool MpmcQueue<T>::wait(std::atomic<int> &word, std::atomic<int> &waiters,
+                        std::chrono::steady_clock::time_point deadline, Ready ready)
+/*
+ *  word is read before the last check of the queue: if other side changes queue
+ *  after that, futex will not fall asleep
+ */
+{
+    for (;;)
+    {
+        int expected = word.load(std::memory_order_relaxed);
+
+        waiters.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (ready())
+        {
+            waiters.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if (now >= deadline)
+        {
+            waiters.fetch_sub(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        futexWait(word, expected, deadline - now);
+        waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+}
+
+template<typename T>
+void MpmcQueue<T>::futexWait(std::atomic<int> &word, int expected, std::chrono::nanoseconds timeout)
+{
+    struct timespec ts;
+    ts.tv_sec = timeout.count() / 1000000000;
+    ts.tv_nsec = timeout.count() % 1000000000;
+
+    ::syscall(SYS_futex, reinterpret_cast<int *>(&word), FUTEX_WAIT_PRIVATE, expected, &ts, nullptr, 0);
+}
+
+template<typename T>
+void MpmcQueue<T>::futexWake(std::atomic<int> &word, int count)
+{
+    ::syscall(SYS_futex, reinterpret_cast<int *>(&word), FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+}
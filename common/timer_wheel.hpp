@@ -0,0 +1,289 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <utility>
+
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+
+
+class TimerWheel;
+
+/*
+ * Timer of connection (ping, read deadline...), which is kept by TimerWheel of its io thread.
+ * Callback is set once, arm and cancel are O(1) and do not allocate.
+ */
+class WheelTimer: private boost::noncopyable
+{
+public:
+    typedef std::function<void()> callback_t;
+
+public:
+    WheelTimer() = default;
+    explicit WheelTimer(callback_t callback) : m_Callback(std::move(callback)) {}
+    ~WheelTimer();
+
+    void setCallback(callback_t callback) { m_Callback = std::move(callback); }
+    bool armed() const { return m_Next != nullptr; }
+
+private:
+    friend class TimerWheel;
+
+    void unlink()
+    {
+        if (m_Next)
+        {
+            m_Prev->m_Next = m_Next;
+            m_Next->m_Prev = m_Prev;
+            m_Prev = m_Next = nullptr;
+        }
+    }
+
+private:
+    TimerWheel *m_Wheel = nullptr;          // while armed
+    WheelTimer *m_Prev = nullptr;
+    WheelTimer *m_Next = nullptr;
+    uint64_t m_Expiry = 0;                  // tick
+    callback_t m_Callback;
+    boost::shared_ptr<void> m_Holder;       // owner of timer is alive while timer is armed
+};
+
+
+/*
+ * Hierarchical timing wheel (as old linux kernel timers): 4 levels of 64 slots,
+ * tick is 10 ms, so timers up to 46 hours are kept without overflow.
+ * Timers of near level are fired by tick, others are moved to lower level
+ * when wheel comes to their slot. One asio timer per wheel drives it,
+ * it ticks only while there are armed timers.
+ *
+ * Io thread only: timers are armed, cancelled and fired on io thread of wheel.
+ */
+class TimerWheel: private boost::noncopyable
+{
+public:
+    typedef std::chrono::milliseconds duration_t;
+
+    static const int LEVEL_BITS = 6;
+    static const int LEVELS = 4;
+    static const uint64_t SLOTS = 1 << LEVEL_BITS;
+    static const uint64_t MAX_TICKS = (uint64_t(1) << (LEVEL_BITS * LEVELS)) - 1;
+
+public:
+    explicit TimerWheel(boost::asio::io_service &io) :
+        m_Tick(io),
+        m_Start(std::chrono::steady_clock::now())
+    {
+        for (auto &level : m_Slots)
+        {
+            for (auto &slot : level)
+            {
+                slot.m_Prev = slot.m_Next = &slot;
+            }
+        }
+    }
+
+    ~TimerWheel()
+    {
+        // owners could be destroyed here, their timers are already unlinked
+        for (auto &level : m_Slots)
+        {
+            for (auto &slot : level)
+            {
+                while (slot.m_Next != &slot)
+                {
+                    WheelTimer *timer = slot.m_Next;
+                    timer->unlink();
+                    timer->m_Wheel = nullptr;
+                    --m_Armed;
+                    boost::shared_ptr<void> holder = std::move(timer->m_Holder);
+                }
+            }
+        }
+    }
+
+    static duration_t tick() { return duration_t(10); }
+
+    // re-arms armed timer; holder is released, when timer is fired or cancelled
+    void schedule(WheelTimer &timer, duration_t after, boost::shared_ptr<void> holder)
+    {
+        if (timer.armed())
+        {
+            timer.unlink();
+            --m_Armed;
+        }
+
+        uint64_t now = currentTick();
+        if (m_Armed == 0 && m_Now < now)
+        {
+            // wheel is empty, nothing to cascade on the way
+            m_Now = now;
+        }
+
+        uint64_t ticks = (after.count() + tick().count() - 1) / tick().count();
+        timer.m_Expiry = now + (ticks ? ticks : 1);
+        timer.m_Holder = std::move(holder);
+        timer.m_Wheel = this;
+        add(timer);
+
+        if (++m_Armed == 1 && !m_Ticking)
+        {
+            startTick();
+        }
+    }
+
+    // NB: owner could be destroyed here, if timer kept the last reference
+    void cancel(WheelTimer &timer)
+    {
+        if (!timer.armed())
+        {
+            return;
+        }
+        timer.unlink();
+        timer.m_Wheel = nullptr;
+        --m_Armed;
+        boost::shared_ptr<void> holder = std::move(timer.m_Holder);
+    }
+
+    size_t armed() const { return m_Armed; }
+
+    // moves wheel up to given tick, fires expired timers; public for tests and benchmarks
+    void advance(uint64_t to_tick)
+    {
+        while (m_Now <= to_tick)
+        {
+            uint64_t index = m_Now & (SLOTS - 1);
+            if (index == 0)
+            {
+                for (int level = 1; level < LEVELS; ++level)
+                {
+                    if (cascade(level, (m_Now >> (LEVEL_BITS * level)) & (SLOTS - 1)) != 0)
+                    {
+                        break;
+                    }
+                }
+            }
+            ++m_Now;
+
+            WheelTimer &slot = m_Slots[0][index];
+            while (slot.m_Next != &slot)
+            {
+                WheelTimer *timer = slot.m_Next;
+                timer->unlink();
+                timer->m_Wheel = nullptr;
+                --m_Armed;
+
+                // callback could arm timer again, holder keeps owner alive until it returns
+                boost::shared_ptr<void> holder = std::move(timer->m_Holder);
+                timer->m_Callback();
+            }
+        }
+    }
+
+    uint64_t currentTick() const
+    {
+        return std::chrono::duration_cast<duration_t>(std::chrono::steady_clock::now() - m_Start).count() / tick().count();
+    }
+
+private:
+    void add(WheelTimer &timer)
+    {
+        uint64_t expiry = timer.m_Expiry;
+        uint64_t delta = expiry >= m_Now ? expiry - m_Now : 0;
+        if (delta > MAX_TICKS)
+        {
+            delta = MAX_TICKS;
+            expiry = m_Now + MAX_TICKS;
+            timer.m_Expiry = expiry;
+        }
+
+        WheelTimer *slot = nullptr;
+        if (expiry < m_Now)
+        {
+            // late, fired by next tick
+            slot = &m_Slots[0][m_Now & (SLOTS - 1)];
+        }
+        else
+        {
+            int level = 0;
+            while (level < LEVELS - 1 && delta >= (uint64_t(1) << (LEVEL_BITS * (level + 1))))
+            {
+                ++level;
+            }
+            slot = &m_Slots[level][(expiry >> (LEVEL_BITS * level)) & (SLOTS - 1)];
+        }
+
+        timer.m_Prev = slot->m_Prev;
+        timer.m_Next = slot;
+        slot->m_Prev->m_Next = &timer;
+        slot->m_Prev = &timer;
+    }
+
+    // timers of slot are moved to lower levels, returns index of slot
+    uint64_t cascade(int level, uint64_t index)
+    {
+        WheelTimer &slot = m_Slots[level][index];
+
+        WheelTimer list;
+        if (slot.m_Next != &slot)
+        {
+            list.m_Next = slot.m_Next;
+            list.m_Prev = slot.m_Prev;
+            list.m_Next->m_Prev = &list;
+            list.m_Prev->m_Next = &list;
+            slot.m_Prev = slot.m_Next = &slot;
+        }
+
+        while (list.m_Next && list.m_Next != &list)
+        {
+            WheelTimer *timer = list.m_Next;
+            timer->unlink();
+            add(*timer);
+        }
+        list.m_Prev = list.m_Next = nullptr;
+        return index;
+    }
+
+    void startTick()
+    {
+        m_Ticking = true;
+        m_Tick.expires_from_now(tick());
+        m_Tick.async_wait([this](const boost::system::error_code &e)
+        {
+            m_Ticking = false;
+            if (e == boost::asio::error::operation_aborted)
+            {
+                return;
+            }
+
+            advance(currentTick());
+            if (m_Armed && !m_Ticking)
+            {
+                startTick();
+            }
+        });
+    }
+
+private:
+    boost::asio::steady_timer m_Tick;
+    std::chrono::steady_clock::time_point m_Start;
+
+    uint64_t m_Now = 0;                     // next tick to process
+    size_t m_Armed = 0;
+    bool m_Ticking = false;
+
+    WheelTimer m_Slots[LEVELS][SLOTS];      // list heads
+};
+
+
+// timer without holder could be destroyed armed
+inline WheelTimer::~WheelTimer()
+{
+    if (m_Wheel)
+    {
+        m_Wheel->cancel(*this);
+    }
+}
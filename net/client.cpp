@@ -1,9 +1,13 @@
 #include <boost/asio/steady_timer.hpp>
 #include <zlib.h>
+#include <algorithm>
 #include <mutex>
 
+#include <sys/socket.h>
+
 #include "net/client.hpp"
 #include "net/sync_connect.hpp"
+#include "net/ssl_session_cache.hpp"
 #include "common/utils.hpp"
 
 #include "o2logger/src/o2logger.hpp"
@@ -48,51 +52,6 @@ std::string addressToString(const boost::asio::ip::tcp::endpoint &endpoint, boos
     return endpoint.address().to_string(ec);
 }
 
-void read_completed(boost::asio::io_service& local_io,
-                    const boost::system::error_code& error,
-                    size_t transferred,
-                    size_t &bytes,
-                    boost::optional<boost::system::error_code> *result,
-                    boost::asio::steady_timer &timer)
-{
-    if (error == boost::asio::error::operation_aborted)
-    {
-        return;
-    }
-
-    timer.cancel();
-
-    result->reset(error);
-    if (!error)
-    {
-        bytes = transferred;
-    }
-
-    local_io.post([]() { /*dummy handler, just to notify local_io about read event*/ });
-}
-
-void timeout_expired(const boost::system::error_code &error,
-                     boost::asio::ip::tcp::socket::lowest_layer_type &socket,
-                     boost::optional<boost::system::error_code> *result,
-                     boost::asio::io_service &local_io)
-{
-    if (error == boost::asio::error::operation_aborted)
-    {
-        return;
-    }
-
-    socket.cancel();            // <-- do not do this concurrently with read handler
-    result->reset(error);
-    local_io.post([]() { /*dummy handler, just to notify local_io about timeout event*/ });
-}
-
-void read_from_buffer(boost::asio::streambuf& sbuf, std::string& resp, std::string const& delimiter, size_t bytes)
-{
-    boost::asio::streambuf::const_buffers_type bufs = sbuf.data();
-    resp.assign(boost::asio::buffers_begin(bufs), boost::asio::buffers_begin(bufs) + bytes - delimiter.size());
-    sbuf.consume(bytes);
-}
-
 void sync_connect(boost::asio::ip::tcp::socket::lowest_layer_type& socket, const std::string& host, int port, int timeout)
 {
     boost::asio::steady_timer timer(socket.get_io_service());
@@ -149,9 +108,16 @@ BasicTcpClient::BasicTcpClient(boost::asio::io_service &io, bool ssl, unsigned i
     m_IsOpen(false),
     m_Ssl(ssl),
     m_Backend(io),
-    m_SslContext(boost::asio::ssl::context::sslv23_client),
-    m_SslBackend(io, m_SslContext)
-{
+    m_SslContext(new boost::asio::ssl::context(boost::asio::ssl::context::sslv23_client)),
+    m_StreamContext(m_SslContext.get()),
+    m_QueuedBytes(0),
+    m_Writing(false),
+    m_ReleaseAfterWrite(false),
+    m_CoalesceDelay(0),
+    m_CoalesceTimer(io),
+    m_Reading(false)
+{
+    m_SslBackend.emplace(io, *m_StreamContext);
     logd5("+BasicTcpClient created");
 }
 
@@ -159,9 +125,15 @@ BasicTcpClient::BasicTcpClient(boost::asio::io_service &io, boost::asio::ssl::co
     m_IsOpen(false),
     m_Ssl(true),
     m_Backend(io),
-    m_SslContext(boost::asio::ssl::context::sslv23_client),
-    m_SslBackend(io, ctx)
-{
+    m_StreamContext(&ctx),
+    m_QueuedBytes(0),
+    m_Writing(false),
+    m_ReleaseAfterWrite(false),
+    m_CoalesceDelay(0),
+    m_CoalesceTimer(io),
+    m_Reading(false)
+{
+    m_SslBackend.emplace(io, *m_StreamContext);
     logd5("+BasicTcpClient created");
 }
 
@@ -172,18 +144,18 @@ BasicTcpClient::~BasicTcpClient()
 
 boost::asio::io_service& BasicTcpClient::ioService()
 {
-    if (m_Ssl) return m_SslBackend.get_io_service();
+    if (m_Ssl) return m_SslBackend->get_io_service();
     return m_Backend.get_io_service();
 }
 
 boost::asio::ip::tcp::socket::lowest_layer_type& BasicTcpClient::lowestLayer()
 {
-    if (m_Ssl) return m_SslBackend.lowest_layer();
+    if (m_Ssl) return m_SslBackend->lowest_layer();
     return m_Backend.lowest_layer();
 }
 const boost::asio::ip::tcp::socket::lowest_layer_type& BasicTcpClient::lowestLayer() const
 {
-    if (m_Ssl) return m_SslBackend.lowest_layer();
+    if (m_Ssl) return m_SslBackend->lowest_layer();
     return m_Backend.lowest_layer();
 }
 
@@ -194,221 +166,148 @@ unsigned int BasicTcpClient::setTimeout(unsigned int val)
     return tmp;
 }
 
-std::size_t BasicTcpClient::read_until(const std::string &delimiter, int timeout)
+std::size_t BasicTcpClient::write(std::string const& str)
 {
-    if (timeout < 0)
-    {
-        timeout = m_Timeout;
-    }
-
-    size_t bytes = 0;
-    m_Response.clear();
-
-    if (m_Streambuf.size())
+    boost::system::error_code ec;
+    std::size_t bytes = 0;
+    while (bytes < str.size())
     {
-        boost::asio::streambuf::const_buffers_type bufs = m_Streambuf.data();
-        auto const beg = boost::asio::buffers_begin(bufs);
-        auto const end = boost::asio::buffers_end(bufs);
-        auto const pos = std::search(beg, end, delimiter.begin(), delimiter.end());
-
-        if (pos != end)
+        std::size_t w = 0;
+        if (m_Ssl)
         {
-            m_Response.assign(beg, pos);
-            m_Streambuf.consume(std::distance(beg, pos) + delimiter.size());
-            return m_Response.size();
+            w = m_SslBackend->write_some(boost::asio::buffer(str.data() + bytes, str.size() - bytes), ec);
+        }
+        else
+        {
+            w = m_Backend.write_some(boost::asio::buffer(str.data() + bytes, str.size() - bytes), ec);
         }
+        if (ec) break;
+        bytes += w;
     }
 
-    boost::asio::io_service local_io;
-    local_io.reset();
-
-    boost::optional<boost::system::error_code> timer_result;
-    boost::optional<boost::system::error_code> read_result;
-
-    boost::asio::ip::tcp::socket::lowest_layer_type &sock = lowestLayer();
-    auto timeout_cb = boost::bind(timeout_expired, boost::asio::placeholders::error, std::ref(sock), &timer_result, std::ref(local_io));
-
-    boost::asio::io_service &external_io = ioService();
-    boost::asio::io_service::strand strand(external_io);
-
-    boost::asio::steady_timer timer(external_io);
-    timer.expires_from_now(std::chrono::seconds(timeout));
-    timer.async_wait(strand.wrap(timeout_cb));
+    if (ec) throw std::runtime_error("write failed: " + ec.message());
+    return bytes;
+}
 
-    auto read_callback = strand.wrap(boost::bind(read_completed,
-                                                      std::ref(local_io),
-                                                      boost::asio::placeholders::error,
-                                                      boost::asio::placeholders::bytes_transferred,
-                                                      std::ref(bytes),
-                                                      &read_result,
-                                                      std::ref(timer)));
+const size_t BasicTcpClient::MAX_COALESCE_BYTES;
 
-    if (m_Ssl)
+void BasicTcpClient::enqueueWrite(PendingWrite write)
+{
+    m_QueuedBytes += write.size;
+    m_WriteQueue.push_back(std::move(write));
+    if (m_Writing)
     {
-        boost::asio::async_read_until(m_SslBackend, m_Streambuf, delimiter, read_callback);
+        // will be sent with others, when current write is done
+        return;
     }
-    else
+
+    m_Writing = true;
+    if (m_CoalesceDelay.count() == 0)
     {
-        boost::asio::async_read_until(m_Backend, m_Streambuf, delimiter, read_callback);
+        flushWrites();
+        return;
     }
 
-    boost::asio::io_service::work work(local_io);   // чтобы дождаться хендлера чтения или таймера
-    local_io.run_one();
-
-    if (timer_result)
-        throw std::runtime_error("async read timeout");
-
-    if (read_result && *read_result)
-        throw std::runtime_error("read failed: " + read_result->message());
-
-    read_from_buffer(m_Streambuf, m_Response, delimiter, bytes);
-    return bytes;
+    m_CoalesceTimer.expires_from_now(m_CoalesceDelay);
+    m_CoalesceTimer.async_wait(makeAllocHandler(m_WriteMemory, [self = this->shared_from_this()](const boost::system::error_code &)
+    {
+        self->flushWrites();
+    }));
 }
 
-std::size_t BasicTcpClient::read(std::size_t need_bytes, int timeout)
+void BasicTcpClient::flushWrites()
 {
-    if (timeout < 0)
+    if (m_WriteQueue.empty())
     {
-        timeout = m_Timeout;
+        m_Writing = false;
+        return;
     }
 
-    m_Response.clear();
-    m_Response.resize(need_bytes);
-    char *resp = const_cast<char *>(m_Response.data());
-
-    size_t already_in_stream = std::min(need_bytes, m_Streambuf.size());
-    if (already_in_stream)
+    // big responses are not merged: copy would cost more than separate record
+    size_t count = 1;
+    size_t total = m_WriteQueue.front().size;
+    while (count < m_WriteQueue.size() && total + m_WriteQueue[count].size <= MAX_COALESCE_BYTES)
     {
-        boost::asio::streambuf::const_buffers_type bufs = m_Streambuf.data();
-        std::copy(boost::asio::buffers_begin(bufs), boost::asio::buffers_begin(bufs) + already_in_stream, resp);
-        m_Streambuf.consume(already_in_stream);
+        total += m_WriteQueue[count].size;
+        ++count;
     }
-    if (already_in_stream == need_bytes) return need_bytes;
-
-    boost::asio::io_service local_io;
-    local_io.reset();
-
-    boost::optional<boost::system::error_code> timer_result;
-    boost::optional<boost::system::error_code> read_result;
-
-    boost::asio::ip::tcp::socket::lowest_layer_type &sock = lowestLayer();
-    auto timeout_cb = boost::bind(timeout_expired, boost::asio::placeholders::error, std::ref(sock), &timer_result, std::ref(local_io));
-
-    boost::asio::io_service &external_io = ioService();
-    boost::asio::io_service::strand strand(external_io);
-
-    boost::asio::steady_timer timer(external_io);
-    timer.expires_from_now(std::chrono::seconds(timeout));
-    timer.async_wait(strand.wrap(timeout_cb));
 
-    auto buffer = boost::asio::buffer(resp + already_in_stream, need_bytes - already_in_stream);
-    auto condition = boost::asio::transfer_exactly(need_bytes - already_in_stream);
-
-    size_t bytes = 0;
-    auto read_callback = strand.wrap(boost::bind(read_completed,
-                                                      std::ref(local_io),
-                                                      boost::asio::placeholders::error,
-                                                      boost::asio::placeholders::bytes_transferred,
-                                                      std::ref(bytes),
-                                                      &read_result,
-                                                      std::ref(timer)));
-
-    if (m_Ssl)
+    m_InFlight.clear();
+    if (count == 1)
     {
-        boost::asio::async_read(m_SslBackend, buffer, condition, read_callback);
+        // the most common case, nothing to merge
+        m_WriteBuffer = std::move(m_WriteQueue.front().data);
     }
     else
     {
-        boost::asio::async_read(m_Backend, buffer, condition, read_callback);
-    }
-
-    boost::asio::io_service::work work(local_io);   // чтобы дождаться хендлера чтения или таймера
-    local_io.run_one();
-
-    if (timer_result)
-        throw std::runtime_error("async read timeout");
-
-    if (read_result && *read_result)
-        throw std::runtime_error("read failed: " + read_result->message());
-
-    return need_bytes;
-}
-
-std::size_t BasicTcpClient::write(std::string const& str)
-{
-    boost::system::error_code ec;
-    std::size_t bytes = 0;
-    while (bytes < str.size())
-    {
-        std::size_t w = 0;
-        if (m_Ssl)
+        m_WriteBuffer = OutBuffer(std::string());
+        m_WriteBuffer.reserve(total);
+        for (size_t i = 0; i < count; ++i)
         {
-            w = m_SslBackend.write_some(boost::asio::buffer(str.data() + bytes, str.size() - bytes), ec);
-        }
-        else
-        {
-            w = m_Backend.write_some(boost::asio::buffer(str.data() + bytes, str.size() - bytes), ec);
+            m_WriteBuffer.append(m_WriteQueue[i].data.data(), m_WriteQueue[i].size);
         }
-        if (ec) break;
-        bytes += w;
     }
 
-    if (ec) throw std::runtime_error("write failed: " + ec.message());
-    return bytes;
-}
+    for (size_t i = 0; i < count; ++i)
+    {
+        m_InFlight.emplace_back(std::move(m_WriteQueue[i].handler), m_WriteQueue[i].size);
+    }
+    m_WriteQueue.erase(m_WriteQueue.begin(), m_WriteQueue.begin() + count);
 
-void BasicTcpClient::asyncRead(std::function<std::pair<stream_iterator, bool>(stream_iterator, stream_iterator)> condition,
-                               std::function<void(const ConnectionError &err, size_t)> handler)
-{
     if (m_Ssl)
     {
-        boost::asio::async_read_until(
-            m_SslBackend,
-            m_Streambuf,
-            std::move(condition),
-            [self_life = this->shared_from_this(), handler = std::move(handler)](boost::system::error_code ec, size_t transferred) mutable
+        boost::asio::async_write(
+            *m_SslBackend,
+            m_WriteBuffer.buffers(),
+            makeAllocHandler(m_WriteMemory, [self = this->shared_from_this()](boost::system::error_code ec, size_t)
             {
-                ConnectionError conn_err(ec);
-                handler(conn_err, transferred);
-            });
+                self->writeDone(ec);
+            }));
     }
     else
     {
-        boost::asio::async_read_until(
+        boost::asio::async_write(
             m_Backend,
-            m_Streambuf,
-            std::move(condition),
-            [self_life = this->shared_from_this(), handler = std::move(handler)](boost::system::error_code ec, size_t transferred) mutable
+            m_WriteBuffer.buffers(),
+            makeAllocHandler(m_WriteMemory, [self = this->shared_from_this()](boost::system::error_code ec, size_t)
             {
-                ConnectionError conn_err(ec);
-                handler(conn_err, transferred);
-            });
+                self->writeDone(ec);
+            }));
     }
 }
 
-void BasicTcpClient::asyncWrite(std::string data, std::function<void(const ConnectionError &err, size_t bytes)> handler)
+void BasicTcpClient::writeDone(const boost::system::error_code &ec)
 {
-    m_WriteBuffer = std::move(data);
+    std::vector<std::pair<write_handler_t, size_t>> &done = m_Completed;
+    done.swap(m_InFlight);
+    m_WriteBuffer = OutBuffer(std::string());
 
-    if (m_Ssl)
+    if (ec)
     {
-        boost::asio::async_write(
-            m_SslBackend,
-            boost::asio::buffer(m_WriteBuffer.data(), m_WriteBuffer.size()),
-            [self = this->shared_from_this(), handler = std::move(handler)](boost::system::error_code ec, size_t transferred) mutable
-            {
-                handler(ConnectionError(ec), transferred);
-            });
+        // connection is broken, nothing else will be written
+        for (auto &write : m_WriteQueue)
+        {
+            done.emplace_back(std::move(write.handler), write.size);
+        }
+        m_WriteQueue.clear();
     }
-    else
+
+    for (const auto &write : done)
     {
-        boost::asio::async_write(
-            m_Backend,
-            boost::asio::buffer(m_WriteBuffer.data(), m_WriteBuffer.size()),
-            [self = this->shared_from_this(), handler = std::move(handler)](boost::system::error_code ec, size_t transferred) mutable
-            {
-                handler(ConnectionError(ec), transferred);
-            });
+        m_QueuedBytes -= write.second;
+    }
+
+    // new writes from handlers are queued, m_Writing is still set
+    for (auto &write : done)
+    {
+        write.first(ConnectionError(ec), ec ? 0 : write.second);
+    }
+    done.clear();
+
+    flushWrites();
+    if (m_ReleaseAfterWrite && !m_Writing)
+    {
+        releaseWriteMemory();
     }
 }
 
@@ -424,7 +323,26 @@ std::string BasicTcpClient::remoteAddr() const
 
 void BasicTcpClient::shrinkToFit()
 {
-    m_WriteBuffer = std::string();
+    if (!m_Reading)
+    {
+        m_RecvBuffer.shrink();
+        m_ReadMemory.release();
+    }
+
+    if (!m_Writing)
+    {
+        releaseWriteMemory();
+    }
+}
+
+void BasicTcpClient::releaseWriteMemory()
+{
+    m_WriteBuffer.clear();
+    m_WriteMemory.release();
+    m_HandoffMemory.release();
+    std::vector<PendingWrite>().swap(m_WriteQueue);
+    std::vector<std::pair<write_handler_t, size_t>>().swap(m_InFlight);
+    std::vector<std::pair<write_handler_t, size_t>>().swap(m_Completed);
 }
 
 bool BasicTcpClient::isOpen()
@@ -457,6 +375,14 @@ void BasicTcpClient::close()
     lowestLayer().close(ignored_ec);
 }
 
+void BasicTcpClient::shutdown()
+/*
+ *  only descriptor is touched, so operation of other thread (tls handshake) is not raced
+ */
+{
+    ::shutdown(lowestLayer().native(), SHUT_RDWR);
+}
+
 void BasicTcpClient::makeConnected(boost::system::error_code &ec)
 {
     m_IsOpen = true;
@@ -486,6 +412,36 @@ void BasicTcpClient::makeConnected(boost::system::error_code &ec)
 }
 
 
+void BasicTcpClient::recycle()
+/*
+ *  everything keeps its memory, except ssl stream: asio keeps there
+ *  records of previous connection, which were not read yet, so it is recreated
+ */
+{
+    close();
+    boost::system::error_code ignored_ec;
+    m_CoalesceTimer.cancel(ignored_ec);
+
+    m_RecvBuffer.consume(m_RecvBuffer.size());
+    m_WriteQueue.clear();
+    m_InFlight.clear();
+    m_Completed.clear();
+    m_WriteBuffer = OutBuffer(std::string());
+    m_QueuedBytes = 0;
+    m_Writing = false;
+    m_ReleaseAfterWrite = false;
+    m_CoalesceDelay = std::chrono::microseconds(0);
+
+    m_RemoteAddr.clear();
+    m_LocalAddr.clear();
+
+    if (m_Ssl)
+    {
+        m_SslBackend.emplace(m_Backend.get_io_service(), *m_StreamContext);
+    }
+}
+
+
 TcpClient::TcpClient(boost::asio::io_service &io, bool ssl, unsigned int timeout):
     BasicTcpClient(io, ssl, timeout)
 {
@@ -517,28 +473,7 @@ void TcpClient::connect(const std::string& host, int port)
 namespace
 {
 
-template<typename T> static bool parseHeaderLine(const std::string &line, T &parsed_headers)
-{
-    std::string::size_type pos = line.find_first_of(':');
-    if ((pos == std::string::npos) || (pos == 0))
-        return false;
-
-    std::string key = line.substr(0, pos);
-    if (pos == line.size() - 1)
-    {
-        parsed_headers[key] = "";
-        return true;
-    }
-
-    ++pos;
-    while (isspace(line[pos])) ++pos;
-    std::string value = line.substr(pos, std::string::npos);
-
-    parsed_headers[key] = value;
-    return true;
-}
-
-bool gzipInflate(std::string const& compressedBytes, std::string& uncompressedBytes)
+bool gzipInflate(boost::string_ref compressedBytes, std::string& uncompressedBytes)
 {
     uncompressedBytes.clear();
 
@@ -548,7 +483,7 @@ bool gzipInflate(std::string const& compressedBytes, std::string& uncompressedBy
     z_stream strm;
     memset(&strm, 0, sizeof(strm));
 
-    strm.next_in = (Bytef *)compressedBytes.c_str();  // This can be unsafe ?   NOLINT
+    strm.next_in = (Bytef *)compressedBytes.data();  // This can be unsafe ?   NOLINT
     strm.avail_in = compressedBytes.size();
 
     if (inflateInit2(&strm, (16 + MAX_WBITS)) != Z_OK)
@@ -583,40 +518,49 @@ bool gzipInflate(std::string const& compressedBytes, std::string& uncompressedBy
     return true;
 }
 
-struct contains_t
+// "1a2f\r\n" or "1a2f;ext=value\r\n"
+bool parse_chunk_size(boost::string_ref line, size_t &chunk_size)
 {
-    std::string delimiter;
-
-    template<class It>
-    std::pair<It, bool> operator()(It begin, It end) const
+    if (line.size() < 3)
     {
-        auto pos = std::search(begin, end, delimiter.begin(), delimiter.end());
-        return std::make_pair((pos != end) ? pos : begin, pos != end);
+        return false;
     }
-};
-
-struct exactly_t
-{
-    explicit exactly_t(size_t size) : _size(size) {}
-    size_t _size;
+    line.remove_suffix(2);
 
-    template<class It>
-    std::pair<It, bool> operator()(It begin, It end) const
+    size_t size = 0;
+    size_t digits = 0;
+    for (char c : line)
     {
-        size_t size = end - begin;
-        if (size >= _size)
+        int digit = 0;
+        if (c >= '0' && c <= '9') digit = c - '0';
+        else if (c >= 'a' && c <= 'f') digit = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') digit = c - 'A' + 10;
+        else if (c == ';') break;
+        else return false;
+
+        if (++digits > sizeof(size_t) * 2 - 1)
         {
-            return std::make_pair(begin + size, true);
+            return false;
         }
-        return std::make_pair(begin, false);
+        size = size * 16 + digit;
     }
-};
 
+    chunk_size = size;
+    return digits != 0;
+}
 
 }  // namespace
 
 AsyncHttpClient::AsyncHttpClient(boost::shared_ptr<TcpClient> &socket) :
-        m_Socket(socket)
+        m_Socket(socket),
+        m_BodyType(body_t::NONE),
+        m_BodyLen(0),
+        m_WebSocket(false),
+        m_WsClientSide(false),
+        m_WsDeflate(false),
+        m_WsCloseSent(false),
+        m_WsFragmented(false),
+        m_WsCompressed(false)
 {
     logd5("+AsyncHttpClient created");
 }
@@ -624,6 +568,10 @@ AsyncHttpClient::AsyncHttpClient(boost::shared_ptr<TcpClient> &socket) :
 
 AsyncHttpClient::~AsyncHttpClient()
 {
+    if (!m_SessionKey.empty() && isOpen() && m_Socket->isSsl() && SSL_is_init_finished(m_Socket->ssl_stream().native_handle()))
+    {
+        SslSessionCache::instance().store(m_SessionKey, m_Socket->ssl_stream().native_handle());
+    }
     logd5("~AsyncHttpClient destroyed");
 }
 
@@ -642,6 +590,8 @@ void AsyncHttpClient::asyncConnect(const std::string &host, uint32_t port, std::
         return;
     }
 
+    m_SessionKey = host + ":" + std::to_string(port);
+
     auto new_handler = [self = this, handler](const ConnectionError &read_error) mutable
     {
         self->handleConnect(read_error, handler);
@@ -679,6 +629,8 @@ void AsyncHttpClient::handleConnect(ConnectionError error, Handler handler)
         self->handleHandshake(ConnectionError(error), handler);
     };
 
+    SslSessionCache::instance().restore(m_SessionKey, m_Socket->ssl_stream().native_handle());
+
     m_Socket->ssl_stream().async_handshake(boost::asio::ssl::stream_base::client, new_handler);
 }
 
@@ -687,265 +639,281 @@ void AsyncHttpClient::handleHandshake(ConnectionError error, Handler handler)
 {
     if (error.code)
     {
+        // cached session could be the reason
+        SslSessionCache::instance().drop(m_SessionKey);
         handler(error);
         return;
     }
 
+    SslSessionCache::instance().store(m_SessionKey, m_Socket->ssl_stream().native_handle());
+
     handler(ConnectionError(boost::system::error_code()));
 }
 
-void AsyncHttpClient::asyncHandshakeAsServer(std::function<void(const ConnectionError &err)> handler)
+ConnectionError AsyncHttpClient::protocolError()
 {
-    if (!m_Socket->isSsl())
+    return ConnectionError(boost::system::error_code(boost::system::errc::protocol_error, boost::system::generic_category()));
+}
+
+std::pair<size_t, bool> AsyncHttpClient::headParsed(const char *data, size_t size)
+{
+    // parser works right on receive buffer
+    HttpParser::state_t state = m_Parser.parse(data, size);
+    switch (state)
     {
-        handler(ConnectionError(boost::system::error_code()));
-        return;
+    case HttpParser::state_t::INCOMPLETE:
+        return std::make_pair(size_t(0), false);
+    case HttpParser::state_t::DONE:
+        return std::make_pair(m_Parser.headSize(), true);
+    case HttpParser::state_t::ERROR:
+        break;
     }
+    return std::make_pair(size_t(0), true);
+}
 
-    auto new_handler = [self = this, handler](const boost::system::error_code& error) mutable
+bool AsyncHttpClient::takeHead()
+{
+    if (m_Parser.state() != HttpParser::state_t::DONE)
     {
-        handler(ConnectionError(error));
-    };
+        return false;
+    }
 
-    m_Socket->ssl_stream().async_handshake(boost::asio::ssl::stream_base::server, new_handler);
-}
+    if (m_Parser.isRequest())
+    {
+        boost::string_ref method = m_Parser.method();
+        m_Reply._method.resize(method.size());
+        std::transform(method.begin(), method.end(), m_Reply._method.begin(), ::tolower);
+        m_Reply._resource.assign(m_Parser.resource().data(), m_Parser.resource().size());
+    }
+    else
+    {
+        m_Reply._status = m_Parser.status();
+    }
 
-void AsyncHttpClient::asyncResponse(std::function<void(const ConnectionError &err, const HttpReply &r)> handler)
-{
-    m_Socket->asyncRead(contains_t{"\r\n\r\n"}, [self = this, handler](const ConnectionError &read_error, size_t) mutable
+    for (size_t i = 0; i < static_cast<size_t>(http::header_t::COUNT); ++i)
+    {
+        boost::string_ref value = m_Parser.get(static_cast<http::header_t>(i));
+        m_Reply._hasHeader[i] = m_Parser.has(static_cast<http::header_t>(i));
+        m_Reply._knownHeaders[i].assign(value.data(), value.size());
+    }
+
+    m_BodyType = body_t::NONE;
+    m_BodyLen = 0;
+    if (m_Parser.hasContentLength())
     {
-        self->handleHeaders(read_error, handler);
-    });
+        m_BodyType = body_t::LENGTH;
+        m_BodyLen = m_Parser.contentLength();
+    }
+    else if (m_Parser.isChunked())
+    {
+        m_BodyType = body_t::CHUNKED;
+    }
+
+    // views of parser point into receive buffer, they are not used after that
+    m_Socket->recvBuffer().consume(m_Parser.headSize());
+    m_Parser.reset();
+    return true;
 }
 
-void AsyncHttpClient::asyncRequest(std::string request, std::function<void(const ConnectionError &err)> handler)
+bool AsyncHttpClient::takeChunkSize(size_t line_len, size_t &chunk_size)
 {
-    m_Socket->asyncWrite(request,
-        [handler](const ConnectionError &write_error, size_t bytes) mutable
-        {
-            unused_args(bytes);
-            handler(write_error);
-            return;
-        });
+    RecvBuffer &buffer = m_Socket->recvBuffer();
+    bool valid = parse_chunk_size(buffer.view(line_len), chunk_size);
+    buffer.consume(line_len);
+
+    return valid && chunk_size <= buffer.limit() - m_Reply._bodyStorage.size();
 }
 
-template<class Handler>
-void AsyncHttpClient::handleHeaders(ConnectionError error, Handler handler)
+void AsyncHttpClient::takeChunk(size_t chunk_size)
 {
-    if (error.code)
-    {
-        handler(error, {});
-        return;
-    }
-
-    HttpReply reply;
+    // chunks are the only place, where body is copied: it is assembled from parts
+    RecvBuffer &buffer = m_Socket->recvBuffer();
+    m_Reply._bodyStorage.append(buffer.data(), chunk_size);
+    buffer.consume(chunk_size + 2);
+}
 
-    // Читаем заголовки
-    m_Socket->read_until("\r\n\r\n");
-    m_Socket->swapResponse(reply._headers);
+bool AsyncHttpClient::inflateBody()
+{
+    bool content_zipped = m_Reply.hasHeader(http::header_t::CONTENT_ENCODING) &&
+                          m_Reply.getHeader(http::header_t::CONTENT_ENCODING).find("gzip") != std::string::npos;
 
-    std::vector<std::string> h_vector = utils::split(reply._headers, "\r\n");
-    if (h_vector.empty() || h_vector[0].empty())
+    if (!content_zipped || m_Reply.body().empty())
     {
-        boost::system::error_code protocol_error(boost::system::errc::protocol_error, boost::system::generic_category());
-        handler(ConnectionError(protocol_error), reply);
-        return;
+        return true;
     }
 
-    std::vector<std::string> response_params = utils::split(h_vector[0], " ");
-    if (response_params.size() < 2)
+    std::string r;
+    if (!gzipInflate(m_Reply.body(), r))
     {
-        boost::system::error_code protocol_error(boost::system::errc::protocol_error, boost::system::generic_category());
-        handler(ConnectionError(protocol_error), reply);
-        return;
+        return false;
     }
+    m_Reply._bodyView.clear();
+    m_Reply._bodyStorage = std::move(r);
+    return true;
+}
 
-    std::string lc = utils::lowercased(response_params[0]);
-    if (utils::starts_with(lc, "http/"))
+void AsyncHttpClient::startWebSocket(bool client_side, bool deflate)
+{
+    m_WebSocket = true;
+    m_WsClientSide = client_side;
+    m_WsDeflate = deflate;
+}
+
+std::pair<size_t, bool> AsyncHttpClient::frameParsed(const char *data, size_t size)
+{
+    switch (websocket::parse_head(data, size, m_WsHead))
     {
-        // status string like: "HTTP/1.1 200 OK" or "HTTP/1.1 301 Moved Permanently"
-        try
+    case websocket::parse_t::INCOMPLETE:
+        return std::make_pair(size_t(0), false);
+    case websocket::parse_t::ERROR:
+        break;
+    case websocket::parse_t::DONE:
+        if (m_WsHead.payload_len > m_Socket->recvBuffer().limit() - m_WsHead.size)
         {
-            reply._status = std::stoi(response_params[1]);
-        }
-        catch (const std::exception &e)
-        {
-            f::loge("http status: {0}, error: {1}", response_params[1], e.what());
-            boost::system::error_code protocol_error(boost::system::errc::protocol_error, boost::system::generic_category());
-            handler(ConnectionError(protocol_error), reply);
-            return;
+            // frame does not fit into receive buffer
+            break;
         }
+        size_t frame_size = m_WsHead.size + m_WsHead.payload_len;
+        return std::make_pair(frame_size, size >= frame_size);
     }
-    else
+    return std::make_pair(size_t(0), true);
+}
+
+AsyncHttpClient::frame_t AsyncHttpClient::takeFrame(size_t frame_size)
+/*
+ *  frame is unmasked right in the receive buffer, unfragmented uncompressed message
+ *  is given to handler as is
+ */
+{
+    if (frame_size == 0)
     {
-        // POST / HTTP/1.1
-        reply._method = lc;
-        reply._resource = response_params[1];
+        return frame_t::ERROR;
     }
 
-    for (size_t i = 1; i < h_vector.size(); ++i)
+    // frames of client are masked, of server are not
+    if (m_WsHead.masked == m_WsClientSide)
     {
-        parseHeaderLine(h_vector[i], reply._parsedHeaders);
+        return frame_t::ERROR;
     }
 
-    bool has_content_len = reply.hasHeader("Content-Length");
-    size_t body_len = 0;
-    if (has_content_len)
+    RecvBuffer &buffer = m_Socket->recvBuffer();
+    char *payload = buffer.data() + m_WsHead.size;
+    size_t payload_len = m_WsHead.payload_len;
+    if (m_WsHead.masked)
     {
-        try
-        {
-            body_len = std::stoul(reply.getHeader("Content-Length"));
-        }
-        catch (const std::exception &e)
-        {
-            f::loge("content len: {0}, error: {1}", reply.getHeader("Content-Length"), e.what());
-            boost::system::error_code protocol_error(boost::system::errc::protocol_error, boost::system::generic_category());
-            handler(ConnectionError(protocol_error), reply);
-            return;
-        }
+        websocket::unmask(payload, payload_len, m_WsHead.mask);
     }
 
-    if (has_content_len)
-    {
-        m_Socket->asyncRead(
-            [body_len](auto begin, auto end)
-            {
-                size_t size = end - begin;
-                return std::make_pair((size >= body_len) ? begin + body_len : begin, size >= body_len);
-            },
+    // next read is started from io queue, so payload stays in place until handler returns
+    boost::string_ref data(payload, payload_len);
+    buffer.consume(frame_size);
 
-            [self = this, handler, reply = std::move(reply), body_len](const ConnectionError &read_error, size_t) mutable
-            {
-                if (read_error.code)
-                {
-                    handler(read_error, reply);
-                }
-                else
-                {
-                    self->m_Socket->read(body_len);
-                    self->m_Socket->swapResponse(reply._body);
-                    self->processReply(std::move(reply), handler);
-                }
-            });
-    }
-    else if (reply.getHeader("Transfer-Encoding") == "chunked")
-    {
-        m_Socket->asyncRead(contains_t{"\r\n"},
-            [self = *this, reply = std::move(reply), handler](ConnectionError read_error, size_t) mutable
-            {
-                self.startProcessChunk(read_error, std::move(reply), handler);
-            });
-    }
-    else
+    if (websocket::is_control(m_WsHead.opcode))
     {
-        // request without body
-        handler(ConnectionError(boost::system::error_code()), reply);
+        return takeControlFrame(m_WsHead.opcode, data);
     }
-}
 
-template<class Handler>
-void AsyncHttpClient::processReply(HttpReply reply, Handler handler)
-{
-    bool content_zipped = reply.hasHeader("Content-Encoding") &&
-                          reply.getHeader("Content-Encoding").find("gzip") != std::string::npos;
-
-    if (content_zipped && !reply._body.empty())
+    if (m_WsHead.opcode == websocket::opcode_t::CONTINUATION)
     {
-        std::string r;
-        if (!gzipInflate(reply._body, r))
+        if (!m_WsFragmented || m_WsHead.compressed)
         {
-            boost::system::error_code protocol_error(boost::system::errc::protocol_error, boost::system::generic_category());
-            handler(ConnectionError(protocol_error), reply);
-            return;
+            return frame_t::ERROR;
         }
-        reply._body = std::move(r);
     }
-
-    handler(ConnectionError(boost::system::error_code()), reply);
-}
-
-template<class Handler>
-void AsyncHttpClient::startProcessChunk(ConnectionError error, HttpReply reply, Handler handler)
-{
-    if (error.code)
+    else
     {
-        handler(error, {});
-        return;
-    }
-
-    std::string chunk_size_string;
-    m_Socket->read_until("\r\n");
-    m_Socket->swapResponse(chunk_size_string);
+        if (m_WsFragmented || (m_WsHead.compressed && !m_WsDeflate))
+        {
+            return frame_t::ERROR;
+        }
+        m_WsCompressed = m_WsHead.compressed;
+        m_WsFragments.clear();
 
-    size_t parsed = 0;
-    size_t chunk_size = 0;
+        if (m_WsHead.fin && !m_WsCompressed)
+        {
+            m_WsView = data;
+            return frame_t::MESSAGE;
+        }
+    }
 
-    try
+    if (!m_WsHead.fin || m_WsFragmented)
     {
-        chunk_size = std::stoul(chunk_size_string, &parsed, 16);
+        // fragments are the only place, where message is copied
+        if (data.size() > buffer.limit() - m_WsFragments.size())
+        {
+            return frame_t::ERROR;
+        }
+        m_WsFragments.append(data.data(), data.size());
+        data = m_WsFragments;
     }
-    catch (const std::exception &e)
+
+    m_WsFragmented = !m_WsHead.fin;
+    if (m_WsFragmented)
     {
-        boost::system::error_code protocol_error(boost::system::errc::protocol_error, boost::system::generic_category());
-        handler(ConnectionError(protocol_error), reply);
-        return;
+        return frame_t::NEXT;
     }
 
-    if (parsed != chunk_size_string.size())
+    if (m_WsCompressed)
     {
-        boost::system::error_code protocol_error(boost::system::errc::protocol_error, boost::system::generic_category());
-        handler(ConnectionError(protocol_error), reply);
-        return;
+        if (!websocket::inflate_message(data, m_WsMessage, buffer.limit()))
+        {
+            return frame_t::ERROR;
+        }
+        data = m_WsMessage;
     }
 
-    m_Socket->asyncRead(
-        [chunk_size](auto begin, auto end)
-        {
-            size_t size = end - begin;
-            return std::make_pair((size >= chunk_size + 2) ? (begin + chunk_size + 2) : begin, size >= chunk_size + 2);
-        },
-        [self = *this, handler, reply = std::move(reply), chunk_size](auto read_error, size_t) mutable
-        {
-            self.processChunk(read_error, chunk_size, std::move(reply), handler);
-        });
+    m_WsView = data;
+    return frame_t::MESSAGE;
 }
 
-template<class Handler>
-void AsyncHttpClient::processChunk(ConnectionError error, size_t chunk_size, HttpReply reply, Handler handler)
+AsyncHttpClient::frame_t AsyncHttpClient::takeControlFrame(websocket::opcode_t opcode, boost::string_ref payload)
 {
-    if (error.code)
+    switch (opcode)
     {
-        handler(error, reply);
-        return;
+    case websocket::opcode_t::PING:
+    {
+        OutBuffer pong;
+        pong.append(payload.data(), payload.size());
+        asyncRequest(makeFrame(std::move(pong), websocket::opcode_t::PONG), [](const ConnectionError &) {});
+        return frame_t::NEXT;
     }
 
-    m_Socket->read(chunk_size + 2);
+    case websocket::opcode_t::CLOSE:
+        if (!m_WsCloseSent)
+        {
+            // status code of peer is sent back
+            m_WsCloseSent = true;
+            OutBuffer close;
+            close.append(payload.data(), std::min<size_t>(payload.size(), 2));
+            asyncRequest(makeFrame(std::move(close), websocket::opcode_t::CLOSE), [](const ConnectionError &) {});
+        }
+        return frame_t::CLOSED;
 
-    reply._body += m_Socket->response().substr(0, chunk_size);
+    case websocket::opcode_t::PONG:
+        return frame_t::NEXT;
 
-    if (chunk_size == 0)
-    {
-        processReply(std::move(reply), handler);
-    }
-    else
-    {
-        m_Socket->asyncRead(contains_t{"\r\n"},
-            [self = *this, reply = std::move(reply), handler](auto read_error, size_t) mutable
-            {
-                self.startProcessChunk(read_error, std::move(reply), handler);
-            });
+    default:
+        break;
     }
+    return frame_t::ERROR;
 }
 
-bool HttpReply::hasHeader(const std::string &header) const
+OutBuffer AsyncHttpClient::makeFrame(OutBuffer payload, websocket::opcode_t opcode)
 {
-    return (_parsedHeaders.find(header) != _parsedHeaders.end());
+    bool compressed = false;
+    if (m_WsDeflate && !websocket::is_control(opcode))
+    {
+        OutBuffer deflated;
+        compressed = websocket::deflate_message(boost::string_ref(payload.data(), payload.size()), deflated);
+        if (compressed)
+        {
+            payload = std::move(deflated);
+        }
+    }
+    return websocket::make_frame(std::move(payload), opcode, compressed, m_WsClientSide);
 }
 
-std::string HttpReply::getHeader(const std::string &header) const
+void AsyncHttpClient::ping()
 {
-    auto it = _parsedHeaders.find(header);
-    if (it != _parsedHeaders.end()) return it->second;
-    return std::string("");
+    asyncRequest(makeFrame(OutBuffer(), websocket::opcode_t::PING), [](const ConnectionError &) {});
 }
-
@@ -1,12 +1,15 @@
 #pragma once
 
+#include <algorithm>
+#include <chrono>
 #include <functional>
+#include <memory>
 #include <string>
+#include <vector>
 
 #include <boost/asio.hpp>
 #include <boost/asio/ssl.hpp>
-#include <boost/asio/buffers_iterator.hpp>
-#include <boost/asio/streambuf.hpp>
+#include <boost/asio/steady_timer.hpp>
 #include <boost/system/error_code.hpp>
 #include <boost/bind.hpp>
 #include <boost/function.hpp>
@@ -15,6 +18,12 @@
 #include <boost/variant.hpp>
 
 #include "async_connect.hpp"
+#include "handler_memory.hpp"
+#include "http_parser.hpp"
+#include "inplace_function.hpp"
+#include "out_buffer.hpp"
+#include "recv_buffer.hpp"
+#include "websocket.hpp"
 #include "common/http.hpp"
 #include "common/utils.hpp"
 
@@ -35,7 +44,7 @@ struct ConnectionError
 class BasicTcpClient: public boost::enable_shared_from_this<BasicTcpClient>
 {
 public:
-    typedef boost::asio::buffers_iterator<boost::asio::streambuf::const_buffers_type> stream_iterator;
+    typedef InplaceFunction<void(const ConnectionError &err, size_t)> write_handler_t;
 
 public:
     BasicTcpClient(boost::asio::io_service &io, bool ssl, unsigned int timeout);
@@ -51,46 +60,165 @@ public:
     void cancel();
     void close();
 
-    std::size_t read(std::size_t need_bytes, int timeout = -1);
-    std::size_t read_until(const std::string &delimiter, int timeout = -1);
+    // pending operations are completed with error; unlike close, could be called from any thread
+    void shutdown();
+
     std::size_t write(std::string const& str);
 
-    // stream_iterator - is typedef from abcstract client
-    void asyncRead(std::function<std::pair<stream_iterator, bool>(stream_iterator, stream_iterator)> condition,
-                   std::function<void(const ConnectionError &err, size_t)> handler);
+    /*
+     * Reads into receive buffer until condition is satisfied, handler gets size of message,
+     * which starts at recvBuffer().data() and should be consumed by caller.
+     * Read is always started from io queue, so new read initiated inside of handler
+     * does not touch data, which handler is working with.
+     *
+     * condition: (const char *data, size_t size) -> std::pair<size_t, bool>, (bytes of message, is complete)
+     * handler:   (const ConnectionError &err, size_t bytes)
+     */
+    template<class Condition, class Handler>
+    void asyncRead(Condition condition, Handler handler)
+    {
+        ioService().post(makeAllocHandler(m_ReadMemory,
+            [self = this->shared_from_this(), condition = std::move(condition), handler = std::move(handler)]() mutable
+            {
+                self->startRead(std::move(condition), std::move(handler));
+            }));
+    }
+
+    /*
+     * Could be called from any thread and at any time: data is queued on io thread
+     * of socket, everything queued while previous write was in progress
+     * (or during coalesce delay) goes to socket by one write
+     */
+    template<class Handler>
+    void asyncWrite(OutBuffer data, Handler handler)
+    {
+        // NB: handoff from other thread takes handoff memory, io thread itself runs it in place
+        ioService().dispatch(makeAllocHandler(m_HandoffMemory,
+            [self = this->shared_from_this(), data = std::move(data), handler = std::move(handler)]() mutable
+            {
+                size_t size = data.size();
+                self->enqueueWrite(PendingWrite{std::move(data), write_handler_t(std::move(handler)), size});
+            }));
+    }
+
+    template<class Handler>
+    void asyncWrite(std::string data, Handler handler)
+    {
+        asyncWrite(OutBuffer(std::move(data)), std::move(handler));
+    }
+
+    void setCoalesceDelay(std::chrono::microseconds delay) { m_CoalesceDelay = delay; }
 
-    void asyncWrite(std::string data, std::function<void(const ConnectionError &err, size_t)> handler);
+    // queued and in flight; only on io thread of socket
+    size_t queuedBytes() const { return m_QueuedBytes; }
 
     std::string localAddr() const;
     std::string remoteAddr() const;
 
-    const std::string& response() const { return m_Response; }
-    void swapResponse(std::string &res) { std::swap(m_Response, res); }
-    boost::asio::streambuf& response_stream() { return m_Streambuf; }
+    RecvBuffer &recvBuffer() { return m_RecvBuffer; }
+
+    // releases memory of buffers, which are not used by read or write in progress
     void shrinkToFit();
+    // write memory is released each time all writes are done, for connections, which write rarely
+    void setReleaseAfterWrite(bool release) { m_ReleaseAfterWrite = release; }
 
     void makeConnected(boost::system::error_code &ec);
 
+    // closes connection and makes client ready for next one, memory of buffers is kept
+    void recycle();
+
     boost::asio::io_service &ioService();
 
     boost::asio::ip::tcp::socket::lowest_layer_type &lowestLayer();
     const boost::asio::ip::tcp::socket::lowest_layer_type &lowestLayer() const;
 
-    boost::asio::ssl::stream<boost::asio::ip::tcp::socket> &ssl_stream() { return m_SslBackend; }
+    boost::asio::ssl::stream<boost::asio::ip::tcp::socket> &ssl_stream() { return *m_SslBackend; }
     boost::asio::ip::tcp::socket &socket() { return m_Backend; }
 
+private:
+    static const size_t MAX_COALESCE_BYTES = 64 * 1024;
+
+    struct PendingWrite
+    {
+        OutBuffer data;
+        write_handler_t handler;
+        size_t size;
+    };
+
+    template<class Condition, class Handler>
+    void startRead(Condition condition, Handler handler)
+    {
+        std::pair<size_t, bool> match = condition(m_RecvBuffer.data(), m_RecvBuffer.size());
+        if (match.second)
+        {
+            handler(ConnectionError(boost::system::error_code()), match.first);
+            return;
+        }
+
+        boost::asio::mutable_buffers_1 buffer = m_RecvBuffer.prepare();
+        if (boost::asio::buffer_size(buffer) == 0)
+        {
+            // message does not fit into limit of receive buffer
+            handler(ConnectionError(boost::asio::error::no_buffer_space), 0);
+            return;
+        }
+
+        m_Reading = true;
+        auto on_read = makeAllocHandler(m_ReadMemory,
+            [self = this->shared_from_this(), condition = std::move(condition), handler = std::move(handler)]
+            (boost::system::error_code ec, size_t transferred) mutable
+            {
+                self->m_Reading = false;
+                if (ec)
+                {
+                    handler(ConnectionError(ec), 0);
+                    return;
+                }
+                self->m_RecvBuffer.commit(transferred);
+                self->startRead(std::move(condition), std::move(handler));
+            });
+
+        if (m_Ssl)
+        {
+            m_SslBackend->async_read_some(buffer, std::move(on_read));
+        }
+        else
+        {
+            m_Backend.async_read_some(buffer, std::move(on_read));
+        }
+    }
+
+    void enqueueWrite(PendingWrite write);
+    void flushWrites();
+    void writeDone(const boost::system::error_code &ec);
+    void releaseWriteMemory();
+
 protected:
     int m_Timeout;
     bool m_IsOpen;
     bool m_Ssl;
 
     boost::asio::ip::tcp::socket m_Backend;
-    boost::asio::ssl::context m_SslContext;
-    boost::asio::ssl::stream<boost::asio::ip::tcp::socket> m_SslBackend;
-
-    std::string m_WriteBuffer;
-    boost::asio::streambuf m_Streambuf;
-    std::string m_Response;
+    std::unique_ptr<boost::asio::ssl::context> m_SslContext;  // own context of outgoing connection
+    boost::asio::ssl::context *m_StreamContext;     // context of ssl stream, it is recreated by recycle()
+    boost::optional<boost::asio::ssl::stream<boost::asio::ip::tcp::socket>> m_SslBackend;
+
+    OutBuffer m_WriteBuffer;                        // data of write in progress
+    std::vector<std::pair<write_handler_t, size_t>> m_InFlight;    // handlers of write in progress
+    std::vector<std::pair<write_handler_t, size_t>> m_Completed;   // handlers being called, kept for capacity
+    std::vector<PendingWrite> m_WriteQueue;
+    size_t m_QueuedBytes;
+    bool m_Writing;                                 // write or coalesce delay is in progress
+    bool m_ReleaseAfterWrite;
+    std::chrono::microseconds m_CoalesceDelay;
+    boost::asio::steady_timer m_CoalesceTimer;
+
+    RecvBuffer m_RecvBuffer;
+    bool m_Reading;                                 // socket read into receive buffer is in progress
+
+    HandlerMemory m_ReadMemory;
+    HandlerMemory m_WriteMemory;                    // socket writes and coalesce delay
+    HandoffMemory m_HandoffMemory;                  // writes started by other threads
 
     std::string m_RemoteAddr;
     std::string m_LocalAddr;
@@ -150,34 +278,394 @@ public:
     bool isOpen() const { return m_Socket && m_Socket->isOpen(); }
     void cancel() { if (m_Socket) m_Socket->cancel(); }
     void close() { if (m_Socket) m_Socket->close(); }
+    void shutdown() { if (m_Socket) m_Socket->shutdown(); }
 
     std::string remoteAddr() const { return m_Socket->remoteAddr(); }
     std::string localAddr()  const { return m_Socket->localAddr();  }
 
+    size_t queuedBytes() const { return m_Socket->queuedBytes(); }
+
+    // for connections, which are quiet for a long time
+    void shrinkToFit()
+    {
+        m_Reply.shrinkToFit();
+        std::string().swap(m_WsFragments);
+        std::string().swap(m_WsMessage);
+        m_Socket->shrinkToFit();
+    }
+    void setReleaseAfterWrite(bool release) { m_Socket->setReleaseAfterWrite(release); }
+
     void asyncConnect(const std::string &host, uint32_t port, std::function<void(const ConnectionError &err)> handler);
-    void asyncResponse(std::function<void(const ConnectionError &err, const HttpReply &r)> handler);
-    void asyncRequest(std::string request, std::function<void(const ConnectionError &err)> handler);
-    void asyncHandshakeAsServer(std::function<void(const ConnectionError &err)> handler);
+
+    /*
+     * handler: (const ConnectionError &err, const HttpReply &r)
+     * reply is owned by client and is reused for next response, as well as receive buffer,
+     * where its body usually is; so reply is valid only until handler returns.
+     */
+    template<class Handler>
+    void asyncResponse(Handler handler)
+    {
+        m_Parser.reset();
+        m_Socket->asyncRead(
+            [self = this](const char *data, size_t size)
+            {
+                return self->headParsed(data, size);
+            },
+            [self = this, handler = std::move(handler)](const ConnectionError &read_error, size_t) mutable
+            {
+                self->handleHeaders(read_error, handler);
+            });
+    }
+
+    /*
+     * Endless chunked body (text/event-stream): asyncResponse gives only head of such response,
+     * then body is read by one chunk. handler: (const ConnectionError &err, boost::string_ref chunk)
+     * chunk is in receive buffer, it is valid until handler returns; the last chunk comes as eof.
+     */
+    template<class Handler>
+    void asyncReadChunk(Handler handler)
+    {
+        m_Socket->asyncRead(LineCondition(),
+            [self = this, handler = std::move(handler)](const ConnectionError &read_error, size_t line_len) mutable
+            {
+                self->startStreamChunk(read_error, line_len, handler);
+            });
+    }
+
+    // handler: (const ConnectionError &err)
+    template<class Handler>
+    void asyncRequest(OutBuffer request, Handler handler)
+    {
+        m_Socket->asyncWrite(std::move(request),
+            [handler = std::move(handler)](const ConnectionError &write_error, size_t) mutable
+            {
+                handler(write_error);
+            });
+    }
+
+    template<class Handler>
+    void asyncRequest(std::string request, Handler handler)
+    {
+        asyncRequest(OutBuffer(std::move(request)), std::move(handler));
+    }
+
+    /*
+     * WebSocket mode, after upgrade handshake: messages go as frames over the same connection.
+     * Client side masks its frames; deflate - permessage-deflate is negotiated.
+     */
+    void startWebSocket(bool client_side, bool deflate);
+    bool isWebSocket() const { return m_WebSocket; }
+
+    /*
+     * handler: (const ConnectionError &err, boost::string_ref message)
+     * message usually points into receive buffer, so it is valid only until handler returns.
+     * Pings are answered and close is confirmed here, close comes to handler as eof.
+     */
+    template<class Handler>
+    void asyncReadMessage(Handler handler)
+    {
+        m_Socket->asyncRead(
+            [self = this](const char *data, size_t size)
+            {
+                return self->frameParsed(data, size);
+            },
+            [self = this, handler = std::move(handler)](const ConnectionError &read_error, size_t frame_size) mutable
+            {
+                self->handleFrame(read_error, frame_size, handler);
+            });
+    }
+
+    // text message; handler: (const ConnectionError &err)
+    template<class Handler>
+    void asyncWriteMessage(OutBuffer message, Handler handler)
+    {
+        asyncRequest(makeFrame(std::move(message), websocket::opcode_t::TEXT), std::move(handler));
+    }
+
+    void ping();
+
+    // handler is called with boost::system::error_code and is given to asio as is,
+    // so its asio_handler_invoke hook decides, where handshake steps run
+    template<class Handler>
+    void asyncHandshakeAsServer(Handler handler)
+    {
+        if (!m_Socket->isSsl())
+        {
+            handler(boost::system::error_code());
+            return;
+        }
+
+        m_Socket->ssl_stream().async_handshake(boost::asio::ssl::stream_base::server, std::move(handler));
+    }
+
 private:
+    enum class body_t : uint8_t
+    {
+        NONE,
+        LENGTH,
+        CHUNKED
+    };
+
+    static const size_t MAX_CHUNK_LINE = 1024;
+
+    // line with \r\n; too long line is given as empty, so it fails parsing
+    struct LineCondition
+    {
+        std::pair<size_t, bool> operator()(const char *data, size_t size) const
+        {
+            const char crlf[] = "\r\n";
+            const char *pos = std::search(data, data + size, crlf, crlf + 2);
+            if (pos != data + size)
+            {
+                return std::make_pair(static_cast<size_t>(pos - data) + 2, true);
+            }
+            return std::make_pair(size_t(0), size > MAX_CHUNK_LINE);
+        }
+    };
+
+    struct ExactlyCondition
+    {
+        explicit ExactlyCondition(size_t size) : _size(size) {}
+        size_t _size;
+
+        std::pair<size_t, bool> operator()(const char *, size_t size) const
+        {
+            return std::make_pair(_size, size >= _size);
+        }
+    };
+
+    static ConnectionError noError() { return ConnectionError(boost::system::error_code()); }
+    static ConnectionError protocolError();
+
     template<class Handler>
     void handleConnect(ConnectionError error, Handler handler);
 
     template<class Handler>
     void handleHandshake(ConnectionError error, Handler handler);
 
+    std::pair<size_t, bool> headParsed(const char *data, size_t size);
+    bool takeHead();
+    bool takeChunkSize(size_t line_len, size_t &chunk_size);
+    void takeChunk(size_t chunk_size);
+    bool inflateBody();
+
+    enum class frame_t : uint8_t
+    {
+        MESSAGE,        // message is complete
+        NEXT,           // fragment or control frame, next frame is needed
+        CLOSED,
+        ERROR
+    };
+
+    std::pair<size_t, bool> frameParsed(const char *data, size_t size);
+    frame_t takeFrame(size_t frame_size);
+    frame_t takeControlFrame(websocket::opcode_t opcode, boost::string_ref payload);
+    OutBuffer makeFrame(OutBuffer payload, websocket::opcode_t opcode);
+
+    template<class Handler>
+    void handleFrame(const ConnectionError &error, size_t frame_size, Handler &handler)
+    {
+        if (error.code)
+        {
+            handler(error, boost::string_ref());
+            return;
+        }
+
+        switch (takeFrame(frame_size))
+        {
+        case frame_t::MESSAGE:
+            handler(noError(), m_WsView);
+            break;
+
+        case frame_t::NEXT:
+            asyncReadMessage(std::move(handler));
+            break;
+
+        case frame_t::CLOSED:
+            handler(ConnectionError(boost::asio::error::eof), boost::string_ref());
+            break;
+
+        case frame_t::ERROR:
+            handler(protocolError(), boost::string_ref());
+            break;
+        }
+    }
+
+    template<class Handler>
+    void handleHeaders(const ConnectionError &error, Handler &handler)
+    {
+        m_Reply.clear();
+
+        if (error.code)
+        {
+            handler(error, m_Reply);
+            return;
+        }
+
+        if (!takeHead())
+        {
+            handler(protocolError(), m_Reply);
+            return;
+        }
+
+        if (m_BodyType == body_t::CHUNKED &&
+            m_Reply.getHeader(http::header_t::CONTENT_TYPE).find("text/event-stream") != std::string::npos)
+        {
+            // body is streamed, its chunks are read by asyncReadChunk
+            handler(noError(), m_Reply);
+            return;
+        }
+
+        switch (m_BodyType)
+        {
+        case body_t::NONE:
+            // request without body
+            handler(noError(), m_Reply);
+            break;
+
+        case body_t::LENGTH:
+            m_Socket->asyncRead(ExactlyCondition(m_BodyLen),
+                [self = this, handler = std::move(handler)](const ConnectionError &read_error, size_t body_len) mutable
+                {
+                    if (read_error.code)
+                    {
+                        handler(read_error, self->m_Reply);
+                        return;
+                    }
+
+                    // next read is started from io queue, so body stays in place until handler returns
+                    RecvBuffer &buffer = self->m_Socket->recvBuffer();
+                    self->m_Reply._bodyView = buffer.view(body_len);
+                    buffer.consume(body_len);
+                    self->processReply(handler);
+                });
+            break;
+
+        case body_t::CHUNKED:
+            readChunkSize(handler);
+            break;
+        }
+    }
+
+    template<class Handler>
+    void processReply(Handler &handler)
+    {
+        if (!inflateBody())
+        {
+            handler(protocolError(), m_Reply);
+            return;
+        }
+        handler(noError(), m_Reply);
+    }
+
     template<class Handler>
-    void handleHeaders(ConnectionError error, Handler handler);
+    void readChunkSize(Handler &handler)
+    {
+        m_Socket->asyncRead(LineCondition(),
+            [self = this, handler = std::move(handler)](const ConnectionError &read_error, size_t line_len) mutable
+            {
+                self->startProcessChunk(read_error, line_len, handler);
+            });
+    }
 
     template<class Handler>
-    void processReply(HttpReply reply, Handler handler);
+    void startProcessChunk(const ConnectionError &error, size_t line_len, Handler &handler)
+    {
+        if (error.code)
+        {
+            handler(error, m_Reply);
+            return;
+        }
+
+        size_t chunk_size = 0;
+        if (!takeChunkSize(line_len, chunk_size))
+        {
+            handler(protocolError(), m_Reply);
+            return;
+        }
+
+        m_Socket->asyncRead(ExactlyCondition(chunk_size + 2),
+            [self = this, handler = std::move(handler), chunk_size](const ConnectionError &read_error, size_t) mutable
+            {
+                self->processChunk(read_error, chunk_size, handler);
+            });
+    }
 
     template<class Handler>
-    void startProcessChunk(ConnectionError error, HttpReply reply, Handler handler);
+    void processChunk(const ConnectionError &error, size_t chunk_size, Handler &handler)
+    {
+        if (error.code)
+        {
+            handler(error, m_Reply);
+            return;
+        }
+
+        takeChunk(chunk_size);
+
+        if (chunk_size == 0)
+        {
+            processReply(handler);
+        }
+        else
+        {
+            readChunkSize(handler);
+        }
+    }
 
     template<class Handler>
-    void processChunk(ConnectionError error, size_t chunk_size, HttpReply reply, Handler handler);
+    void startStreamChunk(const ConnectionError &error, size_t line_len, Handler &handler)
+    {
+        if (error.code)
+        {
+            handler(error, boost::string_ref());
+            return;
+        }
+
+        size_t chunk_size = 0;
+        if (!takeChunkSize(line_len, chunk_size))
+        {
+            handler(protocolError(), boost::string_ref());
+            return;
+        }
+
+        if (chunk_size == 0)
+        {
+            handler(ConnectionError(boost::asio::error::eof), boost::string_ref());
+            return;
+        }
+
+        m_Socket->asyncRead(ExactlyCondition(chunk_size + 2),
+            [self = this, handler = std::move(handler), chunk_size](const ConnectionError &read_error, size_t) mutable
+            {
+                if (read_error.code)
+                {
+                    handler(read_error, boost::string_ref());
+                    return;
+                }
+
+                RecvBuffer &buffer = self->m_Socket->recvBuffer();
+                boost::string_ref chunk = buffer.view(chunk_size);
+                buffer.consume(chunk_size + 2);
+                handler(noError(), chunk);
+            });
+    }
 
 private:
     boost::shared_ptr<TcpClient> m_Socket;
+    HttpParser m_Parser;
+    HttpReply m_Reply;
+    body_t m_BodyType;
+    size_t m_BodyLen;
+    std::string m_SessionKey;           // host:port, for ssl session resumption
+
+    bool m_WebSocket;
+    bool m_WsClientSide;
+    bool m_WsDeflate;
+    bool m_WsCloseSent;
+    bool m_WsFragmented;                // continuation frames of message are expected
+    bool m_WsCompressed;                // message being assembled is deflated
+    websocket::FrameHead m_WsHead;      // of frame being read
+    boost::string_ref m_WsView;         // message for handler
+    std::string m_WsFragments;
+    std::string m_WsMessage;            // inflated message
 };
-
@@ -0,0 +1,192 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <utility>
+
+#include <boost/noncopyable.hpp>
+
+
+/*
+ * Memory for asio operations of one chain (reads or writes of connection),
+ * where next operation is started only after previous one is completed.
+ * Block is kept between operations and grows up to the biggest operation,
+ * so in steady state nothing is allocated. Asio frees operation before
+ * calling its handler, so handler could start next operation right away.
+ *
+ * Not thread safe: operations of chain should be started on io thread of socket.
+ */
+class HandlerMemory: private boost::noncopyable
+{
+public:
+    HandlerMemory() :
+        m_Block(nullptr),
+        m_Size(0),
+        m_InUse(false)
+    {
+    }
+
+    ~HandlerMemory()
+    {
+        ::operator delete(m_Block);
+    }
+
+    void *allocate(size_t size)
+    {
+        if (m_InUse)
+        {
+            // second operation of chain, should not happen
+            return ::operator new(size);
+        }
+
+        if (size > m_Size)
+        {
+            ::operator delete(m_Block);
+            m_Block = nullptr;
+            m_Size = 0;
+
+            m_Block = ::operator new(size);
+            m_Size = size;
+        }
+
+        m_InUse = true;
+        return m_Block;
+    }
+
+    void deallocate(void *p)
+    {
+        if (p == m_Block)
+        {
+            m_InUse = false;
+            return;
+        }
+        ::operator delete(p);
+    }
+
+    // for idle connections
+    void release()
+    {
+        if (!m_InUse)
+        {
+            ::operator delete(m_Block);
+            m_Block = nullptr;
+            m_Size = 0;
+        }
+    }
+
+private:
+    void *m_Block;
+    size_t m_Size;
+    bool m_InUse;
+};
+
+
+/*
+ * Memory for handoffs from other threads to io thread (response of database worker,
+ * write of push): block is taken by thread, which starts operation, and is given back
+ * on io thread, when asio frees operation before calling its handler.
+ * Handoff, which meets the block taken, gets memory from heap as usual.
+ */
+class HandoffMemory: private boost::noncopyable
+{
+public:
+    HandoffMemory() :
+        m_Block(nullptr),
+        m_Size(0),
+        m_InUse(false)
+    {
+    }
+
+    ~HandoffMemory()
+    {
+        ::operator delete(m_Block.load());
+    }
+
+    void *allocate(size_t size)
+    {
+        bool expected = false;
+        if (!m_InUse.compare_exchange_strong(expected, true, std::memory_order_acquire))
+        {
+            return ::operator new(size);
+        }
+
+        // block is owned by this thread until it is given back
+        if (size > m_Size)
+        {
+            ::operator delete(m_Block.exchange(nullptr, std::memory_order_relaxed));
+            m_Size = 0;
+
+            m_Block.store(::operator new(size), std::memory_order_relaxed);
+            m_Size = size;
+        }
+        return m_Block.load(std::memory_order_relaxed);
+    }
+
+    void deallocate(void *p)
+    {
+        // heap memory of other handoff is never equal to the block
+        if (p == m_Block.load(std::memory_order_relaxed))
+        {
+            m_InUse.store(false, std::memory_order_release);
+            return;
+        }
+        ::operator delete(p);
+    }
+
+    // for idle connections
+    void release()
+    {
+        bool expected = false;
+        if (m_InUse.compare_exchange_strong(expected, true, std::memory_order_acquire))
+        {
+            ::operator delete(m_Block.exchange(nullptr, std::memory_order_relaxed));
+            m_Size = 0;
+            m_InUse.store(false, std::memory_order_release);
+        }
+    }
+
+private:
+    std::atomic<void *> m_Block;            // read by other threads, changed by owner only
+    size_t m_Size;
+    std::atomic<bool> m_InUse;
+};
+
+
+// gives memory to asio through allocation hooks of handler
+template<class Handler, class Memory = HandlerMemory>
+class AllocHandler
+{
+public:
+    AllocHandler(Memory &memory, Handler handler) :
+        m_Memory(&memory),
+        m_Handler(std::move(handler))
+    {
+    }
+
+    template<class... Args>
+    void operator()(Args&&... args)
+    {
+        m_Handler(std::forward<Args>(args)...);
+    }
+
+    friend void *asio_handler_allocate(size_t size, AllocHandler *self)
+    {
+        return self->m_Memory->allocate(size);
+    }
+
+    friend void asio_handler_deallocate(void *p, size_t, AllocHandler *self)
+    {
+        self->m_Memory->deallocate(p);
+    }
+
+private:
+    Memory *m_Memory;
+    Handler m_Handler;
+};
+
+template<class Memory, class Handler>
+AllocHandler<Handler, Memory> makeAllocHandler(Memory &memory, Handler handler)
+{
+    return AllocHandler<Handler, Memory>(memory, std::move(handler));
+}
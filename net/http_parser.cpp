@@ -0,0 +1,277 @@
+#include <cstring>
+#include <limits>
+
+#include <strings.h>
+
+#include "net/http_parser.hpp"
+
+
+namespace
+{
+
+struct KnownHeader
+{
+    const char *name;
+    size_t len;
+};
+
+// order of http::header_t
+const KnownHeader KNOWN_HEADERS[] = {
+    { "Content-Length",    sizeof("Content-Length") - 1 },
+    { "Content-Type",      sizeof("Content-Type") - 1 },
+    { "Transfer-Encoding", sizeof("Transfer-Encoding") - 1 },
+    { "Content-Encoding",  sizeof("Content-Encoding") - 1 },
+    { "Accept",            sizeof("Accept") - 1 },
+    { "Upgrade",                  sizeof("Upgrade") - 1 },
+    { "Sec-WebSocket-Key",        sizeof("Sec-WebSocket-Key") - 1 },
+    { "Sec-WebSocket-Accept",     sizeof("Sec-WebSocket-Accept") - 1 },
+    { "Sec-WebSocket-Extensions", sizeof("Sec-WebSocket-Extensions") - 1 },
+};
+
+static_assert(sizeof(KNOWN_HEADERS) / sizeof(KNOWN_HEADERS[0]) == static_cast<size_t>(http::header_t::COUNT),
+              "all interned headers should have names");
+
+bool iequals(boost::string_ref a, const char *b, size_t len)
+{
+    return a.size() == len && ::strncasecmp(a.data(), b, len) == 0;
+}
+
+bool is_space(char c)
+{
+    return c == ' ' || c == '\t';
+}
+
+boost::string_ref trimmed(boost::string_ref s)
+{
+    while (!s.empty() && is_space(s.front()))
+    {
+        s.remove_prefix(1);
+    }
+    while (!s.empty() && is_space(s.back()))
+    {
+        s.remove_suffix(1);
+    }
+    return s;
+}
+
+// next token up to space; rest of line stays in 'line'
+boost::string_ref next_token(boost::string_ref &line)
+{
+    size_t pos = line.find(' ');
+    boost::string_ref token = line.substr(0, pos);
+    line.remove_prefix(pos == boost::string_ref::npos ? line.size() : pos + 1);
+    return token;
+}
+
+}   // namespace
+
+
+void HttpParser::reset()
+{
+    m_State = state_t::INCOMPLETE;
+    m_Scanned = 0;
+    m_HeadSize = 0;
+
+    m_IsRequest = false;
+    m_Method.clear();
+    m_Resource.clear();
+    m_Status = 0;
+
+    m_HeaderCount = 0;
+    m_Known.fill(boost::string_ref());
+
+    m_HasContentLength = false;
+    m_ContentLength = 0;
+}
+
+HttpParser::state_t HttpParser::parse(const char *data, size_t size)
+{
+    if (m_State != state_t::INCOMPLETE)
+    {
+        return m_State;
+    }
+
+    // \r\n\r\n could be split between previous and this call
+    size_t from = m_Scanned > 3 ? m_Scanned - 3 : 0;
+    const char *end = nullptr;
+    for (const char *p = data + from; p + 4 <= data + size; )
+    {
+        p = static_cast<const char *>(::memchr(p, '\r', data + size - p));
+        if (!p || p + 4 > data + size)
+        {
+            break;
+        }
+        if (p[1] == '\n' && p[2] == '\r' && p[3] == '\n')
+        {
+            end = p + 4;
+            break;
+        }
+        ++p;
+    }
+
+    if (!end)
+    {
+        m_Scanned = size;
+        if (size > MAX_HEAD_SIZE)
+        {
+            m_State = state_t::ERROR;
+        }
+        return m_State;
+    }
+
+    m_HeadSize = end - data;
+    m_State = parseHead(data, m_HeadSize);
+    return m_State;
+}
+
+bool HttpParser::isChunked() const
+{
+    boost::string_ref te = get(http::header_t::TRANSFER_ENCODING);
+    return iequals(te, "chunked", sizeof("chunked") - 1);
+}
+
+HttpParser::state_t HttpParser::parseHead(const char *data, size_t size)
+{
+    boost::string_ref head(data, size - 2);     // every line ends with \r\n
+    bool start_line = true;
+
+    while (!head.empty())
+    {
+        size_t pos = head.find("\r\n");
+        boost::string_ref line = head.substr(0, pos);
+        head.remove_prefix(pos + 2);
+
+        if (start_line)
+        {
+            if (!parseStartLine(line))
+            {
+                return state_t::ERROR;
+            }
+            start_line = false;
+            continue;
+        }
+
+        if (!parseHeaderLine(line))
+        {
+            return state_t::ERROR;
+        }
+    }
+
+    if (start_line)
+    {
+        return state_t::ERROR;
+    }
+
+    // length of body is ambiguous (rfc 7230, 3.3.3): such message is a way of request smuggling
+    if (m_HasContentLength && has(http::header_t::TRANSFER_ENCODING))
+    {
+        return state_t::ERROR;
+    }
+    return state_t::DONE;
+}
+
+bool HttpParser::parseStartLine(boost::string_ref line)
+/*
+ *  request:  "POST /v1/user/auth HTTP/1.1"
+ *  response: "HTTP/1.1 200 OK"
+ */
+{
+    boost::string_ref first = next_token(line);
+    boost::string_ref second = next_token(line);
+    if (first.empty() || second.empty())
+    {
+        return false;
+    }
+
+    if (first.size() >= 5 && ::strncasecmp(first.data(), "http/", 5) == 0)
+    {
+        if (second.size() != 3)
+        {
+            return false;
+        }
+
+        m_Status = 0;
+        for (char c : second)
+        {
+            if (c < '0' || c > '9')
+            {
+                return false;
+            }
+            m_Status = m_Status * 10 + (c - '0');
+        }
+        return true;
+    }
+
+    m_IsRequest = true;
+    m_Method = first;
+    m_Resource = second;
+    return true;
+}
+
+bool HttpParser::parseHeaderLine(boost::string_ref line)
+{
+    size_t pos = line.find(':');
+    if (pos == boost::string_ref::npos || pos == 0)
+    {
+        // malformed lines are skipped, as before
+        return true;
+    }
+
+    Header header;
+    header.name = line.substr(0, pos);
+    header.value = trimmed(line.substr(pos + 1));
+
+    // headers above the limit are not listed, but known ones are still taken
+    if (m_HeaderCount < MAX_HEADERS)
+    {
+        m_Headers[m_HeaderCount++] = header;
+    }
+
+    for (size_t i = 0; i < static_cast<size_t>(http::header_t::COUNT); ++i)
+    {
+        if (!iequals(header.name, KNOWN_HEADERS[i].name, KNOWN_HEADERS[i].len))
+        {
+            continue;
+        }
+
+        // string_ref of empty value still should mark header as present
+        m_Known[i] = header.value.empty() ? boost::string_ref(header.name.end(), 0) : header.value;
+        if (static_cast<http::header_t>(i) == http::header_t::CONTENT_LENGTH)
+        {
+            return parseContentLength(header.value);
+        }
+        break;
+    }
+    return true;
+}
+
+bool HttpParser::parseContentLength(boost::string_ref value)
+{
+    if (value.empty())
+    {
+        return false;
+    }
+
+    size_t len = 0;
+    for (char c : value)
+    {
+        if (c < '0' || c > '9')
+        {
+            return false;
+        }
+        size_t digit = c - '0';
+        if (len > (std::numeric_limits<size_t>::max() - digit) / 10)
+        {
+            return false;
+        }
+        len = len * 10 + digit;
+    }
+
+    if (m_HasContentLength && len != m_ContentLength)
+    {
+        return false;
+    }
+    m_HasContentLength = true;
+    m_ContentLength = len;
+    return true;
+}
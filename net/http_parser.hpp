@@ -0,0 +1,88 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include <boost/utility/string_ref.hpp>
+
+#include "common/http.hpp"
+
+
+/*
+ * Incremental parser of http/1.1 head (start line and headers).
+ * Works over the receive buffer itself: all results are views into it,
+ * so they are valid until the buffer is consumed. Nothing is allocated.
+ *
+ * parse() could be called each time new data arrived, with whole unconsumed
+ * buffer: search of the end of head continues from the place where it stopped.
+ */
+class HttpParser
+{
+public:
+    enum class state_t : uint8_t
+    {
+        INCOMPLETE,
+        DONE,
+        ERROR
+    };
+
+    struct Header
+    {
+        boost::string_ref name;
+        boost::string_ref value;
+    };
+
+    static const size_t MAX_HEADERS = 32;           // listed ones, the rest are only looked up as known
+    static const size_t MAX_HEAD_SIZE = 64 * 1024;
+
+public:
+    HttpParser() { reset(); }
+
+    void reset();
+
+    state_t parse(const char *data, size_t size);
+    state_t state() const { return m_State; }
+
+    // size of head with final \r\n\r\n
+    size_t headSize() const { return m_HeadSize; }
+
+    bool isRequest() const { return m_IsRequest; }
+    boost::string_ref method() const { return m_Method; }
+    boost::string_ref resource() const { return m_Resource; }
+    int status() const { return m_Status; }
+
+    size_t headerCount() const { return m_HeaderCount; }
+    const Header &header(size_t i) const { return m_Headers[i]; }
+
+    // only interned headers are looked up without scan
+    bool has(http::header_t h) const { return m_Known[static_cast<size_t>(h)].data() != nullptr; }
+    boost::string_ref get(http::header_t h) const { return m_Known[static_cast<size_t>(h)]; }
+
+    bool hasContentLength() const { return m_HasContentLength; }
+    size_t contentLength() const { return m_ContentLength; }
+    bool isChunked() const;
+
+private:
+    state_t parseHead(const char *data, size_t size);
+    bool parseStartLine(boost::string_ref line);
+    bool parseHeaderLine(boost::string_ref line);
+    bool parseContentLength(boost::string_ref value);
+
+private:
+    state_t m_State;
+    size_t m_Scanned;
+    size_t m_HeadSize;
+
+    bool m_IsRequest;
+    boost::string_ref m_Method;
+    boost::string_ref m_Resource;
+    int m_Status;
+
+    size_t m_HeaderCount;
+    std::array<Header, MAX_HEADERS> m_Headers;
+    std::array<boost::string_ref, static_cast<size_t>(http::header_t::COUNT)> m_Known;
+
+    bool m_HasContentLength;
+    size_t m_ContentLength;
+};
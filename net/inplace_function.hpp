@@ -0,0 +1,124 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+
+/*
+ * Move-only std::function, which keeps callable inside of itself.
+ * Handlers of queued writes are stored here, so queueing of write
+ * does not allocate. Too big callable is a compile error.
+ */
+template<class Signature, size_t Capacity = 64>
+class InplaceFunction;
+
+template<class R, class... Args, size_t Capacity>
+class InplaceFunction<R(Args...), Capacity>
+{
+public:
+    InplaceFunction() :
+        m_Ops(nullptr)
+    {
+    }
+
+    template<class F, class = typename std::enable_if<!std::is_same<typename std::decay<F>::type, InplaceFunction>::value>::type>
+    InplaceFunction(F &&f)      // NOLINT
+    {
+        typedef typename std::decay<F>::type Callable;
+        static_assert(sizeof(Callable) <= Capacity, "callable is too big for InplaceFunction");
+        static_assert(alignof(Callable) <= alignof(Storage), "callable is overaligned for InplaceFunction");
+
+        new (&m_Storage) Callable(std::forward<F>(f));
+        m_Ops = OpsFor<Callable>::get();
+    }
+
+    InplaceFunction(InplaceFunction &&other) :
+        m_Ops(other.m_Ops)
+    {
+        if (m_Ops)
+        {
+            m_Ops->move(&m_Storage, &other.m_Storage);
+            other.reset();
+        }
+    }
+
+    InplaceFunction &operator=(InplaceFunction &&other)
+    {
+        if (this != &other)
+        {
+            reset();
+            if (other.m_Ops)
+            {
+                other.m_Ops->move(&m_Storage, &other.m_Storage);
+                m_Ops = other.m_Ops;
+                other.reset();
+            }
+        }
+        return *this;
+    }
+
+    InplaceFunction(const InplaceFunction &) = delete;
+    InplaceFunction &operator=(const InplaceFunction &) = delete;
+
+    ~InplaceFunction()
+    {
+        reset();
+    }
+
+    R operator()(Args... args)
+    {
+        return m_Ops->invoke(&m_Storage, std::forward<Args>(args)...);
+    }
+
+    explicit operator bool() const { return m_Ops != nullptr; }
+
+    void reset()
+    {
+        if (m_Ops)
+        {
+            m_Ops->destroy(&m_Storage);
+            m_Ops = nullptr;
+        }
+    }
+
+private:
+    typedef typename std::aligned_storage<Capacity>::type Storage;
+
+    struct Ops
+    {
+        R (*invoke)(void *callable, Args&&... args);
+        void (*move)(void *to, void *from);
+        void (*destroy)(void *callable);
+    };
+
+    template<class Callable>
+    struct OpsFor
+    {
+        static R invoke(void *callable, Args&&... args)
+        {
+            return (*static_cast<Callable *>(callable))(std::forward<Args>(args)...);
+        }
+
+        static void move(void *to, void *from)
+        {
+            new (to) Callable(std::move(*static_cast<Callable *>(from)));
+        }
+
+        static void destroy(void *callable)
+        {
+            static_cast<Callable *>(callable)->~Callable();
+        }
+
+        static const Ops *get()
+        {
+            static const Ops ops = { &invoke, &move, &destroy };
+            return &ops;
+        }
+    };
+
+private:
+    Storage m_Storage;
+    const Ops *m_Ops;
+};
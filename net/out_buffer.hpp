@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstring>
+#include <string>
+
+#include <boost/asio/buffer.hpp>
+
+
+/*
+ * Outgoing data with free space reserved in front of it.
+ * Body is serialized right into the buffer (it is rapidjson output stream),
+ * protocol head is prepended into reserved space later, so whole message
+ * is one contiguous buffer and body is never copied.
+ *
+ * NB: ssl stream writes every buffer of a sequence into its own record,
+ *     that is why head and body are not gathered from separate buffers.
+ */
+class OutBuffer
+{
+public:
+    typedef char Ch;
+
+    static const size_t HEADROOM = 192;
+
+public:
+    OutBuffer() :
+        m_Data(HEADROOM, '\0'),
+        m_Begin(HEADROOM)
+    {
+    }
+
+    // data without headroom
+    explicit OutBuffer(std::string data) :
+        m_Data(std::move(data)),
+        m_Begin(0)
+    {
+    }
+
+    // rapidjson output stream
+    void Put(char c) { m_Data.push_back(c); }
+    void Flush() {}
+
+    void reserve(size_t size) { m_Data.reserve(m_Begin + size); }
+    void append(const char *data, size_t size) { m_Data.append(data, size); }
+    void append(const std::string &data) { m_Data.append(data); }
+
+    // false - no space left in front of data
+    bool prepend(const char *data, size_t size)
+    {
+        if (size > m_Begin)
+        {
+            return false;
+        }
+        m_Begin -= size;
+        memcpy(&m_Data[m_Begin], data, size);
+        return true;
+    }
+
+    const char *data() const { return m_Data.data() + m_Begin; }
+    char *data() { return &m_Data[m_Begin]; }
+    size_t size() const { return m_Data.size() - m_Begin; }
+    bool empty() const { return size() == 0; }
+
+    boost::asio::const_buffers_1 buffers() const { return boost::asio::buffer(data(), size()); }
+
+    void clear()
+    {
+        m_Data.clear();
+        m_Data.shrink_to_fit();
+        m_Begin = 0;
+    }
+
+private:
+    std::string m_Data;
+    size_t m_Begin;
+};
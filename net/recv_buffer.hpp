@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstring>
+#include <memory>
+
+#include <boost/asio/buffer.hpp>
+#include <boost/utility/string_ref.hpp>
+
+
+/*
+ * Linear receive buffer of connection: socket reads right into its tail,
+ * parser and api layer work on [data(), data() + size()) in place.
+ *
+ * Memory is allocated on first read and grows only when one message
+ * does not fit (up to limit), unread bytes are moved to the front
+ * only when there is too little space after them.
+ */
+class RecvBuffer
+{
+public:
+    static const size_t INITIAL_CAPACITY = 16 * 1024;
+    static const size_t DEFAULT_LIMIT = 1024 * 1024;
+
+public:
+    RecvBuffer() :
+        m_Capacity(0),
+        m_Limit(DEFAULT_LIMIT),
+        m_Begin(0),
+        m_End(0)
+    {
+    }
+
+    void setLimit(size_t limit) { m_Limit = limit; }
+    size_t limit() const { return m_Limit; }
+
+    const char *data() const { return m_Data.get() + m_Begin; }
+    char *data() { return m_Data.get() + m_Begin; }
+    size_t size() const { return m_End - m_Begin; }
+    bool empty() const { return m_Begin == m_End; }
+    boost::string_ref view(size_t size) const { return boost::string_ref(data(), size); }
+
+    void consume(size_t size)
+    {
+        m_Begin += size;
+        if (m_Begin == m_End)
+        {
+            m_Begin = m_End = 0;
+        }
+    }
+
+    // free space for next read; empty buffer - limit is reached
+    boost::asio::mutable_buffers_1 prepare()
+    {
+        if (m_Capacity - m_End < m_Capacity / 4 && m_Begin != 0)
+        {
+            ::memmove(m_Data.get(), data(), size());
+            m_End -= m_Begin;
+            m_Begin = 0;
+        }
+
+        if (m_End == m_Capacity && m_Capacity < m_Limit)
+        {
+            size_t capacity = m_Capacity ? m_Capacity * 2 : INITIAL_CAPACITY;
+            capacity = capacity < m_Limit ? capacity : m_Limit;
+            std::unique_ptr<char[]> data(new char[capacity]);
+            if (m_End)
+            {
+                ::memcpy(data.get(), m_Data.get(), m_End);
+            }
+            m_Data = std::move(data);
+            m_Capacity = capacity;
+        }
+
+        return boost::asio::buffer(m_Data.get() + m_End, m_Capacity - m_End);
+    }
+
+    void commit(size_t size) { m_End += size; }
+
+    // returns memory, if there is no unread data
+    void shrink()
+    {
+        if (empty())
+        {
+            m_Data.reset();
+            m_Capacity = 0;
+            m_Begin = m_End = 0;
+        }
+    }
+
+private:
+    std::unique_ptr<char[]> m_Data;
+    size_t m_Capacity;
+    size_t m_Limit;
+    size_t m_Begin;
+    size_t m_End;
+};
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <openssl/ssl.h>
+
+
+/*
+ * Client side cache of ssl sessions, key is "host:port".
+ * Session is offered in the next handshake to the same server, so reconnect
+ * is abbreviated handshake (session id or ticket) instead of full one.
+ */
+class SslSessionCache
+{
+public:
+    static SslSessionCache &instance()
+    {
+        static SslSessionCache cache;
+        return cache;
+    }
+
+    ~SslSessionCache()
+    {
+        for (auto &it : m_Sessions)
+        {
+            SSL_SESSION_free(it.second);
+        }
+    }
+
+    // before handshake
+    void restore(const std::string &key, SSL *ssl)
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        auto it = m_Sessions.find(key);
+        if (it != m_Sessions.end())
+        {
+            SSL_set_session(ssl, it->second);
+        }
+    }
+
+    // after handshake; with tls 1.3 ticket comes later, so it is worth to call again before close
+    void store(const std::string &key, SSL *ssl)
+    {
+        SSL_SESSION *session = SSL_get1_session(ssl);
+        if (!session)
+        {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        SSL_SESSION *&stored = m_Sessions[key];
+        if (stored)
+        {
+            SSL_SESSION_free(stored);
+        }
+        stored = session;
+    }
+
+    void drop(const std::string &key)
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        auto it = m_Sessions.find(key);
+        if (it != m_Sessions.end())
+        {
+            SSL_SESSION_free(it->second);
+            m_Sessions.erase(it);
+        }
+    }
+
+private:
+    SslSessionCache() = default;
+
+private:
+    std::mutex m_Mutex;
+    std::unordered_map<std::string, SSL_SESSION *> m_Sessions;
+};
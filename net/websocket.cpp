@@ -0,0 +1,377 @@
+#include <algorithm>
+#include <cstring>
+
+#include <strings.h>
+#include <zlib.h>
+
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <openssl/sha.h>
+
+#include "net/websocket.hpp"
+
+
+namespace websocket
+{
+
+namespace
+{
+
+const char GUID[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+const char DEFLATE_ANSWER[] = "permessage-deflate; server_no_context_takeover; client_no_context_takeover";
+
+// end of block, which is added by Z_SYNC_FLUSH: it is not sent (rfc 7692, 7.2.1)
+const char DEFLATE_TAIL[] = { '\x00', '\x00', '\xff', '\xff' };
+
+std::string base64(const unsigned char *data, size_t size)
+{
+    std::string out(4 * ((size + 2) / 3), '\0');
+    int len = EVP_EncodeBlock(reinterpret_cast<unsigned char *>(&out[0]), data, size);
+    out.resize(len);
+    return out;
+}
+
+/*
+ * zlib streams of thread: messages are independent (no context takeover),
+ * so stream is reset before each of them and serves every connection of thread
+ */
+class Deflater
+{
+public:
+    Deflater()
+    {
+        memset(&m_Stream, 0, sizeof(m_Stream));
+        m_Ok = deflateInit2(&m_Stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+    }
+
+    ~Deflater()
+    {
+        if (m_Ok)
+        {
+            deflateEnd(&m_Stream);
+        }
+    }
+
+    bool deflate(boost::string_ref data, OutBuffer &out)
+    {
+        if (!m_Ok || deflateReset(&m_Stream) != Z_OK)
+        {
+            return false;
+        }
+
+        m_Scratch.resize(deflateBound(&m_Stream, data.size()) + 16);
+        m_Stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));     // NOLINT
+        m_Stream.avail_in = data.size();
+        m_Stream.next_out = reinterpret_cast<Bytef *>(&m_Scratch[0]);
+        m_Stream.avail_out = m_Scratch.size();
+
+        if (::deflate(&m_Stream, Z_SYNC_FLUSH) != Z_OK || m_Stream.avail_in != 0)
+        {
+            return false;
+        }
+
+        size_t size = m_Scratch.size() - m_Stream.avail_out;
+        if (size < sizeof(DEFLATE_TAIL) || memcmp(&m_Scratch[size - sizeof(DEFLATE_TAIL)], DEFLATE_TAIL, sizeof(DEFLATE_TAIL)) != 0)
+        {
+            return false;
+        }
+        size -= sizeof(DEFLATE_TAIL);
+
+        if (size >= data.size())
+        {
+            return false;
+        }
+        out.append(m_Scratch.data(), size);
+        return true;
+    }
+
+private:
+    z_stream m_Stream;
+    bool m_Ok;
+    std::string m_Scratch;
+};
+
+class Inflater
+{
+public:
+    Inflater()
+    {
+        memset(&m_Stream, 0, sizeof(m_Stream));
+        m_Ok = inflateInit2(&m_Stream, -MAX_WBITS) == Z_OK;
+    }
+
+    ~Inflater()
+    {
+        if (m_Ok)
+        {
+            inflateEnd(&m_Stream);
+        }
+    }
+
+    bool inflate(boost::string_ref data, std::string &out, size_t limit)
+    {
+        out.clear();
+        if (!m_Ok || inflateReset(&m_Stream) != Z_OK)
+        {
+            return false;
+        }
+
+        return feed(data, out, limit) && feed(boost::string_ref(DEFLATE_TAIL, sizeof(DEFLATE_TAIL)), out, limit);
+    }
+
+private:
+    bool feed(boost::string_ref data, std::string &out, size_t limit)
+    {
+        m_Stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));     // NOLINT
+        m_Stream.avail_in = data.size();
+
+        // output could be pending, while there is no space for it
+        do
+        {
+            size_t used = out.size();
+            if (used >= limit)
+            {
+                return false;
+            }
+            size_t grow = std::min(std::max<size_t>(data.size() * 2, 1024), limit - used);
+            out.resize(used + grow);
+
+            m_Stream.next_out = reinterpret_cast<Bytef *>(&out[used]);
+            m_Stream.avail_out = grow;
+
+            int status = ::inflate(&m_Stream, Z_SYNC_FLUSH);
+            out.resize(out.size() - m_Stream.avail_out);
+            if (status == Z_STREAM_END || status == Z_BUF_ERROR)
+            {
+                // buf error: no progress is possible, everything is inflated
+                return true;
+            }
+            if (status != Z_OK)
+            {
+                return false;
+            }
+        }
+        while (m_Stream.avail_in != 0 || m_Stream.avail_out == 0);
+
+        return true;
+    }
+
+private:
+    z_stream m_Stream;
+    bool m_Ok;
+};
+
+// "permessage-deflate; client_max_window_bits, x-webkit-deflate-frame"
+bool has_token(boost::string_ref list, boost::string_ref token)
+{
+    while (!list.empty())
+    {
+        size_t pos = list.find_first_of(",;");
+        boost::string_ref item = list.substr(0, pos);
+        list.remove_prefix(pos == boost::string_ref::npos ? list.size() : pos + 1);
+
+        while (!item.empty() && item.front() == ' ')
+        {
+            item.remove_prefix(1);
+        }
+        while (!item.empty() && item.back() == ' ')
+        {
+            item.remove_suffix(1);
+        }
+
+        if (item.size() == token.size() && ::strncasecmp(item.data(), token.data(), token.size()) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+}   // namespace
+
+
+parse_t parse_head(const char *data, size_t size, FrameHead &head)
+{
+    if (size < 2)
+    {
+        return parse_t::INCOMPLETE;
+    }
+
+    const uint8_t *p = reinterpret_cast<const uint8_t *>(data);
+    head.fin = (p[0] & 0x80) != 0;
+    head.compressed = (p[0] & 0x40) != 0;
+    head.opcode = static_cast<opcode_t>(p[0] & 0x0f);
+    head.masked = (p[1] & 0x80) != 0;
+
+    if ((p[0] & 0x30) != 0)
+    {
+        // rsv2, rsv3: no extension uses them
+        return parse_t::ERROR;
+    }
+
+    size_t len_size = 0;
+    uint64_t len = p[1] & 0x7f;
+    if (len == 126)
+    {
+        len_size = 2;
+    }
+    else if (len == 127)
+    {
+        len_size = 8;
+    }
+
+    head.size = 2 + len_size + (head.masked ? 4 : 0);
+    if (size < head.size)
+    {
+        return parse_t::INCOMPLETE;
+    }
+
+    if (len_size)
+    {
+        len = 0;
+        for (size_t i = 0; i < len_size; ++i)
+        {
+            len = (len << 8) | p[2 + i];
+        }
+        if (len >> 63)
+        {
+            return parse_t::ERROR;
+        }
+    }
+    head.payload_len = len;
+
+    if (head.masked)
+    {
+        memcpy(head.mask, p + 2 + len_size, 4);
+    }
+
+    if (is_control(head.opcode) && (!head.fin || len > MAX_CONTROL_PAYLOAD || head.compressed))
+    {
+        return parse_t::ERROR;
+    }
+    return parse_t::DONE;
+}
+
+void unmask(char *data, size_t size, const uint8_t mask[4])
+{
+    for (size_t i = 0; i < size; ++i)
+    {
+        data[i] ^= mask[i & 3];
+    }
+}
+
+OutBuffer make_frame(OutBuffer payload, opcode_t opcode, bool compressed, bool masked)
+{
+    size_t size = payload.size();
+
+    uint8_t head[MAX_HEAD_SIZE];
+    size_t head_size = 0;
+    head[head_size++] = 0x80 | (compressed ? 0x40 : 0) | static_cast<uint8_t>(opcode);
+
+    uint8_t mask_bit = masked ? 0x80 : 0;
+    if (size < 126)
+    {
+        head[head_size++] = mask_bit | static_cast<uint8_t>(size);
+    }
+    else if (size <= 0xffff)
+    {
+        head[head_size++] = mask_bit | 126;
+        head[head_size++] = static_cast<uint8_t>(size >> 8);
+        head[head_size++] = static_cast<uint8_t>(size);
+    }
+    else
+    {
+        head[head_size++] = mask_bit | 127;
+        for (int shift = 56; shift >= 0; shift -= 8)
+        {
+            head[head_size++] = static_cast<uint8_t>(static_cast<uint64_t>(size) >> shift);
+        }
+    }
+
+    if (masked)
+    {
+        uint8_t *mask = head + head_size;
+        RAND_bytes(mask, 4);
+        head_size += 4;
+        unmask(payload.data(), size, mask);
+    }
+
+    if (!payload.prepend(reinterpret_cast<const char *>(head), head_size))
+    {
+        // payload without headroom: frame is assembled once
+        OutBuffer frame;
+        frame.reserve(size);
+        frame.append(payload.data(), size);
+        frame.prepend(reinterpret_cast<const char *>(head), head_size);
+        return frame;
+    }
+    return payload;
+}
+
+bool deflate_message(boost::string_ref data, OutBuffer &out)
+{
+    if (data.size() < DEFLATE_MIN_SIZE)
+    {
+        return false;
+    }
+
+    static thread_local Deflater deflater;
+    return deflater.deflate(data, out);
+}
+
+bool inflate_message(boost::string_ref data, std::string &out, size_t limit)
+{
+    static thread_local Inflater inflater;
+    return inflater.inflate(data, out, limit);
+}
+
+std::string accept_key(boost::string_ref key)
+{
+    std::string source(key.data(), key.size());
+    source += GUID;
+
+    unsigned char hash[SHA_DIGEST_LENGTH];
+    SHA1(reinterpret_cast<const unsigned char *>(source.data()), source.size(), hash);
+    return base64(hash, sizeof(hash));
+}
+
+std::string make_key()
+{
+    unsigned char nonce[16];
+    RAND_bytes(nonce, sizeof(nonce));
+    return base64(nonce, sizeof(nonce));
+}
+
+bool deflate_offered(boost::string_ref extensions)
+{
+    return has_token(extensions, "permessage-deflate");
+}
+
+std::string upgrade_request(const std::string &resource, const std::string &host, const std::string &key)
+{
+    std::string request = "GET " + resource + " HTTP/1.1\r\n";
+    request += "Host: " + host + "\r\n";
+    request += "Upgrade: websocket\r\n";
+    request += "Connection: Upgrade\r\n";
+    request += "Sec-WebSocket-Key: " + key + "\r\n";
+    request += "Sec-WebSocket-Version: 13\r\n";
+    request += "Sec-WebSocket-Extensions: permessage-deflate; client_no_context_takeover; server_no_context_takeover\r\n";
+    request += "\r\n";
+    return request;
+}
+
+std::string upgrade_response(boost::string_ref key, bool deflate)
+{
+    std::string response = "HTTP/1.1 101 Switching Protocols\r\n";
+    response += "Upgrade: websocket\r\n";
+    response += "Connection: Upgrade\r\n";
+    response += "Sec-WebSocket-Accept: " + accept_key(key) + "\r\n";
+    if (deflate)
+    {
+        response += std::string("Sec-WebSocket-Extensions: ") + DEFLATE_ANSWER + "\r\n";
+    }
+    response += "\r\n";
+    return response;
+}
+
+}   // namespace websocket
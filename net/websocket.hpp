@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include <boost/utility/string_ref.hpp>
+
+#include "net/out_buffer.hpp"
+
+
+/*
+ * WebSocket (rfc 6455) framing and permessage-deflate (rfc 7692).
+ * Frames are parsed right in the receive buffer, head of outgoing frame
+ * is prepended into headroom of OutBuffer, as http head is.
+ *
+ * Deflate is negotiated without context takeover in both directions:
+ * every message is compressed on its own, so connection keeps no zlib state
+ * and streams are shared by all connections of thread.
+ */
+namespace websocket
+{
+
+enum class opcode_t : uint8_t
+{
+    CONTINUATION = 0x0,
+    TEXT = 0x1,
+    BINARY = 0x2,
+    CLOSE = 0x8,
+    PING = 0x9,
+    PONG = 0xa
+};
+
+inline bool is_control(opcode_t opcode) { return (static_cast<uint8_t>(opcode) & 0x8) != 0; }
+
+static const size_t MAX_HEAD_SIZE = 14;
+static const size_t MAX_CONTROL_PAYLOAD = 125;
+
+// smaller messages are sent as is, deflate would not make them shorter
+static const size_t DEFLATE_MIN_SIZE = 128;
+
+struct FrameHead
+{
+    bool fin = false;
+    bool compressed = false;        // rsv1: message is deflated, set in its first frame
+    opcode_t opcode = opcode_t::CONTINUATION;
+    bool masked = false;
+    uint8_t mask[4] = {};
+    uint64_t payload_len = 0;
+    size_t size = 0;                // of head itself
+};
+
+enum class parse_t : uint8_t
+{
+    INCOMPLETE,
+    DONE,
+    ERROR
+};
+
+parse_t parse_head(const char *data, size_t size, FrameHead &head);
+
+void unmask(char *data, size_t size, const uint8_t mask[4]);
+
+// frame of one message; frames of client are masked, so payload is changed in place
+OutBuffer make_frame(OutBuffer payload, opcode_t opcode, bool compressed, bool masked);
+
+// payload of message frame, compressed if it is worth it; false - sent as is
+bool deflate_message(boost::string_ref data, OutBuffer &out);
+bool inflate_message(boost::string_ref data, std::string &out, size_t limit);
+
+
+/*
+ * Upgrade handshake: GET with "Upgrade: websocket" and random key,
+ * server confirms it by "101 Switching Protocols" with hash of the key
+ */
+std::string accept_key(boost::string_ref key);
+std::string make_key();
+
+bool deflate_offered(boost::string_ref extensions);
+
+std::string upgrade_request(const std::string &resource, const std::string &host, const std::string &key);
+std::string upgrade_response(boost::string_ref key, bool deflate);
+
+}   // namespace websocket
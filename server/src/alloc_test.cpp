@@ -0,0 +1,548 @@
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <string>
+#include <thread>
+
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+#include <boost/make_shared.hpp>
+
+#include <openssl/evp.h>
+#include <openssl/x509.h>
+
+#include "rapidjson/document.h"
+
+#include "libproperty/src/libproperty.hpp"
+
+#include "apiclient.hpp"
+#include "tls_context.hpp"
+#include "net/client.hpp"
+
+
+/*
+ * Heap allocations of request/response cycle on keep-alive connection:
+ * client writes request, server reads it and writes response, client reads response.
+ *
+ * Network layer: plain tcp pair of AsyncHttpClient. After warm up (buffers, handler memory
+ * and vectors have grown) nothing should be allocated; messages are built by caller
+ * and are not counted.
+ *
+ * ApiClient: real /v1/user/status requests with session token over tls, served by ApiClient
+ * in its io thread and by in-memory database worker. Allocations are counted per thread:
+ * client side should allocate nothing, residual ones of server are listed below.
+ *
+ * Exit code is not zero, if allocations are above the expected ones.
+ */
+
+// database worker threads loop until it is set
+std::atomic<bool> g_NeedStop(false);
+
+namespace
+{
+
+// threads, which allocations are counted apart
+enum role_t
+{
+    CLIENT,                 // main thread: client side, both sides of plain tcp pair
+    SERVER_IO,              // io thread of ApiClient
+    WORKER,                 // database workers and others
+    ROLE_COUNT
+};
+
+std::atomic<size_t> g_allocations[ROLE_COUNT];
+std::atomic<size_t> g_ssl_allocations[ROLE_COUNT];
+std::atomic<bool> g_counting(false);
+thread_local role_t t_role = WORKER;
+thread_local bool t_paused = false;
+
+const size_t WARM_UP_CYCLES = 100;
+const size_t CYCLES = 10000;
+
+/*
+ * Residual allocations of one /v1/user/status cycle of ApiClient (steady state).
+ * Server io thread, 8:
+ *   - 1: params of request are copied into db::Task, session token does not fit into small string
+ *        (request details keep capacity of their strings for next request),
+ *   - 3: access log of new request: format string, stream buffer and line,
+ *   - 4: access log of done request: line is formatted by string stream, then logged as text.
+ * Database worker, 6:
+ *   - 3: lookup by name returns vector with copy of user, user is copied out of it
+ *        (with password hash, which does not fit into small string),
+ *   - 3: response body: buffer, allocator and stack of json writer.
+ * Handoffs of response from worker to io thread and of write to socket go through handler memory.
+ * Openssl allocates by malloc: record buffers are released after each read and write
+ * (SSL_MODE_RELEASE_BUFFERS, set by asio too), openssl 3 allocates per record as well;
+ * it depends on version of openssl, so it is printed, not checked.
+ */
+const size_t SERVER_IO_PER_CYCLE = 8;
+const size_t WORKER_PER_CYCLE = 6;
+
+const char REQUEST[] =
+    "POST /v1/user/status HTTP/1.1\r\n"
+    "Host: localhost\r\n"
+    "Content-Type: application/json\r\n"
+    "Content-Length: 26\r\n"
+    "\r\n"
+    "{\"uid\":1,\"user\":\"someone\"}";
+
+const char RESPONSE[] =
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Type: application/json\r\n"
+    "Content-Length: 19\r\n"
+    "\r\n"
+    "{\"status\":\"online\"}";
+
+// message is data of caller, its allocation is not the one of network layer
+OutBuffer make_message(boost::string_ref data)
+{
+    t_paused = true;
+    OutBuffer message{std::string(data.data(), data.size())};
+    t_paused = false;
+    return message;
+}
+
+std::string make_request(const std::string &resource, const std::string &body)
+{
+    return "POST " + resource + " HTTP/1.1\r\n"
+           "Host: localhost\r\n"
+           "Content-Type: application/json\r\n"
+           "Content-Length: " + std::to_string(body.size()) + "\r\n"
+           "\r\n" + body;
+}
+
+size_t allocations()
+{
+    size_t sum = 0;
+    for (const auto &count : g_allocations)
+    {
+        sum += count;
+    }
+    return sum;
+}
+
+// openssl allocates through malloc, it is counted by own hooks
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+void *ssl_malloc(size_t size, const char *, int)
+{
+    if (g_counting) ++g_ssl_allocations[t_role];
+    return malloc(size);
+}
+
+void *ssl_realloc(void *p, size_t size, const char *, int)
+{
+    if (g_counting) ++g_ssl_allocations[t_role];
+    return realloc(p, size);
+}
+
+void ssl_free(void *p, const char *, int)
+{
+    free(p);
+}
+#else
+void *ssl_malloc(size_t size)
+{
+    if (g_counting) ++g_ssl_allocations[t_role];
+    return malloc(size);
+}
+
+void *ssl_realloc(void *p, size_t size)
+{
+    if (g_counting) ++g_ssl_allocations[t_role];
+    return realloc(p, size);
+}
+
+void ssl_free(void *p)
+{
+    free(p);
+}
+#endif
+
+// server certificate, which is made on the fly
+void use_self_signed(boost::asio::ssl::context &context)
+{
+    EVP_PKEY *key = nullptr;
+    EVP_PKEY_CTX *key_ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, nullptr);
+    if (!key_ctx || EVP_PKEY_keygen_init(key_ctx) <= 0
+        || EVP_PKEY_CTX_set_rsa_keygen_bits(key_ctx, 2048) <= 0 || EVP_PKEY_keygen(key_ctx, &key) <= 0)
+    {
+        EVP_PKEY_CTX_free(key_ctx);
+        throw std::runtime_error("key generation failed");
+    }
+    EVP_PKEY_CTX_free(key_ctx);
+
+    X509 *cert = X509_new();
+    X509_set_version(cert, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+    X509_gmtime_adj(X509_get_notBefore(cert), 0);
+    X509_gmtime_adj(X509_get_notAfter(cert), 3600);
+    X509_set_pubkey(cert, key);
+    X509_NAME_add_entry_by_txt(X509_get_subject_name(cert), "CN", MBSTRING_ASC,
+                               reinterpret_cast<const unsigned char *>("localhost"), -1, -1, 0);
+    X509_set_issuer_name(cert, X509_get_subject_name(cert));
+
+    bool ok = X509_sign(cert, key, EVP_sha256()) > 0
+              && SSL_CTX_use_certificate(context.native_handle(), cert) == 1
+              && SSL_CTX_use_PrivateKey(context.native_handle(), key) == 1;
+    X509_free(cert);
+    EVP_PKEY_free(key);
+    if (!ok)
+    {
+        throw std::runtime_error("self signed certificate failed");
+    }
+}
+
+// output of server logs (access log of each request) is not needed
+class NullBuffer: public std::streambuf
+{
+protected:
+    int overflow(int c) override { return c; }
+};
+
+class Loopback
+{
+public:
+    Loopback() :
+        m_Acceptor(m_Io, boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0)),
+        m_ServerSocket(boost::make_shared<TcpClient>(m_Io, false, 0)),
+        m_ClientSocket(boost::make_shared<TcpClient>(m_Io, false, 0)),
+        m_Server(m_ServerSocket),
+        m_Client(m_ClientSocket),
+        m_Cycles(0),
+        m_Failed(false)
+    {
+        // TcpClient::connect waits for io thread, which is not running yet
+        m_ClientSocket->lowestLayer().connect(m_Acceptor.local_endpoint());
+        m_Acceptor.accept(m_ServerSocket->lowestLayer());
+
+        boost::system::error_code ec;
+        m_ClientSocket->makeConnected(ec);
+        if (!ec) m_ServerSocket->makeConnected(ec);
+        if (ec)
+        {
+            throw std::runtime_error("connect failed: " + ec.message());
+        }
+    }
+
+    // false - connection failed
+    bool run()
+    {
+        startCycle();
+        m_Io.run();
+        g_counting = false;
+        return !m_Failed;
+    }
+
+private:
+    void startCycle()
+    {
+        // io service itself allocates on start, so counting is started inside of run
+        g_counting = m_Cycles >= WARM_UP_CYCLES;
+        if (m_Cycles == WARM_UP_CYCLES + CYCLES)
+        {
+            return;
+        }
+        ++m_Cycles;
+
+        m_Server.asyncResponse([this](const ConnectionError &error, const HttpReply &request)
+        {
+            if (error.code || request._resource != "/v1/user/status")
+            {
+                fail("server read", error);
+                return;
+            }
+
+            m_Server.asyncRequest(make_message(RESPONSE), [this](const ConnectionError &error)
+            {
+                if (error.code) fail("server write", error);
+            });
+        });
+
+        m_Client.asyncRequest(make_message(REQUEST), [this](const ConnectionError &error)
+        {
+            if (error.code)
+            {
+                fail("client write", error);
+                return;
+            }
+
+            m_Client.asyncResponse([this](const ConnectionError &error, const HttpReply &response)
+            {
+                if (error.code || response._status != 200)
+                {
+                    fail("client read", error);
+                    return;
+                }
+                startCycle();
+            });
+        });
+    }
+
+    void fail(const char *what, const ConnectionError &error)
+    {
+        std::cerr << what << " failed: " << error.asString() << std::endl;
+        m_Failed = true;
+        m_Io.stop();
+    }
+
+private:
+    boost::asio::io_service m_Io;
+    boost::asio::ip::tcp::acceptor m_Acceptor;
+    boost::shared_ptr<TcpClient> m_ServerSocket;
+    boost::shared_ptr<TcpClient> m_ClientSocket;
+    AsyncHttpClient m_Server;
+    AsyncHttpClient m_Client;
+    size_t m_Cycles;                    // started ones
+    bool m_Failed;
+};
+
+/*
+ * ApiClient of tls connection in own io thread, client is served by main thread.
+ * User is created and logged in first, its session token is used by status requests.
+ */
+class ApiLoopback
+{
+public:
+    ApiLoopback() :
+        m_Tls("", 3600),
+        m_ClientContext(boost::asio::ssl::context::sslv23_client),
+        m_Db(db::type_t::MEMORY, 1, 1, 16, std::chrono::seconds(3600)),
+        m_Handshakes(0, 1),
+        m_Acceptor(m_Io, boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0)),
+        m_ClientSocket(boost::make_shared<TcpClient>(m_Io, m_ClientContext)),
+        m_Client(m_ClientSocket),
+        m_Cycles(0),
+        m_Failed(false)
+    {
+        use_self_signed(m_Tls.context());
+    }
+
+    ~ApiLoopback()
+    {
+        m_Client.close();
+        g_NeedStop = true;
+        m_Db.stop();
+        m_Db.join();
+        m_IoThread.stop();
+        m_IoThread.join();
+    }
+
+    // false - connection or request failed
+    bool run()
+    {
+        m_Db.run();
+        m_IoThread.start();
+        m_IoThread.ioService().post([]() { t_role = SERVER_IO; });
+
+        // TcpClient::connect waits for io thread, which is not running yet
+        boost::shared_ptr<TcpClient> socket = boost::make_shared<TcpClient>(m_IoThread.ioService(), m_Tls.context());
+        m_ClientSocket->lowestLayer().connect(m_Acceptor.local_endpoint());
+        m_Acceptor.accept(socket->lowestLayer());
+
+        boost::system::error_code ec;
+        m_ClientSocket->makeConnected(ec);
+        if (!ec) socket->makeConnected(ec);
+        if (ec || !m_Handshakes.tryAdmit())
+        {
+            throw std::runtime_error("connect failed: " + ec.message());
+        }
+
+        boost::make_shared<ApiClient>(socket, m_Db, m_IoThread, m_Outbound)->serveSslClient(m_Handshakes);
+        m_ClientSocket->ssl_stream().handshake(boost::asio::ssl::stream_base::client);
+
+        const std::string credentials = "{\"user\":\"alloc_test\",\"password\":\"alloc_test\"}";
+        request(make_request("/v1/user/create", credentials), [this, credentials](const HttpReply &)
+        {
+            request(make_request("/v1/user/login", credentials), [this](const HttpReply &response)
+            {
+                rapidjson::Document json;
+                json.Parse(std::string(response.body()).c_str());
+                if (!json.IsObject() || !json.HasMember("id") || !json.HasMember("token"))
+                {
+                    fail("login", response.body());
+                    return;
+                }
+
+                m_Status = make_request("/v1/user/status", "{\"uid\":" + std::to_string(json["id"].GetUint64())
+                    + ",\"user\":\"alloc_test\",\"token\":\"" + json["token"].GetString() + "\"}");
+                startCycle();
+            });
+        });
+
+        m_Io.run();
+        g_counting = false;
+        return !m_Failed;
+    }
+
+private:
+    void startCycle()
+    {
+        if (m_Cycles == WARM_UP_CYCLES || m_Cycles == WARM_UP_CYCLES + CYCLES)
+        {
+            // server finishes previous cycle after client has got its response
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            g_counting = m_Cycles == WARM_UP_CYCLES;
+        }
+        if (m_Cycles == WARM_UP_CYCLES + CYCLES)
+        {
+            return;
+        }
+        ++m_Cycles;
+
+        request(m_Status, [this](const HttpReply &)
+        {
+            startCycle();
+        });
+    }
+
+    template<class Handler>
+    void request(const std::string &message, Handler handler)
+    {
+        m_Client.asyncRequest(make_message(message), [this, handler](const ConnectionError &error)
+        {
+            if (error.code)
+            {
+                fail("client write", error.asString());
+                return;
+            }
+
+            m_Client.asyncResponse([this, handler](const ConnectionError &error, const HttpReply &response)
+            {
+                if (error.code || response._status != 200)
+                {
+                    fail("request", error.code ? error.asString() : std::string(response.body()));
+                    return;
+                }
+                handler(response);
+            });
+        });
+    }
+
+    void fail(const char *what, boost::string_ref error)
+    {
+        std::cerr << what << " failed: " << error << std::endl;
+        m_Failed = true;
+        m_Io.stop();
+    }
+
+private:
+    TlsContext m_Tls;
+    boost::asio::ssl::context m_ClientContext;
+    DatabaseWorker m_Db;
+    IoThread m_IoThread;
+    HandshakePool m_Handshakes;
+    OutboundPolicy m_Outbound;
+
+    boost::asio::io_service m_Io;
+    boost::asio::ip::tcp::acceptor m_Acceptor;
+    boost::shared_ptr<TcpClient> m_ClientSocket;
+    AsyncHttpClient m_Client;
+    std::string m_Status;               // request with session token
+    size_t m_Cycles;                    // started ones
+    bool m_Failed;
+};
+
+}   // namespace
+
+
+void *operator new(size_t size)
+{
+    if (g_counting && !t_paused)
+    {
+        ++g_allocations[t_role];
+    }
+
+    void *p = malloc(size ? size : 1);
+    if (!p)
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+
+int main()
+{
+    // before the first allocation of openssl, otherwise they are not counted
+    bool ssl_counted = CRYPTO_set_mem_functions(ssl_malloc, ssl_realloc, ssl_free) == 1;
+    t_role = CLIENT;
+
+    libproperty::Options *opt = libproperty::Options::impl();
+    opt->add("hibernate_sec", "", "", 30);
+    opt->add("pipeline_depth", "", "", 16);
+    opt->add("websocket_deflate", "", "", true);
+    opt->add("read_timeout_sec", "", "", 10);
+    opt->add("idle_timeout_sec", "", "", 60);
+    opt->add("handshake_timeout_sec", "", "", 10);
+    opt->add("pass_len", "", "", 8);
+
+    try
+    {
+        Loopback loopback;
+        if (!loopback.run())
+        {
+            return 1;
+        }
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "alloc_test: " << e.what() << std::endl;
+        return 1;
+    }
+
+    size_t network = allocations();
+    std::cout << "alloc_test: " << network << " allocations in " << CYCLES << " cycles" << std::endl;
+
+    for (auto &count : g_allocations)
+    {
+        count = 0;
+    }
+
+    NullBuffer null;
+    std::streambuf *out = std::cout.rdbuf(&null);
+    try
+    {
+        ApiLoopback api;
+        if (!api.run())
+        {
+            std::cout.rdbuf(out);
+            return 1;
+        }
+    }
+    catch (const std::exception &e)
+    {
+        std::cout.rdbuf(out);
+        std::cerr << "alloc_test: " << e.what() << std::endl;
+        return 1;
+    }
+    std::cout.rdbuf(out);
+
+    std::cout << "alloc_test: ApiClient over tls, allocations in " << CYCLES << " cycles: "
+              << g_allocations[CLIENT] << " by client, "
+              << g_allocations[SERVER_IO] << " by server io thread (" << SERVER_IO_PER_CYCLE << " per cycle expected), "
+              << g_allocations[WORKER] << " by database worker (" << WORKER_PER_CYCLE << " per cycle expected)";
+    if (ssl_counted)
+    {
+        std::cout << "; openssl: " << g_ssl_allocations[CLIENT] << " by client, "
+                  << g_ssl_allocations[SERVER_IO] << " by server io thread, " << g_ssl_allocations[WORKER] << " by others";
+    }
+    std::cout << std::endl;
+
+    bool ok = network == 0
+              && g_allocations[CLIENT] == 0
+              && g_allocations[SERVER_IO] <= SERVER_IO_PER_CYCLE * CYCLES
+              && g_allocations[WORKER] <= WORKER_PER_CYCLE * CYCLES;
+    return ok ? 0 : 1;
+}
@@ -10,7 +10,6 @@
 
 #include <sys/types.h>
 
-#include <rapidjson/document.h>
 #include <rapidjson/stringbuffer.h>
 #include <rapidjson/writer.h>
 
@@ -18,6 +17,7 @@
 
 #include "apiclient.hpp"
 #include "database.hpp"
+#include "params_decoder.hpp"
 
 #include "o2logger/src/o2logger.hpp"
 
@@ -27,6 +27,42 @@ using namespace o2logger;
 namespace
 {
 
+// how long idle connection should be quiet to release its buffers
+std::chrono::seconds hibernate_after()
+{
+    static const std::chrono::seconds after(libproperty::Options::impl()->get<int>("hibernate_sec"));
+    return after;
+}
+
+// requests of connection, which are processed at the same time
+size_t max_pipeline()
+{
+    static const size_t depth = std::max(1, libproperty::Options::impl()->get<int>("pipeline_depth"));
+    return depth;
+}
+
+// permessage-deflate for websocket connections, if client offers it
+bool websocket_deflate()
+{
+    static const bool deflate = libproperty::Options::impl()->get<bool>("websocket_deflate");
+    return deflate;
+}
+
+// time for client to send request: first one after connect and next ones of keep-alive connection
+std::chrono::milliseconds read_timeout(bool first_request)
+{
+    static const std::chrono::seconds first(libproperty::Options::impl()->get<int>("read_timeout_sec"));
+    static const std::chrono::seconds next(libproperty::Options::impl()->get<int>("idle_timeout_sec"));
+    return first_request ? first : next;
+}
+
+// time for tls handshake, slot of handshake pool is held while it goes
+std::chrono::seconds handshake_timeout()
+{
+    static const std::chrono::seconds timeout(std::max(1, libproperty::Options::impl()->get<int>("handshake_timeout_sec")));
+    return timeout;
+}
+
 std::string generate_session_id(const std::string &local_addr)
 {
     std::stringstream ss;
@@ -50,425 +86,662 @@ std::string generate_session_id(const std::string &local_addr)
     return hex_str + utils::gen_random(2);
 }
 
-uint64_t max_timestamp(std::vector<apiclient_utils::Message> &msgs)
+std::string parse_meta(RequestDetails &details,
+                       boost::string_ref json,
+                       const common::Route &route)
+/*
+ *  parameters are taken by schema of route: required ones and optional ones
+ */
 {
-    uint64_t ts = 0;
-    for (const auto &msg : msgs)
+    logd2("parse json: ", json);
+
+    // body is in receive buffer (or in storage of reply), it is not needed after parsing,
+    // so it is decoded in place
+    std::string err = decode_params(details.params, const_cast<char *>(json.data()), json.size(), route);     // NOLINT
+    if (!err.empty())
+    {
+        f::loge("[{0}] parse meta: {1}", details.sessid, err);
+        return err;
+    }
+
+    if (route.cmd == common::cmd_t::USER_CREATE)
     {
-        if (msg.ts > ts)
+        int min_len = libproperty::Options::impl()->get<int>("pass_len");
+        if (min_len < 0)
         {
-            ts = msg.ts;
+            min_len = 8;
+        }
+        if (!apiclient_utils::password_check(details.params.password, min_len))
+        {
+            std::string err = "weak password";
+            return err;
         }
     }
-    return ts;
+
+    return "";
 }
 
-rapidjson::GenericMemberIterator<true, rapidjson::UTF8<>, rapidjson::MemoryPoolAllocator<>>
-find_required_string_param(const rapidjson::Document &doc, const std::string &pattern, std::string &error)
+#define API_RESPONSE_HEAD(status) "HTTP/1.1 " status "\r\n"                  \
+                                  "Content-Type: application/json\r\n"      \
+                                  "Access-Control-Allow-Origin: *\r\n"      \
+                                  "Content-Length: "
+
+boost::string_ref head_template(int http_code)
+/*
+ *  everything up to value of Content-Length, it is the only part which is changed
+ */
 {
-    auto it = doc.FindMember(pattern.c_str());
-    if (it == doc.MemberEnd())
+    switch (http_code)
     {
-        error = std::string("bad request, ") + pattern + " required";
-        return it;
+        case 200: return API_RESPONSE_HEAD("200 OK");
+        case 400: return API_RESPONSE_HEAD("400 Bad Request");
+        case 401: return API_RESPONSE_HEAD("401 Unauthorized");
+        case 403: return API_RESPONSE_HEAD("403 Forbidden");
+        case 404: return API_RESPONSE_HEAD("404 Not Found");
+        case 405: return API_RESPONSE_HEAD("405 Method Not Allowed");
+        case 409: return API_RESPONSE_HEAD("409 Conflict");
+        case 429: return API_RESPONSE_HEAD("429 Too Many Requests");
+        case 500: return API_RESPONSE_HEAD("500 Internal Server Error");
+        case 503: return API_RESPONSE_HEAD("503 Service Unavailable");
     }
+    return API_RESPONSE_HEAD("200 OK");
+}
+
+#undef API_RESPONSE_HEAD
+
+void prepend_http_head(OutBuffer &response, int http_code)
+/*
+ *  head is written into free space in front of body, body is not copied
+ */
+{
+    char tail[32];
+    int tail_len = snprintf(tail, sizeof(tail), "%zu\r\n\r\n", response.size());
+    boost::string_ref head = head_template(http_code);
 
-    if (!it->value.IsString())
+    if (!response.prepend(tail, tail_len) || !response.prepend(head.data(), head.size()))
+    {
+        throw std::logic_error("no space for http head in response buffer");
+    }
+}
+
+const char EVENT_STREAM_HEAD[] = "HTTP/1.1 200 OK\r\n"
+                                "Content-Type: text/event-stream\r\n"
+                                "Cache-Control: no-cache\r\n"
+                                "Access-Control-Allow-Origin: *\r\n"
+                                "Transfer-Encoding: chunked\r\n"
+                                "\r\n";
+
+bool accepts_event_stream(const HttpReply &req)
+{
+    return req.getHeader(http::header_t::ACCEPT).find("text/event-stream") != std::string::npos;
+}
+
+void frame_event(OutBuffer &event, bool error)
+/*
+ *  server-sent event: "data: {...}\n\n", json is written without line breaks
+ */
+{
+    const char data[] = "data: ";
+    const char error_data[] = "event: error\ndata: ";
+    bool ok = error ? event.prepend(error_data, sizeof(error_data) - 1)
+                    : event.prepend(data, sizeof(data) - 1);
+    if (!ok)
     {
-        error = std::string("bad request, ") + pattern + " is not string";
-        return it;
+        throw std::logic_error("no space for event head in response buffer");
     }
+    event.append("\n\n", 2);
+}
 
-    if (std::string(it->value.GetString()).empty())
+void frame_chunk(OutBuffer &chunk)
+{
+    char head[24];
+    int head_len = snprintf(head, sizeof(head), "%zx\r\n", chunk.size());
+    if (!chunk.prepend(head, head_len))
     {
-        error = "bad request, " + pattern + " is empty";
-        return it;
+        throw std::logic_error("no space for chunk head in response buffer");
     }
-    return it;
+    chunk.append("\r\n", 2);
 }
 
-rapidjson::GenericMemberIterator<true, rapidjson::UTF8<>, rapidjson::MemoryPoolAllocator<>>
-find_required_uint_param(const rapidjson::Document &doc, const std::string &pattern, std::string &error)
+void prepend_ws_message_head(OutBuffer &response, boost::string_ref head)
 {
-    auto it = doc.FindMember(pattern.c_str());
-    if (it == doc.MemberEnd())
+    if (!response.prepend(head.data(), head.size()))
     {
-        error = std::string("bad request, ") + pattern + " required";
-        return it;
+        // body without headroom: message is assembled once
+        OutBuffer message;
+        message.reserve(response.size());
+        message.append(response.data(), response.size());
+        message.prepend(head.data(), head.size());
+        response = std::move(message);
     }
+}
 
-    if (!it->value.IsUint())
+void prepend_ws_head(OutBuffer &response, int http_code, boost::string_ref resource)
+/*
+ *  websocket message of response: "200 /v1/user/login\n{...}", of push: "push\n{...}"
+ */
+{
+    // resource of unknown route is client input, it is not echoed
+    if (!common::find_route(resource))
     {
-        error = std::string("bad request, ") + pattern + " is not uint";
-        return it;
+        resource = "unknown";
     }
 
-    return it;
+    prepend_ws_message_head(response, std::to_string(http_code) + " " + resource.to_string() + "\n");
 }
 
+}   // namespace
 
-std::string parse_meta(RequestDetails &details,
-                       const std::string &json,
-                       common::cmd_t command)
+
+ApiClient::ApiClient(boost::shared_ptr<TcpClient> socket, DatabaseWorker &db, IoThread &io_thread, OutboundPolicy &outbound) :
+    m_PingIntervalMs(5000),
+    m_PingTimer([this]() { timerPingHandler(); }),
+    m_ReadTimer([this]() { readTimeout(); }),
+    m_FirstRequest(true),
+    m_Handshakes(nullptr),
+    m_FirstSeq(0),
+    m_Writing(0),
+    m_ReadPending(false),
+    m_ReadStopped(false),
+    m_WebSocket(false),
+    m_WsDeflate(false),
+    m_IdleUid(0),
+    m_EventStream(false),
+    m_EventsWriting(false),
+    m_Db(db),
+    m_IoThread(io_thread),
+    m_Outbound(outbound),
+    m_NeedResync(false),
+    m_Hibernating(false)
 {
-    logd2("parse json: ", json);
+    m_Client = boost::make_shared<AsyncHttpClient>(socket);
+    m_IoThread.connectionOpened();
+}
 
-    rapidjson::Document document;
-    if (document.Parse(json.data()).HasParseError())
+ApiClient::~ApiClient()
+{
+    releaseHandshake();
+    m_IoThread.connectionClosed();
+
+    if (m_IdleUid)
     {
-        loge("invalid meta json");
-        std::string api_response = "bad request, invalid json";
-        return api_response;
+        m_Db.pubsub().unsubscribe(m_IdleUid, this);
     }
+}
 
+void ApiClient::serveSslClient(HandshakePool &handshakes)
+/*
+ *  handshake is done in handshake pool if it is not empty,
+ *  connection returns into own io thread after that.
+ *  Slot of pool is admitted by caller, it is released once: by end of handshake
+ *  or by destructor; silent client is cut by deadline, so it does not hold slot forever.
+ *  Caller may be acceptor thread, timer wheel is touched in own io thread only.
+ */
+{
+    m_Handshakes = &handshakes;
+    m_Client->ioService().post([self = shared_from_this(), &handshakes]()
     {
-        std::string fatal_error;
-        auto it = find_required_string_param(document, "password", fatal_error);
-        if (!fatal_error.empty())
-        {
-            f::loge("[{0}] parse meta: {1}", details.sessid, fatal_error);
-            return fatal_error;
-        }
-        details.params.password = it->value.GetString();
-    }
+        self->startHandshake(handshakes);
+    });
+}
 
+void ApiClient::startHandshake(HandshakePool &handshakes)
+{
+    m_IoThread.timers().schedule(m_ReadTimer, handshake_timeout(), shared_from_this());
 
-    if (   command == common::cmd_t::USER_CREATE
-        || command == common::cmd_t::USER_LOGIN
-        )
+    boost::asio::io_service *handshake_io = handshakes.pickIo();
+    if (!handshake_io)
     {
-        std::string fatal_error;
-        auto it = find_required_string_param(document, "user", fatal_error);
-        if (!fatal_error.empty())
+        m_Client->asyncHandshakeAsServer([self = shared_from_this()](const boost::system::error_code &error)
         {
-            f::loge("[{0}] parse meta: {1}", details.sessid, fatal_error);
-            return fatal_error;
-        }
-        details.params.user = it->value.GetString();
- 
-        if (command == common::cmd_t::USER_CREATE)
+            self->releaseHandshake();
+            self->processClientRequest(ConnectionError(error));
+        });
+        return;
+    }
+
+    handshake_io->post([self = shared_from_this(), handshake_io]()
+    {
+        auto handler = [self](const boost::system::error_code &error)
         {
-            int min_len = libproperty::Options::impl()->get<int>("pass_len");
-            if (min_len < 0)
+            self->releaseHandshake();
+            self->m_Client->ioService().post([self, error]()
             {
-                min_len = 8;
-            }
-            if (!apiclient_utils::password_check(details.params.password, min_len))
-            {
-                std::string err = "weak password";
-                return err;
-            }
-        }
+                self->processClientRequest(ConnectionError(error));
+            });
+        };
 
-        return "";
+        self->m_Client->asyncHandshakeAsServer(HandshakePool::wrap(*handshake_io, std::move(handler)));
+    });
+}
+
+void ApiClient::releaseHandshake()
+{
+    HandshakePool *handshakes = m_Handshakes.exchange(nullptr);
+    if (handshakes)
+    {
+        handshakes->release();
     }
+}
 
+void ApiClient::readCmd()
+{
+    // while requests are processed, client waits for server, not vice versa
+    if (m_Pipeline.empty())
     {
-        // self id required 
-        std::string fatal_error;
-        auto it = find_required_uint_param(document, "uid", fatal_error);
-        if (!fatal_error.empty())
-        {
-            f::loge("[{0}] parse meta: {1}", details.sessid, fatal_error);
-            return fatal_error;
-        }
-        details.params.uid = it->value.GetUint();
+        scheduleReadTimeout();
     }
 
-    if (   command == common::cmd_t::CHAT_CREATE
-        || command == common::cmd_t::CHAT_ADDUSER
-        )
+    m_ReadPending = true;
+    if (m_WebSocket)
     {
-        std::string fatal_error;
-        auto it = find_required_string_param(document, "chatname", fatal_error);
-        if (!fatal_error.empty())
+        m_Client->asyncReadMessage([self = shared_from_this()](const ConnectionError &error, boost::string_ref message)
         {
-            f::loge("[{0}] parse meta: {1}", details.sessid, fatal_error);
-            return fatal_error;
-        }
-        details.params.chat.name = it->value.GetString();
+            self->messageFromClientReadHandler(error, message);
+        });
+        return;
+    }
 
-        if (command == common::cmd_t::CHAT_ADDUSER)
-        {
-            it = find_required_string_param(document, "adduser", fatal_error);
-            if (!fatal_error.empty())
-            {
-                f::loge("[{0}] parse meta: {1}", details.sessid, fatal_error);
-                return fatal_error;
-            }
-            details.params.chat.adduser = it->value.GetString();
-        }
+    m_Client->asyncResponse([self = shared_from_this()](const ConnectionError &error, const HttpReply &reply)
+    {
+        self->requestFromClientReadHandler(error, reply);
+    });
+}
 
-        return "";
+void ApiClient::scheduleReadTimeout()
+{
+    if (m_IdleUid)
+    {
+        // subscribed websocket could be silent, it is checked by pings
+        return;
     }
 
-    if (command == common::cmd_t::IDLE)
+    std::chrono::milliseconds timeout = read_timeout(m_FirstRequest);
+    if (timeout.count())
     {
-        std::string fatal_error;
-        auto it = find_required_uint_param(document, "heartbit", fatal_error);
-        if (fatal_error.empty())
-        {
-            details.params.ts = it->value.GetUint();
-        }
-        return "";
+        m_IoThread.timers().schedule(m_ReadTimer, timeout, shared_from_this());
     }
-    
-    if (   command == common::cmd_t::USER_HISTORY
-        || command == common::cmd_t::USER_STATUS
-        )
+}
+
+void ApiClient::processClientRequest(const ConnectionError &error)
+{
+    // deadline of handshake
+    m_IoThread.timers().cancel(m_ReadTimer);
+
+    m_RequestDetails.sessid = generate_session_id(m_Client->localAddr());
+    f::logd2("[{0}] new client {1}", m_RequestDetails.sessid, "");
+
+    if (error.code)
     {
-        std::string fatal_error;
-        auto it = find_required_string_param(document, "user", fatal_error);
-        if (!fatal_error.empty())
-        {
-            f::loge("[{0}] parse meta: {1}", details.sessid, fatal_error);
-            return fatal_error;
-        }
-        details.params.user = it->value.GetString();
-        
-        it = find_required_uint_param(document, "count", fatal_error);
-        if (fatal_error.empty())
-        {
-            details.params.count = it->value.GetUint();
-        }
-        return "";
+        requestFromClientReadHandler(error, {});
+        return;
     }
-       
-    if (   command == common::cmd_t::MESSAGE_SEND
-        || command == common::cmd_t::MESSAGE_SEND_CHAT
-        )
+
+    readCmd();
+}
+
+uint64_t ApiClient::beginRequest(const std::string &method)
+{
+    // slots of ring are reused by next requests, full ring grows
+    if (m_Pipeline.full())
     {
-        std::string fatal_error;
-        auto it = find_required_string_param(document, "message", fatal_error);
-        if (!fatal_error.empty())
-        {
-            f::loge("[{0}] parse meta: {1}", details.sessid, fatal_error);
-            return fatal_error;
-        }
-        details.params.message = it->value.GetString();
+        m_Pipeline.set_capacity(std::max<size_t>(1, 2 * m_Pipeline.capacity()));
+    }
+
+    PipelinedRequest request;
+    request.start = std::chrono::steady_clock::now();
+    request.method = method;
+    request.resource = m_RequestDetails.resource;
+    m_Pipeline.push_back(std::move(request));
+
+    return m_FirstSeq + m_Pipeline.size() - 1;
+}
 
-        if (command == common::cmd_t::MESSAGE_SEND)
+void ApiClient::completeRequest(uint64_t seq, int http_code, OutBuffer response)
+/*
+ *  io thread only
+ */
+{
+    if (seq < m_FirstSeq + m_Writing || seq >= m_FirstSeq + m_Pipeline.size())
+    {
+        // answer to request, which is already answered (idle subscription), is written as is
+        auto handler = [](const ConnectionError &error)
         {
-            it = find_required_string_param(document, "to", fatal_error);
-            if (!fatal_error.empty())
+            if (error.code)
             {
-                f::loge("[{0}] parse meta: {1}", details.sessid, fatal_error);
-                return fatal_error;
+                loge("idle connect error: ", error.asString());
             }
-            details.params.to_user = it->value.GetString();
+        };
+
+        if (m_WebSocket)
+        {
+            prepend_ws_head(response, http_code, common::cmd2string(common::cmd_t::IDLE));
+            m_Client->asyncWriteMessage(std::move(response), std::move(handler));
+            return;
         }
-        else
+        if (m_EventStream)
         {
-            it = find_required_string_param(document, "chatname", fatal_error);
-            if (!fatal_error.empty())
-            {
-                f::loge("[{0}] parse meta: {1}", details.sessid, fatal_error);
-                return fatal_error;
-            }
+            frame_event(response, http_code != 200);
+            writeEvent(std::move(response));
+            return;
+        }
+        prepend_http_head(response, http_code);
+        m_Client->asyncRequest(std::move(response), std::move(handler));
+        return;
+    }
 
-            details.params.chat.name = it->value.GetString();
+    PipelinedRequest &request = m_Pipeline[seq - m_FirstSeq];
+    if (m_WebSocket)
+    {
+        prepend_ws_head(response, http_code, request.resource);
+    }
+    else if (request.idle && m_EventStream)
+    {
+        // answer to idle opens event stream, it is the first event
+        frame_event(response, false);
+        frame_chunk(response);
+        if (!response.prepend(EVENT_STREAM_HEAD, sizeof(EVENT_STREAM_HEAD) - 1))
+        {
+            throw std::logic_error("no space for http head in response buffer");
         }
-        return "";
     }
+    else
+    {
+        prepend_http_head(response, http_code);
+    }
+    logd4("HTTP response:\n", boost::string_ref(response.data(), response.size()));
 
-    return "";
+    request.http_code = http_code;
+    request.response = std::move(response);
+    request.ready = true;
+
+    writeReadyResponses();
 }
 
-std::string http_code_to_string(int code)
+void ApiClient::writeReadyResponses()
+/*
+ *  responses are given to socket in order of requests, the ones after unanswered request wait
+ */
 {
-    switch (code)
+    while (m_Writing < m_Pipeline.size() && m_Pipeline[m_Writing].ready)
     {
-        case 200: return "200 OK";
-        case 400: return "400 Bad Request";
-        case 403: return "403 Forbidden";
-        case 404: return "404 Not Found";
-        case 409: return "409 Conflict";
-        case 429: return "429 Too Many Requests";
-        case 500: return "500 Internal Server Error";
-        case 503: return "503 Service Unavailable";
+        PipelinedRequest &request = m_Pipeline[m_Writing++];
+        auto handler = [self = shared_from_this()](const ConnectionError &error)
+        {
+            self->responseToClientWroteHandler(error);
+        };
+
+        if (m_WebSocket)
+        {
+            m_Client->asyncWriteMessage(std::move(request.response), std::move(handler));
+        }
+        else
+        {
+            m_Client->asyncRequest(std::move(request.response), std::move(handler));
+        }
     }
-    return "200 OK";
 }
 
-std::string build_api_error_rsponse(int http_code, common::ApiStatusCode api_code, const std::string &desc)
+void ApiClient::sendOkResponse(uint64_t seq, const std::string &body)
 {
-    std::string api_response = apiclient_utils::make_api_error(api_code, desc);
-
-    std::string response = "HTTP/1.1 " + http_code_to_string(http_code) + "\r\n";
-    response += (std::string("Content-Length: ") + std::to_string(api_response.size()) + std::string("\r\n"));
-    response += "Access-Control-Allow-Origin: *\r\n";
-    response += "Content-Type: application/json\r\n";
-    response += "\r\n";
-    response += api_response;
-
-    return response;
+    OutBuffer response;
+    response.append(body);
+    sendOkResponse(seq, std::move(response));
 }
 
-}   // namespace
-
-
-ApiClient::ApiClient(boost::shared_ptr<TcpClient> socket, DatabaseWorker &db) :
-    m_HttpCode(200),
-    m_StoragePollingIntervalMs(200),
-    m_Timer(socket->ioService()),
-    m_Db(db)
+void ApiClient::sendOkResponse(uint64_t seq, OutBuffer body)
 {
-    m_Client = boost::make_shared<AsyncHttpClient>(socket);
+    m_Client->ioService().dispatch(makeAllocHandler(m_ResponseMemory,
+        [self = shared_from_this(), seq, body = std::move(body)]() mutable
+        {
+            self->completeRequest(seq, 200, std::move(body));
+        }));
 }
 
-ApiClient::~ApiClient()
+void ApiClient::sendMessages(uint64_t seq, std::vector<apiclient_utils::Message> &&msgs)
 {
+    sendOkResponse(seq, apiclient_utils::build_api_ok_response_body(std::move(msgs)));
 }
 
-void ApiClient::serveSslClient()
+void ApiClient::sendMessagesToIdleConn(std::vector<apiclient_utils::Message> &&msgs)
+/*
+ *  io thread only: queued bytes of socket are checked
+ */
 {
-    m_Client->asyncHandshakeAsServer([self = shared_from_this()](const ConnectionError &error)
+    if (!msgs.empty())
     {
-        self->processClientRequest(error);
-    });
-}
+        m_LastTraffic = std::chrono::steady_clock::now();
+        m_Hibernating = false;
+        m_Client->setReleaseAfterWrite(false);
+    }
+    else if (m_WebSocket && !m_NeedResync)
+    {
+        // websocket has its own ping
+        m_Client->ping();
+        return;
+    }
+    else if (m_EventStream && !m_NeedResync)
+    {
+        // comment line; it is not needed, while events are written
+        if (!m_EventsWriting)
+        {
+            OutBuffer ping;
+            ping.append(":\n\n", 3);
+            writeEventChunk(std::move(ping));
+        }
+        return;
+    }
 
-void ApiClient::readCmd()
-{
-    m_Client->asyncResponse([self = shared_from_this()](const ConnectionError &error, const HttpReply &reply)
+    OutBuffer response;
+    if (m_NeedResync)
     {
-        self->requestFromClientReadHandler(error, reply);
-    });
-}
+        // pushed messages are useless until client reloads history
+        response = apiclient_utils::build_api_resync_body();
+    }
+    else
+    {
+        response = apiclient_utils::build_api_ok_response_body(std::move(msgs));
+    }
 
-void ApiClient::processClientRequest(const ConnectionError &error)
-{
-    m_RequestDetails.sessid = generate_session_id(m_Client->localAddr());
-    f::logd2("[{0}] new client {1}", m_RequestDetails.sessid, "");
+    if (m_WebSocket)
+    {
+        prepend_ws_message_head(response, "push\n");
+    }
+    else if (m_EventStream)
+    {
+        frame_event(response, false);
+    }
+    else
+    {
+        prepend_http_head(response, 200);
+    }
 
-    if (error.code)
+    if (m_Client->queuedBytes() + m_Events.size() + response.size() > m_Outbound.max_bytes)
     {
-        requestFromClientReadHandler(error, {});
+        slowReader();
         return;
     }
+    m_NeedResync = false;
 
-    readCmd();
-}
-
-std::string ApiClient::buildApiOkResponse(const std::string &body)
-{
-    std::string response = "HTTP/1.1 200 OK\r\n";
-    response += (std::string("Content-Length: ") + std::to_string(body.size()) + std::string("\r\n"));
-    response += "Content-Type: application/json\r\n";
-    response += "Access-Control-Allow-Origin: *\r\n";
-    response += "\r\n";
-    response += body;
+    auto handler = [self = shared_from_this()](const ConnectionError &error)
+    {
+        if (error.code)
+        {
+            self->idleWriteFailed(error);
+        }
+    };
 
-    logd4("HTTP response:\n", response);
-    return response;
+    if (m_WebSocket)
+    {
+        m_Client->asyncWriteMessage(std::move(response), std::move(handler));
+    }
+    else if (m_EventStream)
+    {
+        writeEvent(std::move(response));
+    }
+    else
+    {
+        m_Client->asyncRequest(std::move(response), std::move(handler));
+    }
 }
 
-void ApiClient::sendOkResponse(const std::string &body)
+void ApiClient::writeEvent(OutBuffer event)
+/*
+ *  events, which come while chunk is written, are coalesced into the next one
+ */
 {
-    std::string response = buildApiOkResponse(body);
-
-    m_Client->asyncRequest(response, [self = shared_from_this()](const ConnectionError &error)
+    if (m_EventsWriting)
     {
-        self->responseToClientWroteHandler(error);
-    });
+        m_Events.append(event.data(), event.size());
+        return;
+    }
+    writeEventChunk(std::move(event));
 }
 
-void ApiClient::sendMessages(std::vector<apiclient_utils::Message> &&msgs)
+void ApiClient::writeEventChunk(OutBuffer chunk)
 {
-    uint64_t max_ts = max_timestamp(msgs);
-
-    std::string body = apiclient_utils::build_api_ok_response_body(std::move(msgs));
-    std::string response = buildApiOkResponse(body);
-
-    m_Client->asyncRequest(response, [self = shared_from_this(), max_ts](const ConnectionError &error)
+    frame_chunk(chunk);
+    m_EventsWriting = true;
+    m_Client->asyncRequest(std::move(chunk), [self = shared_from_this()](const ConnectionError &error)
     {
-        self->responseToClientWroteHandler(error);
+        self->m_EventsWriting = false;
+        if (error.code)
+        {
+            self->idleWriteFailed(error);
+            return;
+        }
+
+        if (!self->m_Events.empty())
+        {
+            OutBuffer next;
+            std::swap(next, self->m_Events);
+            self->writeEventChunk(std::move(next));
+        }
     });
 }
 
-
-void ApiClient::sendMessagesToIdleConn(std::vector<apiclient_utils::Message> &&msgs)
+void ApiClient::idleWriteFailed(const ConnectionError &error)
 {
-    uint64_t max_ts = max_timestamp(msgs);
-
-    std::string body = apiclient_utils::build_api_ok_response_body(std::move(msgs));
-    std::string response = buildApiOkResponse(body);
+    loge("idle connect error: ", error.asString());
+    m_IoThread.timers().cancel(m_PingTimer);
+    m_Client->cancel();
+    m_Db.pubsub().unsubscribe(m_IdleUid, this);
+}
 
-    m_Client->asyncRequest(response, [self = shared_from_this(), max_ts](const ConnectionError &error)
+void ApiClient::slowReader()
+{
+    switch (m_Outbound.on_overflow)
     {
-        if (error.code)
+    case OutboundPolicy::slow_reader_t::DROP:
+        ++m_Outbound.dropped;
+        break;
+
+    case OutboundPolicy::slow_reader_t::RESYNC:
+        if (!m_NeedResync)
         {
-            loge("idle connect error: ", error.asString());
-            self->m_Timer.cancel();
-            self->m_Client->cancel();
-            return;
+            ++m_Outbound.resynced;
+            m_NeedResync = true;
         }
-        self->m_NewestMsgTimestamp = max_ts;
-    });
+        break;
+
+    case OutboundPolicy::slow_reader_t::DISCONNECT:
+        ++m_Outbound.disconnected;
+        f::logi("[{0}] slow reader disconnected, {1} bytes are not read", m_RequestDetails.sessid, m_Client->queuedBytes());
+        m_IoThread.timers().cancel(m_PingTimer);
+        m_Client->close();
+        m_Db.pubsub().unsubscribe(m_IdleUid, this);
+        break;
+    }
 }
 
-void ApiClient::sendOkResponseAndStartIdle()
+void ApiClient::pushMessages(std::vector<apiclient_utils::Message> msgs)
+/*
+ *  called from database worker, so write on own io thread
+ */
 {
-    std::string body = apiclient_utils::build_api_ok_response_body(m_RequestDetails.command);
-    std::string response = buildApiOkResponse(body);
-
-    m_Client->asyncRequest(response, [self = shared_from_this()](const ConnectionError &error)
+    m_Client->ioService().post([self = shared_from_this(), msgs = std::move(msgs)]() mutable
     {
-        // TODO: process error
-        unused_args(error);
+        self->sendMessagesToIdleConn(std::move(msgs));
     });
+}
 
-    // start polling storage for new messages
-    // actually, it should be PUB/SUB sheme
-    m_Timer.expires_from_now(std::chrono::milliseconds(m_StoragePollingIntervalMs));
-    m_Timer.async_wait(boost::bind(&ApiClient::timerWaitTaskResultHandler, shared_from_this(), boost::asio::placeholders::error));
+void ApiClient::sendOkResponseAndStartIdle(uint64_t seq)
+/*
+ *  websocket reads next requests before this answer is written, so subscription
+ *  is built now from state of this request, later ones change it
+ */
+{
+    PipelinedRequest &request = m_Pipeline[seq - m_FirstSeq];
+    request.idle = true;
+    request.idle_task = db::Task(m_RequestDetails);
+    request.idle_task.user = m_SessionUser;
+    completeRequest(seq, 200, apiclient_utils::build_api_ok_response_body(m_RequestDetails.command));
 }
 
-void ApiClient::sendErrorResponse(int http_code, common::ApiStatusCode api_code, const std::string &desc)
+void ApiClient::startIdle(db::Task task)
 {
-    m_HttpCode = http_code;
+    m_LastTraffic = std::chrono::steady_clock::now();
+    if (m_IdleUid)
+    {
+        // websocket connection subscribes again
+        m_Db.pubsub().unsubscribe(m_IdleUid, this);
+    }
+    m_IdleUid = task.request.uid;
+
+    // subscribe to user chats, new messages will be pushed by database worker
+    task.client = shared_from_this();
+    m_Db.putTask(std::move(task));
+
+    m_IoThread.timers().schedule(m_PingTimer, std::chrono::milliseconds(m_PingIntervalMs), shared_from_this());
+}
 
-    std::string response = build_api_error_rsponse(m_HttpCode, api_code, desc);
-    m_Client->asyncRequest(response,
-                           [self = shared_from_this()](const ConnectionError &error)
-                           {
-                               self->responseToClientWroteHandler(error);
-                           });
+void ApiClient::sendErrorResponse(uint64_t seq, int http_code, common::ApiStatusCode api_code, const std::string &desc)
+{
+    OutBuffer response = apiclient_utils::make_api_error(api_code, desc);
+    m_Client->ioService().dispatch(makeAllocHandler(m_ResponseMemory,
+        [self = shared_from_this(), seq, http_code, response = std::move(response)]() mutable
+        {
+            self->completeRequest(seq, http_code, std::move(response));
+        }));
 }
 
-void ApiClient::v1_handler(const HttpReply &req, common::cmd_t cmd)
+void ApiClient::v1_handler(boost::string_ref body, boost::string_ref content_type, const common::Route &route)
 {
-    m_RequestDetails.command = cmd;
-    handler_impl(req, m_RequestDetails.command);
+    m_RequestDetails.command = route.cmd;
+    handler_impl(body, content_type, route);
 
     f::logi("[{0}] new request [{1}, {2}]",
         m_RequestDetails.sessid, m_Client->remoteAddr(), m_RequestDetails.resource);
 }
 
-void ApiClient::handler_impl(const HttpReply &req, common::cmd_t command)
+void ApiClient::handler_impl(boost::string_ref body, boost::string_ref content_type, const common::Route &route)
 {
-    std::string content_type = req.getHeader("Content-Type");
-
-    if (utils::starts_with(content_type, "text/plain")
-        || utils::starts_with(content_type, "application/json"))
+    if (content_type.starts_with("text/plain")
+        || content_type.starts_with("application/json"))
     {
-        std::string err = parse_meta(m_RequestDetails, req._body, command);
+        std::string err = parse_meta(m_RequestDetails, body, route);
         if (!err.empty())
         {
-            sendErrorResponse(400, common::ApiStatusCode::ERR_BAD_REQUEST, err);
+            sendErrorResponse(m_RequestDetails.seq, 400, common::ApiStatusCode::ERR_BAD_REQUEST, err);
             return;
         }
     }
     else
     {
         loge("not allowed content type: ", content_type);
-        sendErrorResponse(400, common::ApiStatusCode::ERR_BAD_REQUEST, "not allowed content type");
+        sendErrorResponse(m_RequestDetails.seq, 400, common::ApiStatusCode::ERR_BAD_REQUEST, "not allowed content type");
+        return;
+    }
+
+    if (!authenticate())
+    {
         return;
     }
 
     db::Task task(m_RequestDetails);
+    task.user = m_SessionUser;
     task.client = shared_from_this();
-    if (command == common::cmd_t::USER_CREATE)
+    if (route.cmd == common::cmd_t::USER_CREATE)
     {
         // need to select one of the storages.
         // currently - storage only one
@@ -478,127 +751,279 @@ void ApiClient::handler_impl(const HttpReply &req, common::cmd_t command)
     m_Db.putTask(std::move(task));
 }
 
-void ApiClient::timerWaitTaskResultHandler(const boost::system::error_code& e)
-/*
- *  check result
- */
+void ApiClient::timerPingHandler()
 {
-    if (e == boost::asio::error::operation_aborted)
+    if (!m_Hibernating && std::chrono::steady_clock::now() - m_LastTraffic >= hibernate_after())
     {
-        return;
+        hibernate();
     }
 
-    if (m_NewestMsgTimestamp > m_RequestDetails.params.ts)
+    sendMessagesToIdleConn({});
+
+    if (m_Client->isOpen())
     {
-        m_RequestDetails.params.ts = m_NewestMsgTimestamp;
+        m_IoThread.timers().schedule(m_PingTimer, std::chrono::milliseconds(m_PingIntervalMs), shared_from_this());
     }
+}
 
-    db::Task task(m_RequestDetails);
-    task.client = shared_from_this();
-
-    if ((time(NULL) - m_LastClientPing) > 5)
+void ApiClient::readTimeout()
+/*
+ *  client is silent too long, pending read is completed with error
+ */
+{
+    if (m_Handshakes.load())
     {
-        m_LastClientPing = time(NULL);
-        task.ping = true;
+        // handshake could go in other thread: socket is not closed under it, handshake fails and releases slot
+        logd2("handshake timeout, connection closed");
+        m_Client->shutdown();
+        return;
     }
 
-    // TODO: need to check pass once after connect! not each time
-    m_Db.putTask(std::move(task));
+    f::logd2("[{0}] read timeout, connection closed", m_RequestDetails.sessid);
+    m_Client->close();
+}
 
-    m_Timer.expires_from_now(std::chrono::milliseconds(m_StoragePollingIntervalMs));
-    m_Timer.async_wait(boost::bind(&ApiClient::timerWaitTaskResultHandler, shared_from_this(), boost::asio::placeholders::error));
+void ApiClient::hibernate()
+/*
+ *  quiet idle connection keeps only what is needed for pushes,
+ *  buffers are allocated again by the next push
+ */
+{
+    m_Hibernating = true;
+    m_RequestDetails.shrinkForIdle();
+    m_Client->shrinkToFit();
+    m_ResponseMemory.release();
+    // pings are still written, their memory should not stay
+    m_Client->setReleaseAfterWrite(true);
+
+    f::logd2("[{0}] idle connection hibernated", m_RequestDetails.sessid);
 }
 
 void ApiClient::requestFromClientReadHandler(const ConnectionError &error, const HttpReply &reply)
 {
-    m_Start = std::chrono::steady_clock::now();
+    m_IoThread.timers().cancel(m_ReadTimer);
+    m_FirstRequest = false;
+    m_ReadPending = false;
 
     if (error.code)
     {
         f::loge("request from client [r: {0}, error: {1}]", cmd2string(m_RequestDetails.command), error.asString());
         // close connect
+        m_ReadStopped = true;
         return;
     }
 
+    const common::Route *route = common::find_route(reply._resource);
+
     m_RequestDetails.remote_address = m_Client->remoteAddr();
-    m_RequestDetails.resource = utils::lowercased(reply._resource);
+    // canonical name of known resource, capacity of string is reused
+    boost::string_ref resource = route ? boost::string_ref(route->resource) : boost::string_ref(reply._resource);
+    m_RequestDetails.resource.assign(resource.data(), resource.size());
     m_RequestDetails.method = reply._method;
+    m_RequestDetails.seq = beginRequest(reply._method);
 
-    logd3(reply._headers);
-    logd4("body: ", reply._body);
+    logd3("request: ", reply._method, " ", reply._resource);
+    logd4("body: ", reply.body());
 
-    if (m_RequestDetails.resource == "/v1/idle")
+    if (route && reply._method != route->method)
     {
-        m_RequestDetails.command = common::cmd_t::IDLE;
-        std::string err = parse_meta(m_RequestDetails, reply._body, common::cmd_t::IDLE);
-        if (!err.empty())
+        sendErrorResponse(m_RequestDetails.seq, 405, common::ApiStatusCode::ERR_BAD_REQUEST, "method not allowed");
+    }
+    else if (route && route->kind == common::route_t::WEBSOCKET)
+    {
+        upgradeToWebSocket(reply);
+    }
+    else
+    {
+        if (route && route->kind == common::route_t::IDLE)
         {
-            sendErrorResponse(400, common::ApiStatusCode::ERR_BAD_REQUEST, err);
-            return;
+            // pushes go as server-sent events of one response, if client accepts them
+            m_EventStream = accepts_event_stream(reply);
         }
-
-        sendOkResponseAndStartIdle();
-        return;
+        dispatchRequest(route, reply.body(), reply.getHeader(http::header_t::CONTENT_TYPE));
     }
 
-    // TODO: router
-    if (m_RequestDetails.resource == "/v1/message/send")
+    // next request is read without waiting for response, reply stays valid until this handler returns
+    if (!m_ReadStopped && m_Pipeline.size() < max_pipeline())
     {
-        v1_handler(reply, common::cmd_t::MESSAGE_SEND);
+        readCmd();
     }
-    else if (m_RequestDetails.resource == "/v1/message/sendchat")
-    {
-        v1_handler(reply, common::cmd_t::MESSAGE_SEND_CHAT);
-    }
-    else if (m_RequestDetails.resource == "/v1/user/login")
+}
+
+void ApiClient::messageFromClientReadHandler(const ConnectionError &error, boost::string_ref message)
+/*
+ *  websocket request: "/v1/user/login\n{...}", body is json
+ */
+{
+    m_IoThread.timers().cancel(m_ReadTimer);
+    m_ReadPending = false;
+
+    if (error.code)
     {
-        v1_handler(reply, common::cmd_t::USER_LOGIN);
+        f::logd2("[{0}] websocket closed [e: {1}]", m_RequestDetails.sessid, error.asString());
+        m_ReadStopped = true;
+        return;
     }
-    else if (m_RequestDetails.resource == "/v1/user/create")
+
+    size_t pos = message.find('\n');
+    boost::string_ref resource = message.substr(0, pos);
+    boost::string_ref body = pos == boost::string_ref::npos ? boost::string_ref() : message.substr(pos + 1);
+
+    const common::Route *route = common::find_route(resource);
+
+    if (route)
     {
-        v1_handler(reply, common::cmd_t::USER_CREATE);
+        resource = route->resource;
     }
-    else if (m_RequestDetails.resource == "/v1/chat/create")
+    m_RequestDetails.resource.assign(resource.data(), resource.size());
+    m_RequestDetails.method = "ws";
+    m_RequestDetails.seq = beginRequest(m_RequestDetails.method);
+
+    logd3("request: ws ", resource);
+    logd4("body: ", body);
+
+    dispatchRequest(route, body, "application/json");
+
+    // message stays valid until this handler returns
+    if (!m_ReadStopped && m_Pipeline.size() < max_pipeline())
     {
-        v1_handler(reply, common::cmd_t::CHAT_CREATE);
+        readCmd();
     }
-    else if (m_RequestDetails.resource == "/v1/user/history")
+}
+
+void ApiClient::upgradeToWebSocket(const HttpReply &req)
+/*
+ *  101 response goes in order of pipelined responses, frames are read after it is written
+ */
+{
+    if (m_WebSocket
+        || !req.hasHeader(http::header_t::SEC_WEBSOCKET_KEY)
+        || utils::lowercased(req.getHeader(http::header_t::UPGRADE)) != "websocket")
     {
-        v1_handler(reply, common::cmd_t::USER_HISTORY);
+        sendErrorResponse(m_RequestDetails.seq, 400, common::ApiStatusCode::ERR_BAD_REQUEST, "websocket upgrade expected");
+        return;
     }
-    else if (m_RequestDetails.resource == "/v1/group/history")
+
+    m_WsDeflate = websocket_deflate()
+                  && websocket::deflate_offered(req.getHeader(http::header_t::SEC_WEBSOCKET_EXTENSIONS));
+    m_ReadStopped = true;
+
+    PipelinedRequest &request = m_Pipeline.back();
+    request.http_code = 101;
+    request.response = OutBuffer(websocket::upgrade_response(req.getHeader(http::header_t::SEC_WEBSOCKET_KEY), m_WsDeflate));
+    request.ready = true;
+    request.upgrade = true;
+    writeReadyResponses();
+}
+
+void ApiClient::dispatchRequest(const common::Route *route, boost::string_ref body, boost::string_ref content_type)
+{
+    if (!route || route->kind == common::route_t::RESERVED || route->kind == common::route_t::WEBSOCKET)
     {
-        v1_handler(reply, common::cmd_t::CHAT_HISTORY);
+        std::string api_response = "bad request";
+        sendErrorResponse(m_RequestDetails.seq, 404, common::ApiStatusCode::ERR_NOT_FOUND, api_response);
+        return;
     }
-    else if (m_RequestDetails.resource == "/v1/user/status")
+
+    if (route->kind == common::route_t::IDLE)
     {
-        v1_handler(reply, common::cmd_t::USER_STATUS);
+        m_RequestDetails.command = route->cmd;
+        std::string err = parse_meta(m_RequestDetails, body, *route);
+        if (!err.empty())
+        {
+            sendErrorResponse(m_RequestDetails.seq, 400, common::ApiStatusCode::ERR_BAD_REQUEST, err);
+            return;
+        }
+
+        if (!authenticate())
+        {
+            return;
+        }
+
+        // idle http connection only gets pushes, next requests are not read; websocket gets both
+        if (!m_WebSocket)
+        {
+            m_ReadStopped = true;
+        }
+        sendOkResponseAndStartIdle(m_RequestDetails.seq);
+        return;
     }
-    else if (m_RequestDetails.resource == "/v1/chat/adduser")
+
+    v1_handler(body, content_type, *route);
+}
+
+bool ApiClient::authenticate()
+/*
+ *  token of session is checked here, worker takes user of session and does not look it up;
+ *  request with password is checked by worker, as it was before sessions
+ */
+{
+    m_SessionUser = db::User();
+    if (m_RequestDetails.params.token.empty())
     {
-        v1_handler(reply, common::cmd_t::CHAT_ADDUSER);
+        return true;
     }
-    else
+
+    if (!m_Db.sessions().check(m_RequestDetails.params.token, m_RequestDetails.params.uid, m_SessionUser))
     {
-        std::string api_response = "bad request";
-        sendErrorResponse(404, common::ApiStatusCode::ERR_NOT_FOUND, api_response);
-        return;
+        f::logi("[{0}] session token is not valid", m_RequestDetails.sessid);
+        sendErrorResponse(m_RequestDetails.seq, 401, common::ApiStatusCode::ERR_CONSTRAINT, "session expired, login again");
+        return false;
     }
+    return true;
 }
 
 void ApiClient::responseToClientWroteHandler(const ConnectionError &error)
 {
-    std::chrono::time_point<std::chrono::steady_clock> end = std::chrono::steady_clock::now();
-    int ms = std::chrono::duration_cast<std::chrono::milliseconds>(end - m_Start).count();
+    PipelinedRequest &request = m_Pipeline.front();
 
+    std::chrono::time_point<std::chrono::steady_clock> end = std::chrono::steady_clock::now();
+    int ms = std::chrono::duration_cast<std::chrono::milliseconds>(end - request.start).count();
 
     std::string e = error.code ? error.asString() : "";
 
     apiclient_utils::log_task_done(e, m_RequestDetails.sessid, m_RequestDetails.remote_address,
-                                      m_RequestDetails.method, m_RequestDetails.resource, m_HttpCode, ms);
+                                      request.method, request.resource, request.http_code, ms);
+
+    bool idle = request.idle;
+    bool upgrade = request.upgrade;
+    db::Task idle_task = std::move(request.idle_task);
+    m_Pipeline.pop_front();
+    ++m_FirstSeq;
+    --m_Writing;
+
+    if (error.code)
+    {
+        return;
+    }
 
-    m_HttpCode = 200;   // will change if next request will be "bad"
+    if (upgrade)
+    {
+        m_WebSocket = true;
+        m_ReadStopped = false;
+        m_Client->startWebSocket(/*client_side*/ false, m_WsDeflate);
+        f::logd2("[{0}] websocket started [deflate: {1}]", m_RequestDetails.sessid, m_WsDeflate);
+    }
+
+    if (idle)
+    {
+        startIdle(std::move(idle_task));
+        if (!m_WebSocket)
+        {
+            return;
+        }
+    }
 
     // don't close connect
-    readCmd();
+    if (m_ReadPending)
+    {
+        if (m_Pipeline.empty())
+        {
+            scheduleReadTimeout();
+        }
+    }
+    else if (!m_ReadStopped)
+    {
+        readCmd();
+    }
 }
@@ -1,65 +1,154 @@
 #pragma once
 
+#include <atomic>
+
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/asio/signal_set.hpp>
 #include <boost/asio/strand.hpp>
-#include <boost/asio/steady_timer.hpp>
+#include <boost/circular_buffer.hpp>
 #include <boost/noncopyable.hpp>
 #include <boost/make_shared.hpp>
 
 #include "apiclient_utils.hpp"
 #include "request.hpp"
 #include "database_worker.hpp"
+#include "handshake_pool.hpp"
 #include "net/client.hpp"
 #include "common/common.hpp"
+#include "common/io_thread.hpp"
+#include "common/timer_wheel.hpp"
+
+
+/*
+ * What to do with idle pushes to client, which does not read them:
+ * when outbound data of connection exceeds the limit, new pushes are dropped,
+ * or collapsed into one "resync" message (client should reload history),
+ * or connection is closed. Counters are shared by all connections.
+ */
+struct OutboundPolicy
+{
+    enum class slow_reader_t : uint8_t
+    {
+        DROP,
+        RESYNC,
+        DISCONNECT
+    };
+
+    size_t max_bytes = 1024 * 1024;
+    slow_reader_t on_overflow = slow_reader_t::RESYNC;
+
+    std::atomic<uint64_t> dropped{0};
+    std::atomic<uint64_t> resynced{0};
+    std::atomic<uint64_t> disconnected{0};
+};
 
 
 class ApiClient: public boost::enable_shared_from_this<ApiClient>, private boost::noncopyable
 {
 public:
-    ApiClient(boost::shared_ptr<TcpClient> socket, DatabaseWorker &db);
+    ApiClient(boost::shared_ptr<TcpClient> socket, DatabaseWorker &db, IoThread &io_thread, OutboundPolicy &outbound);
     ~ApiClient();
 
-    void serveSslClient();
-    void sendOkResponse(const std::string &body);
-    void sendMessagesToIdleConn(std::vector<apiclient_utils::Message> &&msgs);
-    void sendMessages(std::vector<apiclient_utils::Message> &&msgs);
+    void serveSslClient(HandshakePool &handshakes);
+    // responses to request with given seq, could be called from any thread
+    void sendOkResponse(uint64_t seq, const std::string &body);
+    void sendOkResponse(uint64_t seq, OutBuffer body);
+    void sendMessages(uint64_t seq, std::vector<apiclient_utils::Message> &&msgs);
+    void sendErrorResponse(uint64_t seq, int http_code, common::ApiStatusCode api_code, const std::string &desc);
 
-    void sendErrorResponse(int http_code, common::ApiStatusCode api_code, const std::string &desc);
+    void sendMessagesToIdleConn(std::vector<apiclient_utils::Message> &&msgs);
+    void pushMessages(std::vector<apiclient_utils::Message> msgs);
 
 private:
-    void sendOkResponseAndStartIdle();
+    void sendOkResponseAndStartIdle(uint64_t seq);
+    void startIdle(db::Task task);
 
 private:
+    void startHandshake(HandshakePool &handshakes);
     void processClientRequest(const ConnectionError &error);
     void readCmd();
+    void scheduleReadTimeout();
+    void dispatchRequest(const common::Route *route, boost::string_ref body, boost::string_ref content_type);
+    bool authenticate();
+    void upgradeToWebSocket(const HttpReply &req);
+
+    uint64_t beginRequest(const std::string &method);
+    void completeRequest(uint64_t seq, int http_code, OutBuffer response);
+    void writeReadyResponses();
 
 private:
-    void timerWaitTaskResultHandler(const boost::system::error_code& e);
+    void timerPingHandler();
+    void readTimeout();
+    void releaseHandshake();
+    void slowReader();
+    void hibernate();
+
+    void writeEvent(OutBuffer event);
+    void writeEventChunk(OutBuffer chunk);
+    void idleWriteFailed(const ConnectionError &error);
 
 private:
-    void v1_handler(const HttpReply &req, common::cmd_t cmd);
-    void handler_impl(const HttpReply &req, common::cmd_t command);
+    void v1_handler(boost::string_ref body, boost::string_ref content_type, const common::Route &route);
+    void handler_impl(boost::string_ref body, boost::string_ref content_type, const common::Route &route);
 
 private:
     void requestFromClientReadHandler(const ConnectionError &error, const HttpReply &reply);
+    void messageFromClientReadHandler(const ConnectionError &error, boost::string_ref message);
     void responseToClientWroteHandler(const ConnectionError &error);
 
 private:
-    std::string buildApiOkResponse(const std::string &body);
+    /*
+     * Request, which is read from connection and waits for its response.
+     * Client could send next requests without waiting (http pipelining),
+     * they are processed concurrently, responses are written in order of requests.
+     */
+    struct PipelinedRequest
+    {
+        std::chrono::time_point<std::chrono::steady_clock> start;
+        std::string method;
+        std::string resource;
+
+        int http_code = 200;
+        OutBuffer response{std::string()};                   // empty till response is built, nothing is allocated
+        bool ready = false;                                  // response is built
+        bool idle = false;                                   // connection becomes idle after response
+        db::Task idle_task;                                  // subscription of idle request, taken when it is parsed
+        bool upgrade = false;                                // connection becomes websocket after response
+    };
 
 private:
-    int m_HttpCode;                                          // http response code
-    int m_StoragePollingIntervalMs;
-    uint64_t m_NewestMsgTimestamp = 0;                       // notify client only about new messages
-    uint64_t m_LastClientPing = 0;                           // from time to time we need to ping client
+    int m_PingIntervalMs;                                    // from time to time we need to ping idle client
 
     RequestDetails m_RequestDetails;
+    db::User m_SessionUser;                                  // of token of request, empty - password is checked by worker
 
     boost::shared_ptr<AsyncHttpClient> m_Client;             // http socket, request from client
-    boost::asio::steady_timer m_Timer;
-
-    std::chrono::time_point<std::chrono::steady_clock> m_Start;
+    HandoffMemory m_ResponseMemory;                          // responses of database workers go to io thread
+    WheelTimer m_PingTimer;                                  // ping of idle connection
+    WheelTimer m_ReadTimer;                                  // deadline of request from client
+    bool m_FirstRequest;                                     // no request was read from connection yet
+    std::atomic<HandshakePool *> m_Handshakes;               // slot of pool is held, while handshake is not done
+
+    boost::circular_buffer<PipelinedRequest> m_Pipeline;     // io thread only, grows up to the deepest pipeline
+    uint64_t m_FirstSeq;                                     // seq of request in front of pipeline
+    size_t m_Writing;                                        // count of front requests, given to socket
+    bool m_ReadPending;
+    bool m_ReadStopped;                                      // by error or idle request
+
+    bool m_WebSocket;                                        // requests and responses are websocket messages
+    bool m_WsDeflate;                                        // permessage-deflate is negotiated
+    uint64_t m_IdleUid;                                      // user, whose messages are pushed to connection
+
+    bool m_EventStream;                                      // pushes are server-sent events of chunked response
+    bool m_EventsWriting;                                    // chunk of events is given to socket
+    OutBuffer m_Events;                                      // events, which wait for it, go by next chunk
 
     DatabaseWorker &m_Db;
+    IoThread &m_IoThread;                                    // thread, which serves socket
+
+    OutboundPolicy &m_Outbound;
+    bool m_NeedResync;                                       // pushes were dropped, client should reload
+
+    std::chrono::time_point<std::chrono::steady_clock> m_LastTraffic;   // of idle connection, pings are not counted
+    bool m_Hibernating;                                      // buffers of idle connection are released
 };
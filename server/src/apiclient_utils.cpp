@@ -33,10 +33,10 @@ bool password_check(const std::string &password, size_t min_len)
     return false;
 }
 
-std::string make_api_error(common::ApiStatusCode api_code, const std::string &desc)
+OutBuffer make_api_error(common::ApiStatusCode api_code, const std::string &desc)
 {
-    rapidjson::StringBuffer buffer;
-    rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+    OutBuffer buffer;
+    rapidjson::Writer<OutBuffer> writer(buffer);
     writer.StartObject();
 
     writer.Key("status");
@@ -46,13 +46,13 @@ std::string make_api_error(common::ApiStatusCode api_code, const std::string &de
     writer.String(desc.c_str());
 
     writer.EndObject();
-    return std::string(buffer.GetString(), buffer.GetSize());
+    return buffer;
 }
 
-std::string build_api_ok_response_body(common::cmd_t command)
+OutBuffer build_api_ok_response_body(common::cmd_t command)
 {
-    rapidjson::StringBuffer buffer;
-    rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+    OutBuffer buffer;
+    rapidjson::Writer<OutBuffer> writer(buffer);
     writer.StartObject();
 
     writer.Key("cmd");
@@ -62,13 +62,13 @@ std::string build_api_ok_response_body(common::cmd_t command)
     writer.Uint64(time(NULL));
 
     writer.EndObject();
-    return std::string(buffer.GetString(), buffer.GetSize());
+    return buffer;
 }
 
-std::string build_api_ok_response_body(const db::User &user)
+OutBuffer build_api_ok_response_body(const db::User &user, const std::string &token)
 {
-    rapidjson::StringBuffer buffer;
-    rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+    OutBuffer buffer;
+    rapidjson::Writer<OutBuffer> writer(buffer);
     writer.StartObject();
 
     writer.Key("id");
@@ -83,17 +83,23 @@ std::string build_api_ok_response_body(const db::User &user)
     writer.Key("name");
     writer.String(user.name.c_str());
 
+    if (!token.empty())
+    {
+        writer.Key("token");
+        writer.String(token.c_str());
+    }
+
     writer.Key("server_ts");
     writer.Uint64(time(NULL));
 
     writer.EndObject();
-    return std::string(buffer.GetString(), buffer.GetSize());
+    return buffer;
 }
 
-std::string build_api_ok_response_body(const db::Chat &chat)
+OutBuffer build_api_ok_response_body(const db::Chat &chat)
 {
-    rapidjson::StringBuffer buffer;
-    rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+    OutBuffer buffer;
+    rapidjson::Writer<OutBuffer> writer(buffer);
     writer.StartObject();
 
     writer.Key("chatid");
@@ -106,13 +112,20 @@ std::string build_api_ok_response_body(const db::Chat &chat)
     writer.Uint64(time(NULL));
 
     writer.EndObject();
-    return std::string(buffer.GetString(), buffer.GetSize());
+    return buffer;
 }
 
-std::string build_api_ok_response_body(std::vector<apiclient_utils::Message> &&msgs)
+OutBuffer build_api_ok_response_body(std::vector<apiclient_utils::Message> &&msgs)
 {
-    rapidjson::StringBuffer buffer;
-    rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+    OutBuffer buffer;
+    size_t size = 64;
+    for (const auto &msg : msgs)
+    {
+        // keys and timestamp of message take about 64 bytes
+        size += msg.from.size() + msg.to.size() + msg.msg.size() + 64;
+    }
+    buffer.reserve(size);
+    rapidjson::Writer<OutBuffer> writer(buffer);
     writer.StartObject();
 
     writer.Key("server_ts");
@@ -141,7 +154,30 @@ std::string build_api_ok_response_body(std::vector<apiclient_utils::Message> &&m
     writer.EndArray();
 
     writer.EndObject();
-    return std::string(buffer.GetString(), buffer.GetSize());
+    return buffer;
+}
+
+OutBuffer build_api_resync_body()
+/*
+ *  some pushed messages were dropped: client should load history again
+ */
+{
+    OutBuffer buffer;
+    rapidjson::Writer<OutBuffer> writer(buffer);
+    writer.StartObject();
+
+    writer.Key("server_ts");
+    writer.Uint64(time(NULL));
+
+    writer.Key("resync");
+    writer.Bool(true);
+
+    writer.Key("msgs");
+    writer.StartArray();
+    writer.EndArray();
+
+    writer.EndObject();
+    return buffer;
 }
 
 
@@ -5,6 +5,7 @@
 
 #include "common/common.hpp"
 #include "database.hpp"
+#include "net/out_buffer.hpp"
 
 
 namespace apiclient_utils
@@ -27,12 +28,13 @@ struct Message
 
 bool password_check(const std::string &password, size_t min_len);
 
-std::string make_api_error(common::ApiStatusCode api_code, const std::string &desc);
+OutBuffer make_api_error(common::ApiStatusCode api_code, const std::string &desc);
 
-std::string build_api_ok_response_body(common::cmd_t command);
-std::string build_api_ok_response_body(const db::User &user);
-std::string build_api_ok_response_body(const db::Chat &chat);
-std::string build_api_ok_response_body(std::vector<apiclient_utils::Message> &&msgs);
+OutBuffer build_api_ok_response_body(common::cmd_t command);
+OutBuffer build_api_ok_response_body(const db::User &user, const std::string &token = "");
+OutBuffer build_api_ok_response_body(const db::Chat &chat);
+OutBuffer build_api_ok_response_body(std::vector<apiclient_utils::Message> &&msgs);
+OutBuffer build_api_resync_body();
 
 
 
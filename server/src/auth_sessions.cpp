@@ -0,0 +1,109 @@
+#include <mutex>
+#include <tuple>
+
+#include <openssl/rand.h>
+
+#include "auth_sessions.hpp"
+
+
+namespace
+{
+
+const size_t TOKEN_BYTES = 16;
+
+std::string make_token()
+{
+    static const char digits[] = "0123456789abcdef";
+
+    unsigned char random[TOKEN_BYTES];
+    if (RAND_bytes(random, sizeof(random)) != 1)
+    {
+        return "";
+    }
+
+    std::string token(2 * sizeof(random), '\0');
+    for (size_t i = 0; i < sizeof(random); ++i)
+    {
+        token[2 * i] = digits[random[i] >> 4];
+        token[2 * i + 1] = digits[random[i] & 0xf];
+    }
+    return token;
+}
+
+}   // namespace
+
+
+AuthSessions::AuthSessions(std::chrono::seconds ttl) :
+    m_Ttl(ttl)
+{
+}
+
+std::string AuthSessions::issue(const db::User &user)
+/*
+ *  empty token - there is no entropy, session is not started
+ */
+{
+    std::string token = make_token();
+    if (token.empty())
+    {
+        return token;
+    }
+
+    clock_t::time_point now = clock_t::now();
+
+    Shard &s = shard(token);
+    std::unique_lock<std::shared_timed_mutex> lock(s.mutex);
+
+    if (++s.issued % SWEEP_EVERY == 0)
+    {
+        for (auto it = s.sessions.begin(); it != s.sessions.end(); )
+        {
+            it = it->second.expiry.load(std::memory_order_relaxed) < now.time_since_epoch().count() ? s.sessions.erase(it) : std::next(it);
+        }
+    }
+
+    s.sessions.emplace(std::piecewise_construct,
+                       std::forward_as_tuple(token),
+                       std::forward_as_tuple(user, expiry(now)));
+    return token;
+}
+
+bool AuthSessions::check(const std::string &token, uint64_t uid, db::User &user)
+{
+    clock_t::time_point now = clock_t::now();
+    Shard &s = shard(token);
+
+    {
+        std::shared_lock<std::shared_timed_mutex> lock(s.mutex);
+
+        auto it = s.sessions.find(token);
+        if (it == s.sessions.end())
+        {
+            return false;
+        }
+
+        Session &session = it->second;
+        if (session.expiry.load(std::memory_order_relaxed) >= now.time_since_epoch().count())
+        {
+            if (session.uid != uid)
+            {
+                return false;
+            }
+
+            session.expiry.store(expiry(now), std::memory_order_relaxed);
+            user.id = session.uid;
+            user.self_chat_id = session.self_chat_id;
+            user.name = session.name;
+            return true;
+        }
+    }
+
+    // expired: removed, unless it is prolonged in between
+    std::unique_lock<std::shared_timed_mutex> lock(s.mutex);
+    auto it = s.sessions.find(token);
+    if (it != s.sessions.end() && it->second.expiry.load(std::memory_order_relaxed) < now.time_since_epoch().count())
+    {
+        s.sessions.erase(it);
+    }
+    return false;
+}
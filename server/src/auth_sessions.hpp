@@ -0,0 +1,68 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <shared_mutex>
+#include <unordered_map>
+
+#include "database.hpp"
+
+
+/*
+ * Sessions of logged in users. Login checks password once and issues random token,
+ * next requests carry token instead of password: it is checked on io thread,
+ * database worker does not look user up and does not hash password for them.
+ *
+ * Table is split into shards by hash of token, each one with own reader/writer lock,
+ * check takes only shared lock. Expiry is sliding: token lives for ttl after its last use,
+ * expired ones are removed by check or by sweep of shard, which is done while issuing.
+ */
+class AuthSessions
+{
+public:
+    typedef std::chrono::steady_clock clock_t;
+
+public:
+    explicit AuthSessions(std::chrono::seconds ttl);
+
+    std::string issue(const db::User &user);
+
+    // user (id, self chat, name) of valid token, which was issued to uid
+    bool check(const std::string &token, uint64_t uid, db::User &user);
+
+private:
+    static constexpr size_t SHARDS = 64;
+    static constexpr size_t SWEEP_EVERY = 64;       // issues of shard
+
+    struct Session
+    {
+        Session(const db::User &user, clock_t::rep expiry) :
+            uid(user.id),
+            self_chat_id(user.self_chat_id),
+            name(user.name),
+            expiry(expiry)
+        {}
+
+        uint64_t uid;
+        uint64_t self_chat_id;
+        std::string name;
+        std::atomic<clock_t::rep> expiry;           // prolonged under shared lock
+    };
+
+    struct Shard
+    {
+        mutable std::shared_timed_mutex mutex;
+        std::unordered_map<std::string, Session> sessions;
+        size_t issued = 0;
+    };
+
+private:
+    Shard &shard(const std::string &token) { return m_Shards[std::hash<std::string>()(token) % SHARDS]; }
+    clock_t::rep expiry(clock_t::time_point now) const { return (now + m_Ttl).time_since_epoch().count(); }
+
+private:
+    const std::chrono::seconds m_Ttl;
+    std::array<Shard, SHARDS> m_Shards;
+};
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+
+
+/*
+ * Helpers of benchmarks (bench_*.cpp): they are built by waf together with server
+ * and are run by hand, results are printed to stdout.
+ */
+namespace bench
+{
+
+typedef std::chrono::steady_clock clock_t;
+
+// result of measured code is kept, so it is not thrown away by optimizer
+inline void keep(size_t value)
+{
+    static volatile size_t sink = 0;
+    sink = sink + value;
+}
+
+// nanoseconds per call of op(i), i = 0 .. count - 1
+template<class Op>
+double ns_per_op(size_t count, Op op)
+{
+    clock_t::time_point start = clock_t::now();
+    for (size_t i = 0; i < count; ++i)
+    {
+        op(i);
+    }
+    return std::chrono::duration<double, std::nano>(clock_t::now() - start).count() / count;
+}
+
+// millions of operations per second for given nanoseconds per operation
+inline double mops(double ns) { return 1000.0 / ns; }
+
+}   // namespace bench
@@ -0,0 +1,108 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+#include <boost/make_shared.hpp>
+
+#include "libproperty/src/libproperty.hpp"
+
+#include "bench.hpp"
+#include "net/client.hpp"
+
+
+/*
+ * Connect storm against running server: `threads` clients connect, do full tls handshake
+ * and close connection in a loop, result is count of accepted connections per second.
+ * Run it against server with one acceptor (default) and with --reuseport, e.g.
+ *     ./chatserver --sert ../../server.pem --port 7788 --io_workers 4 [--reuseport] &
+ *     ./bench_accept --port 7788 --threads 32
+ */
+
+namespace
+{
+
+// false - connection failed
+bool connect_once(boost::asio::io_service &io, boost::asio::ssl::context &ctx,
+                  const boost::asio::ip::tcp::endpoint &endpoint)
+{
+    auto socket = boost::make_shared<TcpClient>(io, ctx);
+
+    boost::system::error_code ec;
+    socket->lowestLayer().connect(endpoint, ec);
+    if (!ec)
+    {
+        socket->ssl_stream().handshake(boost::asio::ssl::stream_base::client, ec);
+    }
+    socket->lowestLayer().close();
+    return !ec;
+}
+
+}   // namespace
+
+
+int main(int argc, char *argv[])
+{
+    libproperty::Options *opt = libproperty::Options::impl();
+    opt->add("help", "h", "print help and exit", false);
+    opt->add("host", "", "host of server", "127.0.0.1");
+    opt->add("port", "p", "port of server", 7788);
+    opt->add("threads", "t", "count of connecting clients", 32);
+    opt->add("duration_ms", "", "time of storm, milliseconds", 10000);
+
+    try
+    {
+        opt->parse(argc, argv);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        return -1;
+    }
+
+    if (opt->get<bool>("help"))
+    {
+        std::cout << opt->usage(argv[0]) << std::endl;
+        return 0;
+    }
+
+    boost::asio::io_service resolver_io;
+    boost::asio::ip::tcp::resolver resolver(resolver_io);
+    boost::asio::ip::tcp::endpoint endpoint = *resolver.resolve(boost::asio::ip::tcp::resolver::query(
+        opt->get<std::string>("host"), std::to_string(opt->get<int>("port"))));
+
+    boost::asio::ssl::context ctx(boost::asio::ssl::context::sslv23_client);
+    std::atomic<size_t> accepted(0);
+    std::atomic<size_t> failed(0);
+
+    std::chrono::milliseconds duration(opt->get<int>("duration_ms"));
+    bench::clock_t::time_point deadline = bench::clock_t::now() + duration;
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < opt->get<int>("threads"); ++i)
+    {
+        threads.emplace_back([&]()
+        {
+            // sockets are used synchronously, io service is never run
+            boost::asio::io_service io;
+            while (bench::clock_t::now() < deadline)
+            {
+                ++(connect_once(io, ctx, endpoint) ? accepted : failed);
+            }
+        });
+    }
+
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+
+    printf("bench_accept: %.0f connections/s, %zu failed\n",
+           accepted.load() * 1000.0 / duration.count(), failed.load());
+    return 0;
+}
@@ -0,0 +1,158 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+
+#include "libproperty/src/libproperty.hpp"
+
+#include "bench.hpp"
+
+
+/*
+ * Accept to first byte of running server: `threads` clients connect, send tls ClientHello
+ * and wait for the first byte of server's answer, then close connection. ClientHello is made
+ * once by openssl over memory bios and is sent as is, so client side costs only connect,
+ * one write and one read. Result is connections per second and latency percentiles.
+ * Run it against server with session pool (default) and without it, e.g.
+ *     ./chatserver --sert ../../server.pem --port 7788 [--session_pool 0] &
+ *     ./bench_first_byte --port 7788 --threads 8
+ */
+
+namespace
+{
+
+// ClientHello record(s), which openssl client sends first
+std::string make_client_hello()
+{
+    boost::asio::ssl::context ctx(boost::asio::ssl::context::sslv23_client);
+    SSL *ssl = SSL_new(ctx.native_handle());
+    BIO *in = BIO_new(BIO_s_mem());
+    BIO *out = BIO_new(BIO_s_mem());
+    SSL_set_bio(ssl, in, out);
+    SSL_set_connect_state(ssl);
+    SSL_do_handshake(ssl);
+
+    char *data = nullptr;
+    long size = BIO_get_mem_data(out, &data);
+    std::string hello(data, size > 0 ? size : 0);
+    SSL_free(ssl);
+    return hello;
+}
+
+// microseconds from connect to the first byte of answer, 0 - connection failed
+double first_byte_us(boost::asio::io_service &io, const boost::asio::ip::tcp::endpoint &endpoint, const std::string &hello)
+{
+    boost::asio::ip::tcp::socket socket(io);
+    bench::clock_t::time_point start = bench::clock_t::now();
+
+    boost::system::error_code ec;
+    socket.connect(endpoint, ec);
+    if (!ec)
+    {
+        socket.set_option(boost::asio::ip::tcp::no_delay(true), ec);
+        boost::asio::write(socket, boost::asio::buffer(hello), ec);
+    }
+
+    char byte = 0;
+    if (!ec)
+    {
+        socket.read_some(boost::asio::buffer(&byte, 1), ec);
+    }
+    double us = std::chrono::duration<double, std::micro>(bench::clock_t::now() - start).count();
+
+    socket.close(ec);
+    return byte ? us : 0;
+}
+
+}   // namespace
+
+
+int main(int argc, char *argv[])
+{
+    libproperty::Options *opt = libproperty::Options::impl();
+    opt->add("help", "h", "print help and exit", false);
+    opt->add("host", "", "host of server", "127.0.0.1");
+    opt->add("port", "p", "port of server", 7788);
+    opt->add("threads", "t", "count of connecting clients", 8);
+    opt->add("duration_ms", "", "time of run, milliseconds", 10000);
+
+    try
+    {
+        opt->parse(argc, argv);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        return -1;
+    }
+
+    if (opt->get<bool>("help"))
+    {
+        std::cout << opt->usage(argv[0]) << std::endl;
+        return 0;
+    }
+
+    boost::asio::io_service resolver_io;
+    boost::asio::ip::tcp::resolver resolver(resolver_io);
+    boost::asio::ip::tcp::endpoint endpoint = *resolver.resolve(boost::asio::ip::tcp::resolver::query(
+        opt->get<std::string>("host"), std::to_string(opt->get<int>("port"))));
+
+    std::string hello = make_client_hello();
+    std::mutex mutex;
+    std::vector<double> latencies;
+    std::atomic<size_t> failed(0);
+
+    std::chrono::milliseconds duration(opt->get<int>("duration_ms"));
+    bench::clock_t::time_point deadline = bench::clock_t::now() + duration;
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < opt->get<int>("threads"); ++i)
+    {
+        threads.emplace_back([&]()
+        {
+            // sockets are used synchronously, io service is never run
+            boost::asio::io_service io;
+            std::vector<double> own;
+            while (bench::clock_t::now() < deadline)
+            {
+                double us = first_byte_us(io, endpoint, hello);
+                if (us > 0)
+                {
+                    own.push_back(us);
+                }
+                else
+                {
+                    ++failed;
+                }
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            latencies.insert(latencies.end(), own.begin(), own.end());
+        });
+    }
+
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+
+    if (latencies.empty())
+    {
+        printf("bench_first_byte: no answers, %zu failed\n", failed.load());
+        return 1;
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    printf("bench_first_byte: %.0f connections/s, first byte p50 %.0f us, p99 %.0f us, max %.0f us, %zu failed\n",
+           latencies.size() * 1000.0 / duration.count(), latencies[latencies.size() / 2],
+           latencies[latencies.size() * 99 / 100], latencies.back(), failed.load());
+    return 0;
+}
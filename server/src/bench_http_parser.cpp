@@ -0,0 +1,152 @@
+#include <cstdio>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "libproperty/src/libproperty.hpp"
+
+#include "bench.hpp"
+#include "common/utils.hpp"
+#include "net/http_parser.hpp"
+
+
+/*
+ * Parse of request head by HttpParser against the way AsyncHttpClient parsed it before:
+ * head is split into lines, start line into words, headers go to std::map,
+ * Content-Length is converted by stoul. Heads of requests of chat client
+ * and of browser-like client are parsed from the same buffer again and again.
+ */
+
+namespace
+{
+
+const std::string CLIENT_REQUEST =
+    "POST /v1/message/send HTTP/1.1\r\n"
+    "Content-Length: 97\r\n"
+    "Content-Type: application/json\r\n"
+    "Accept: application/json\r\n"
+    "\r\n";
+
+const std::string BROWSER_REQUEST =
+    "POST /v1/user/history HTTP/1.1\r\n"
+    "Host: chat.example.com\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:45.0) Gecko/20100101 Firefox/45.0\r\n"
+    "Accept: application/json, text/plain, */*\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "Content-Type: application/json;charset=utf-8\r\n"
+    "Content-Length: 120\r\n"
+    "Origin: https://chat.example.com\r\n"
+    "Referer: https://chat.example.com/chat\r\n"
+    "Cookie: lang=en; theme=dark\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n";
+
+// length of body, as HttpParser gives it
+size_t parse_new(HttpParser &parser, const std::string &head)
+{
+    parser.reset();
+    if (parser.parse(head.data(), head.size()) != HttpParser::state_t::DONE)
+    {
+        return 0;
+    }
+    return parser.contentLength() + parser.resource().size();
+}
+
+// parseHeaderLine and header part of AsyncHttpClient::handleHeaders, as they were
+bool parse_header_line(const std::string &line, std::map<std::string, std::string> &parsed_headers)
+{
+    std::string::size_type pos = line.find_first_of(':');
+    if ((pos == std::string::npos) || (pos == 0))
+        return false;
+
+    std::string key = line.substr(0, pos);
+    if (pos == line.size() - 1)
+    {
+        parsed_headers[key] = "";
+        return true;
+    }
+
+    ++pos;
+    while (isspace(line[pos])) ++pos;
+    parsed_headers[key] = line.substr(pos, std::string::npos);
+    return true;
+}
+
+size_t parse_old(const std::string &head)
+{
+    // head was swapped out of streambuf into string
+    std::string headers = head;
+
+    std::vector<std::string> h_vector = utils::split(headers, "\r\n");
+    if (h_vector.empty() || h_vector[0].empty())
+    {
+        return 0;
+    }
+
+    std::vector<std::string> request_params = utils::split(h_vector[0], " ");
+    if (request_params.size() < 2)
+    {
+        return 0;
+    }
+    std::string method = utils::lowercased(request_params[0]);
+    std::string resource = request_params[1];
+
+    std::map<std::string, std::string> parsed_headers;
+    for (size_t i = 1; i < h_vector.size(); ++i)
+    {
+        parse_header_line(h_vector[i], parsed_headers);
+    }
+
+    auto it = parsed_headers.find("Content-Length");
+    return (it != parsed_headers.end() ? std::stoul(it->second) : 0) + resource.size();
+}
+
+void measure(const char *name, const std::string &head, size_t count)
+{
+    HttpParser parser;
+    double parsed = bench::ns_per_op(count, [&](size_t)
+    {
+        bench::keep(parse_new(parser, head));
+    });
+
+    double split = bench::ns_per_op(count, [&](size_t)
+    {
+        bench::keep(parse_old(head));
+    });
+
+    printf("%10s %8zu %16.2f %16.2f\n", name, head.size(), bench::mops(parsed), bench::mops(split));
+}
+
+}   // namespace
+
+
+int main(int argc, char *argv[])
+{
+    libproperty::Options *opt = libproperty::Options::impl();
+    opt->add("help", "h", "print help and exit", false);
+    opt->add("count", "", "parses of each head by each parser", 1000000);
+
+    try
+    {
+        opt->parse(argc, argv);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        return -1;
+    }
+
+    if (opt->get<bool>("help"))
+    {
+        std::cout << opt->usage(argv[0]) << std::endl;
+        return 0;
+    }
+
+    size_t count = opt->get<int>("count");
+    printf("%10s %8s %16s %16s\n", "request", "bytes", "HttpParser, M/s", "split, M/s");
+    measure("client", CLIENT_REQUEST, count);
+    measure("browser", BROWSER_REQUEST, count);
+    return 0;
+}
@@ -0,0 +1,270 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+#include <boost/make_shared.hpp>
+
+#include "rapidjson/document.h"
+
+#include "libproperty/src/libproperty.hpp"
+
+#include "bench.hpp"
+#include "net/client.hpp"
+
+
+/*
+ * Latency of cheap requests of running server during storm of logins: one connection
+ * sends /v1/user/status with session token every `status_interval_ms`, first alone,
+ * then while `threads` connections loop on /v1/user/login with password (each login
+ * runs the KDF on hashing pool of server). Logins per second, logins rejected with 429
+ * (see hash_backlog of server) and percentiles of status latency are printed.
+ */
+
+namespace
+{
+
+struct Response
+{
+    int status = 0;
+    std::string body;
+};
+
+struct Storm
+{
+    std::atomic<size_t> logins{0};
+    std::atomic<size_t> rejected{0};
+    std::atomic<size_t> failed{0};
+};
+
+class Client
+{
+public:
+    explicit Client(const boost::asio::ip::tcp::endpoint &endpoint) :
+        m_Context(boost::asio::ssl::context::sslv23_client),
+        m_Endpoint(endpoint)
+    {
+    }
+
+    void connect()
+    {
+        // socket is used synchronously, io service is never run
+        m_Socket = boost::make_shared<TcpClient>(m_Io, m_Context);
+        m_Socket->lowestLayer().connect(m_Endpoint);
+        m_Socket->lowestLayer().set_option(boost::asio::ip::tcp::no_delay(true));
+        m_Socket->ssl_stream().handshake(boost::asio::ssl::stream_base::client);
+    }
+
+    // connection is kept alive between requests
+    Response request(const std::string &resource, const std::string &body)
+    {
+        m_Socket->write("POST " + resource + " HTTP/1.1\r\n"
+                        "Host: localhost\r\n"
+                        "Content-Type: application/json\r\n"
+                        "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                        "\r\n" + body);
+
+        boost::asio::streambuf buffer;
+        size_t head_size = boost::asio::read_until(m_Socket->ssl_stream(), buffer, "\r\n\r\n");
+
+        std::string head(boost::asio::buffers_begin(buffer.data()), boost::asio::buffers_begin(buffer.data()) + head_size);
+        buffer.consume(head_size);
+
+        Response response;
+        sscanf(head.c_str(), "HTTP/1.1 %d", &response.status);
+
+        const char content_length[] = "Content-Length:";
+        size_t pos = head.find(content_length);
+        if (pos != std::string::npos)
+        {
+            size_t length = std::stoul(head.substr(pos + sizeof(content_length) - 1));
+            if (buffer.size() < length)
+            {
+                boost::asio::read(m_Socket->ssl_stream(), buffer, boost::asio::transfer_exactly(length - buffer.size()));
+            }
+            response.body.assign(boost::asio::buffers_begin(buffer.data()), boost::asio::buffers_begin(buffer.data()) + length);
+        }
+        return response;
+    }
+
+private:
+    boost::asio::io_service m_Io;
+    boost::asio::ssl::context m_Context;
+    boost::asio::ip::tcp::endpoint m_Endpoint;
+    boost::shared_ptr<TcpClient> m_Socket;
+};
+
+// body of status request with session token, empty - user could not log in
+std::string login(Client &client, const std::string &user, const std::string &credentials)
+{
+    // user is created by the first run
+    client.request("/v1/user/create", credentials);
+    Response response = client.request("/v1/user/login", credentials);
+
+    rapidjson::Document json;
+    json.Parse(response.body.c_str());
+    if (response.status != 200 || !json.IsObject() || !json.HasMember("id") || !json.HasMember("token"))
+    {
+        std::cerr << "login failed: " << response.status << " " << response.body << std::endl;
+        return "";
+    }
+
+    return "{\"uid\":" + std::to_string(json["id"].GetUint64()) + ",\"user\":\"" + user
+           + "\",\"token\":\"" + json["token"].GetString() + "\"}";
+}
+
+// storm thread: logins over keep-alive connection, it is opened again after error
+void storm_loop(const boost::asio::ip::tcp::endpoint &endpoint, const std::string &credentials,
+                const std::atomic<bool> &stop, Storm &storm)
+{
+    Client client(endpoint);
+    bool connected = false;
+    while (!stop)
+    {
+        try
+        {
+            if (!connected)
+            {
+                client.connect();
+                connected = true;
+            }
+
+            int status = client.request("/v1/user/login", credentials).status;
+            if (status == 200)
+            {
+                ++storm.logins;
+            }
+            else if (status == 429)
+            {
+                ++storm.rejected;
+            }
+            else
+            {
+                ++storm.failed;
+            }
+        }
+        catch (const std::exception &)
+        {
+            ++storm.failed;
+            connected = false;
+        }
+    }
+}
+
+// status requests until deadline, latencies are printed
+void measure_status(const char *name, Client &client, const std::string &status_body,
+                    std::chrono::milliseconds interval, std::chrono::milliseconds duration)
+{
+    std::vector<double> latencies;
+    size_t failed = 0;
+    bench::clock_t::time_point deadline = bench::clock_t::now() + duration;
+    while (bench::clock_t::now() < deadline)
+    {
+        bench::clock_t::time_point start = bench::clock_t::now();
+        if (client.request("/v1/user/status", status_body).status == 200)
+        {
+            latencies.push_back(std::chrono::duration<double, std::milli>(bench::clock_t::now() - start).count());
+        }
+        else
+        {
+            ++failed;
+        }
+        std::this_thread::sleep_until(start + interval);
+    }
+
+    if (latencies.empty())
+    {
+        printf("%10s: no status responses, %zu failed\n", name, failed);
+        return;
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    printf("%10s: status p50 %.1f ms, p99 %.1f ms, max %.1f ms (%zu requests, %zu failed)\n", name,
+           latencies[latencies.size() / 2], latencies[latencies.size() * 99 / 100], latencies.back(),
+           latencies.size(), failed);
+}
+
+}   // namespace
+
+
+int main(int argc, char *argv[])
+{
+    libproperty::Options *opt = libproperty::Options::impl();
+    opt->add("help", "h", "print help and exit", false);
+    opt->add("host", "", "host of server", "127.0.0.1");
+    opt->add("port", "p", "port of server", 7788);
+    opt->add("threads", "t", "count of connections, which loop on logins", 32);
+    opt->add("duration_ms", "", "time of each run, milliseconds", 10000);
+    opt->add("status_interval_ms", "", "interval of status requests, milliseconds", 5);
+    opt->add("user", "u", "user of all requests, it is created if needed", "bench_login_storm");
+    opt->add("password", "", "password of user", "bench_login_storm");
+
+    try
+    {
+        opt->parse(argc, argv);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        return -1;
+    }
+
+    if (opt->get<bool>("help"))
+    {
+        std::cout << opt->usage(argv[0]) << std::endl;
+        return 0;
+    }
+
+    try
+    {
+        boost::asio::io_service resolver_io;
+        boost::asio::ip::tcp::resolver resolver(resolver_io);
+        boost::asio::ip::tcp::endpoint endpoint = *resolver.resolve(boost::asio::ip::tcp::resolver::query(
+            opt->get<std::string>("host"), std::to_string(opt->get<int>("port"))));
+
+        std::string user = opt->get<std::string>("user");
+        std::string credentials = "{\"user\":\"" + user + "\",\"password\":\"" + opt->get<std::string>("password") + "\"}";
+
+        Client client(endpoint);
+        client.connect();
+        std::string status_body = login(client, user, credentials);
+        if (status_body.empty())
+        {
+            return 1;
+        }
+
+        std::chrono::milliseconds interval(opt->get<int>("status_interval_ms"));
+        std::chrono::milliseconds duration(opt->get<int>("duration_ms"));
+        measure_status("no storm", client, status_body, interval, duration);
+
+        Storm storm;
+        std::atomic<bool> stop{false};
+        std::vector<std::thread> threads;
+        for (int i = 0; i < opt->get<int>("threads"); ++i)
+        {
+            threads.emplace_back(storm_loop, std::cref(endpoint), std::cref(credentials), std::cref(stop), std::ref(storm));
+        }
+
+        measure_status("storm", client, status_body, interval, duration);
+        stop = true;
+        for (auto &thread : threads)
+        {
+            thread.join();
+        }
+
+        printf("%10s: %.1f logins/s, %zu rejected with 429, %zu failed\n", "storm",
+               storm.logins.load() * 1000.0 / duration.count(), storm.rejected.load(), storm.failed.load());
+        return 0;
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "bench_login_storm: " << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,211 @@
+#include <cstdio>
+#include <iostream>
+#include <string>
+
+#include <rapidjson/document.h>
+#include <rapidjson/memorystream.h>
+
+#include "libproperty/src/libproperty.hpp"
+
+#include "bench.hpp"
+#include "common/common.hpp"
+#include "params_decoder.hpp"
+#include "request.hpp"
+
+
+/*
+ * Decode of request body per route: SAX decoder of ApiClient (decode_params) against
+ * the way parse_meta did it before: rapidjson Document is built, then members
+ * of route schema are found and copied. Body is copied for SAX decoder each time,
+ * as in situ parsing changes it.
+ */
+
+namespace
+{
+
+struct Sample
+{
+    const char *resource;
+    const char *body;
+};
+
+const Sample SAMPLES[] = {
+    { "/v1/message/send",     R"({"uid":12,"to":"user7","message":"hello, are you coming to the meeting today?","token":"0123456789abcdef0123456789abcdef"})" },
+    { "/v1/message/sendchat", R"({"uid":12,"chatname":"friends","message":"hello, are you coming to the meeting today?","token":"0123456789abcdef0123456789abcdef"})" },
+    { "/v1/user/create",      R"({"user":"user7","password":"secret_7"})" },
+    { "/v1/user/login",       R"({"user":"user7","password":"secret_7"})" },
+    { "/v1/user/history",     R"({"uid":12,"user":"user7","count":50,"token":"0123456789abcdef0123456789abcdef"})" },
+    { "/v1/user/status",      R"({"uid":12,"user":"user7","token":"0123456789abcdef0123456789abcdef"})" },
+    { "/v1/chat/create",      R"({"uid":12,"chatname":"friends","token":"0123456789abcdef0123456789abcdef"})" },
+    { "/v1/group/history",    R"({"uid":12,"token":"0123456789abcdef0123456789abcdef"})" },
+    { "/v1/chat/adduser",     R"({"uid":12,"chatname":"friends","adduser":"user9","token":"0123456789abcdef0123456789abcdef"})" },
+    { "/v1/idle",             R"({"uid":12,"heartbit":1500000000,"token":"0123456789abcdef0123456789abcdef"})" },
+};
+
+// parameters of route schema and their checks, as parse_meta had them with Document
+struct ParamField
+{
+    common::param_t param;
+    const char *name;
+};
+
+const ParamField PARAM_FIELDS[] = {
+    { common::P_PASSWORD, "password" },
+    { common::P_USER,     "user" },
+    { common::P_UID,      "uid" },
+    { common::P_CHATNAME, "chatname" },
+    { common::P_ADDUSER,  "adduser" },
+    { common::P_MESSAGE,  "message" },
+    { common::P_TO,       "to" },
+    { common::P_HEARTBIT, "heartbit" },
+    { common::P_COUNT,    "count" },
+    { common::P_TOKEN,    "token" },
+};
+
+std::string *string_param(RequestDetails::Params &params, common::param_t param)
+{
+    switch (param)
+    {
+        case common::P_PASSWORD: return &params.password;
+        case common::P_USER:     return &params.user;
+        case common::P_CHATNAME: return &params.chat.name;
+        case common::P_ADDUSER:  return &params.chat.adduser;
+        case common::P_MESSAGE:  return &params.message;
+        case common::P_TO:       return &params.to_user;
+        case common::P_TOKEN:    return &params.token;
+        default:                 return nullptr;
+    }
+}
+
+uint64_t *uint_param(RequestDetails::Params &params, common::param_t param)
+{
+    switch (param)
+    {
+        case common::P_UID:      return &params.uid;
+        case common::P_HEARTBIT: return &params.ts;
+        case common::P_COUNT:    return &params.count;
+        default:                 return nullptr;
+    }
+}
+
+std::string dom_decode(RequestDetails::Params &params, const std::string &json, const common::Route &route)
+{
+    rapidjson::MemoryStream stream(json.data(), json.size());
+    rapidjson::Document document;
+    if (document.ParseStream(stream).HasParseError())
+    {
+        return "bad request, invalid json";
+    }
+
+    for (const ParamField &field : PARAM_FIELDS)
+    {
+        bool required = (route.required & field.param) != 0;
+        if (!required && (route.optional & field.param) == 0)
+        {
+            continue;
+        }
+
+        std::string error;
+        auto it = document.FindMember(field.name);
+        std::string *str = string_param(params, field.param);
+        if (it == document.MemberEnd())
+        {
+            error = std::string("bad request, ") + field.name + " required";
+        }
+        else if (str)
+        {
+            if (!it->value.IsString())
+            {
+                error = std::string("bad request, ") + field.name + " is not string";
+            }
+            else if (std::string(it->value.GetString()).empty())
+            {
+                error = std::string("bad request, ") + field.name + " is empty";
+            }
+            else
+            {
+                *str = it->value.GetString();
+            }
+        }
+        else
+        {
+            if (!it->value.IsUint())
+            {
+                error = std::string("bad request, ") + field.name + " is not uint";
+            }
+            else
+            {
+                *uint_param(params, field.param) = it->value.GetUint();
+            }
+        }
+
+        if (!error.empty() && required)
+        {
+            return error;
+        }
+    }
+    return "";
+}
+
+// requests per second of each way
+void measure(const Sample &sample, size_t count)
+{
+    const common::Route &route = *common::find_route(sample.resource);
+    std::string body(sample.body);
+    RequestDetails dom_details;
+    RequestDetails sax_details;
+
+    double dom = bench::ns_per_op(count, [&](size_t)
+    {
+        bench::keep(dom_decode(dom_details.params, body, route).size());
+    });
+
+    std::string buffer;
+    double sax = bench::ns_per_op(count, [&](size_t)
+    {
+        buffer.assign(body);
+        bench::keep(decode_params(sax_details.params, &buffer[0], buffer.size(), route).size());
+    });
+
+    const RequestDetails::Params &d = dom_details.params;
+    const RequestDetails::Params &s = sax_details.params;
+    bool same = d.uid == s.uid && d.ts == s.ts && d.count == s.count && d.message == s.message
+                && d.to_user == s.to_user && d.user == s.user && d.password == s.password && d.token == s.token
+                && d.chat.name == s.chat.name && d.chat.adduser == s.chat.adduser;
+
+    printf("%22s %12.2f %12.2f %s\n", sample.resource, bench::mops(dom), bench::mops(sax), same ? "" : "params differ");
+}
+
+}   // namespace
+
+
+int main(int argc, char *argv[])
+{
+    libproperty::Options *opt = libproperty::Options::impl();
+    opt->add("help", "h", "print help and exit", false);
+    opt->add("count", "", "decodes of each body by each way", 1000000);
+
+    try
+    {
+        opt->parse(argc, argv);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        return -1;
+    }
+
+    if (opt->get<bool>("help"))
+    {
+        std::cout << opt->usage(argv[0]) << std::endl;
+        return 0;
+    }
+
+    size_t count = opt->get<int>("count");
+    printf("%22s %12s %12s\n", "route", "DOM, M/s", "SAX, M/s");
+    for (const Sample &sample : SAMPLES)
+    {
+        measure(sample, count);
+    }
+    return 0;
+}
@@ -0,0 +1,240 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <rapidjson/stringbuffer.h>
+#include <rapidjson/writer.h>
+
+#include "libproperty/src/libproperty.hpp"
+
+#include "apiclient_utils.hpp"
+#include "bench.hpp"
+#include "net/out_buffer.hpp"
+
+
+/*
+ * Building of history response (body with messages and http head) up to the write buffer
+ * of socket: in place, as ApiClient does it, against the way it was done before:
+ * body was serialized into rapidjson::StringBuffer, copied into std::string, appended
+ * to the head and passed by value to AsyncHttpClient::asyncRequest and then to
+ * BasicTcpClient::asyncWrite. Bytes allocated per response are counted by operator new
+ * and by allocator of rapidjson::StringBuffer.
+ */
+
+namespace
+{
+
+bool g_counting = false;
+size_t g_allocated = 0;
+
+const char RESPONSE_HEAD[] = "HTTP/1.1 200 OK\r\n"
+                             "Content-Type: application/json\r\n"
+                             "Access-Control-Allow-Origin: *\r\n"
+                             "Content-Length: ";
+
+typedef std::vector<apiclient_utils::Message> messages_t;
+
+// allocator of rapidjson::StringBuffer, it takes memory by malloc
+struct CountingAllocator : rapidjson::CrtAllocator
+{
+    void *Malloc(size_t size)
+    {
+        g_allocated += g_counting ? size : 0;
+        return rapidjson::CrtAllocator::Malloc(size);
+    }
+
+    void *Realloc(void *original, size_t original_size, size_t new_size)
+    {
+        g_allocated += g_counting ? new_size : 0;
+        return rapidjson::CrtAllocator::Realloc(original, original_size, new_size);
+    }
+};
+
+typedef rapidjson::GenericStringBuffer<rapidjson::UTF8<>, CountingAllocator> string_buffer_t;
+
+// old path, write buffer of socket took data by move
+struct OldSocket
+{
+    void asyncWrite(std::string data) { m_WriteBuffer = std::move(data); }
+    void asyncRequest(std::string request) { asyncWrite(request); }
+
+    std::string m_WriteBuffer;
+};
+
+std::string old_body(messages_t &&msgs)
+{
+    string_buffer_t buffer;
+    rapidjson::Writer<string_buffer_t> writer(buffer);
+    writer.StartObject();
+
+    writer.Key("server_ts");
+    writer.Uint64(time(NULL));
+
+    writer.Key("msgs");
+    writer.StartArray();
+    for (const auto &msg : msgs)
+    {
+        writer.StartObject();
+        writer.Key("from");
+        writer.String(msg.from.c_str());
+        writer.Key("to");
+        writer.String(msg.to.c_str());
+        writer.Key("message");
+        writer.String(msg.msg.c_str());
+        writer.Key("ts");
+        writer.Uint64(msg.ts);
+        writer.EndObject();
+    }
+    writer.EndArray();
+
+    writer.EndObject();
+    return std::string(buffer.GetString(), buffer.GetSize());
+}
+
+void old_send(OldSocket &socket, messages_t &&msgs)
+{
+    std::string body = old_body(std::move(msgs));
+
+    std::string response = "HTTP/1.1 200 OK\r\n";
+    response += (std::string("Content-Length: ") + std::to_string(body.size()) + std::string("\r\n"));
+    response += "Content-Type: application/json\r\n";
+    response += "Access-Control-Allow-Origin: *\r\n";
+    response += "\r\n";
+    response += body;
+
+    socket.asyncRequest(response);
+}
+
+// new path, as ApiClient::sendMessages and prepend_http_head
+struct NewSocket
+{
+    void asyncWrite(OutBuffer data) { m_WriteBuffer = std::move(data); }
+    void asyncRequest(OutBuffer request) { asyncWrite(std::move(request)); }
+
+    OutBuffer m_WriteBuffer;
+};
+
+void new_send(NewSocket &socket, messages_t &&msgs)
+{
+    OutBuffer response = apiclient_utils::build_api_ok_response_body(std::move(msgs));
+
+    char tail[32];
+    int tail_len = snprintf(tail, sizeof(tail), "%zu\r\n\r\n", response.size());
+    if (!response.prepend(tail, tail_len) || !response.prepend(RESPONSE_HEAD, sizeof(RESPONSE_HEAD) - 1))
+    {
+        abort();
+    }
+
+    socket.asyncRequest(std::move(response));
+}
+
+// nanoseconds per response; body builders take messages by rvalue reference,
+// but do not consume them, so one copy serves all rounds
+template<class Socket, class Send>
+double run(const messages_t &msgs, size_t rounds, Send send, size_t &allocated, size_t &response_size)
+{
+    messages_t input(msgs);
+    Socket socket;
+
+    g_allocated = 0;
+    g_counting = true;
+    double ns = bench::ns_per_op(rounds, [&](size_t)
+    {
+        send(socket, std::move(input));
+    });
+    g_counting = false;
+
+    allocated = g_allocated / rounds;
+    response_size = socket.m_WriteBuffer.size();
+    return ns;
+}
+
+}   // namespace
+
+
+void *operator new(size_t size)
+{
+    if (g_counting)
+    {
+        g_allocated += size;
+    }
+
+    void *p = malloc(size ? size : 1);
+    if (!p)
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+
+int main(int argc, char *argv[])
+{
+    libproperty::Options *opt = libproperty::Options::impl();
+    opt->add("help", "h", "print help and exit", false);
+    opt->add("messages", "", "messages in history response", 100);
+    opt->add("message_size", "", "size of each message", 100);
+    opt->add("rounds", "", "responses built each way in one run", 1000);
+    opt->add("repeats", "", "runs of each way, the best one is printed", 10);
+
+    try
+    {
+        opt->parse(argc, argv);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        return -1;
+    }
+
+    if (opt->get<bool>("help"))
+    {
+        std::cout << opt->usage(argv[0]) << std::endl;
+        return 0;
+    }
+
+    messages_t msgs;
+    for (int i = 0; i < opt->get<int>("messages"); ++i)
+    {
+        msgs.emplace_back(1500000000 + i, "user" + std::to_string(i % 7), "chat",
+                          std::string(opt->get<int>("message_size"), 'x'));
+    }
+
+    size_t rounds = opt->get<int>("rounds");
+    size_t repeats = std::max(opt->get<int>("repeats"), 1);
+
+    // machine is rarely quiet: runs of both ways alternate, the best one of each is taken
+    double best_old = 0;
+    double best_new = 0;
+    size_t allocated_old = 0;
+    size_t allocated_new = 0;
+    size_t size_old = 0;
+    size_t size_new = 0;
+    for (size_t r = 0; r < repeats; ++r)
+    {
+        double ns = run<OldSocket>(msgs, rounds, old_send, allocated_old, size_old);
+        best_old = (r == 0 || ns < best_old) ? ns : best_old;
+
+        ns = run<NewSocket>(msgs, rounds, new_send, allocated_new, size_new);
+        best_new = (r == 0 || ns < best_new) ? ns : best_new;
+    }
+
+    printf("%10s %12s %14s %14s\n", "path", "us/response", "response bytes", "allocated bytes");
+    printf("%10s %12.1f %14zu %14zu\n", "copies", best_old / 1000, size_old, allocated_old);
+    printf("%10s %12.1f %14zu %14zu\n", "in place", best_new / 1000, size_new, allocated_new);
+    return 0;
+}
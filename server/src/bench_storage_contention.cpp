@@ -0,0 +1,141 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "libproperty/src/libproperty.hpp"
+
+#include "bench.hpp"
+#include "database.hpp"
+
+
+/*
+ * Read-heavy load of database workers on InMemoryConnection: every worker looks users
+ * and chats up and reads history, `writes` percent of operations save a message.
+ * Sharded storage is compared with the same calls serialized by one mutex,
+ * as all of them were before shards.
+ */
+
+namespace
+{
+
+const size_t USERS = 10000;
+
+struct Load
+{
+    InMemoryConnection db;
+    std::mutex global;              // for serialized mode
+    std::atomic<bool> stop{false};
+    unsigned writes = 10;
+};
+
+size_t operation(Load &load, std::mt19937 &random)
+{
+    uint64_t uid = random() % USERS + 1;
+    unsigned kind = random() % 100;
+
+    if (kind < load.writes)
+    {
+        load.db.saveMessage(db::Message(uid, uid, "benchmark message"));
+        return 0;
+    }
+
+    switch (kind % 3)
+    {
+    case 0:
+        return load.db.lookupUserById(uid).id;
+    case 1:
+        return load.db.lookupChatById(uid).id;
+    default:
+        return load.db.getMessages(uid, db::get_msg_opt_t()).size();
+    }
+}
+
+// operations per second of all workers
+double run(Load &load, size_t workers, bool serialized, std::chrono::milliseconds duration)
+{
+    std::atomic<size_t> total(0);
+    load.stop = false;
+
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < workers; ++i)
+    {
+        threads.emplace_back([&load, &total, serialized, i]()
+        {
+            std::mt19937 random(i);
+            size_t done = 0;
+            while (!load.stop.load(std::memory_order_relaxed))
+            {
+                if (serialized)
+                {
+                    std::lock_guard<std::mutex> lock(load.global);
+                    bench::keep(operation(load, random));
+                }
+                else
+                {
+                    bench::keep(operation(load, random));
+                }
+                ++done;
+            }
+            total += done;
+        });
+    }
+
+    std::this_thread::sleep_for(duration);
+    load.stop = true;
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+    return total.load() * 1000.0 / duration.count();
+}
+
+}   // namespace
+
+
+int main(int argc, char *argv[])
+{
+    libproperty::Options *opt = libproperty::Options::impl();
+    opt->add("help", "h", "print help and exit", false);
+    opt->add("duration_ms", "", "time of each run, milliseconds", 2000);
+    opt->add("writes", "", "percent of operations, which save message", 10);
+
+    try
+    {
+        opt->parse(argc, argv);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        return -1;
+    }
+
+    if (opt->get<bool>("help"))
+    {
+        std::cout << opt->usage(argv[0]) << std::endl;
+        return 0;
+    }
+
+    Load load;
+    load.writes = opt->get<int>("writes");
+    for (size_t i = 0; i < USERS; ++i)
+    {
+        load.db.createUser("user" + std::to_string(i), "password", "");
+    }
+
+    std::chrono::milliseconds duration(opt->get<int>("duration_ms"));
+    printf("cpus: %u\n", std::thread::hardware_concurrency());
+    printf("%8s %18s %18s\n", "workers", "sharded, ops/s", "one mutex, ops/s");
+    for (size_t workers : {1, 4, 16, 64})
+    {
+        double sharded = run(load, workers, false, duration);
+        double serialized = run(load, workers, true, duration);
+        printf("%8zu %18.0f %18.0f\n", workers, sharded, serialized);
+    }
+    return 0;
+}
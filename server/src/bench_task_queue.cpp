@@ -0,0 +1,214 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "libproperty/src/libproperty.hpp"
+
+#include "bench.hpp"
+#include "common/lock_queue.hpp"
+#include "common/mpmc_queue.hpp"
+#include "database.hpp"
+
+
+/*
+ * Task queue of DatabaseWorker: MpmcQueue (tasks are moved, consumers sleep on futex)
+ * against Queue of lock_queue.hpp, as it was used: tasks are copied under mutex,
+ * consumer sleeps 10 ms, when queue is empty.
+ *  - throughput: tasks per second through queue by producers and consumers;
+ *  - wake up: time from push of task into empty queue until it is popped.
+ */
+
+namespace
+{
+
+typedef std::chrono::steady_clock clock_t;
+
+const size_t CAPACITY = 65536;
+
+class LockQueue
+{
+public:
+    void push(db::Task &&task) { m_Queue.push(task); }
+
+    bool pop(db::Task &task, const std::atomic<bool> &stop)
+    {
+        while (!stop)
+        {
+            if (m_Queue.getTask(task))
+            {
+                return true;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        return false;
+    }
+
+    void wakeAll() {}
+
+private:
+    Queue<db::Task> m_Queue;
+};
+
+class LockFreeQueue
+{
+public:
+    LockFreeQueue() : m_Queue(CAPACITY) {}
+
+    void push(db::Task &&task) { m_Queue.push(std::move(task)); }
+
+    bool pop(db::Task &task, const std::atomic<bool> &stop)
+    {
+        while (!stop)
+        {
+            if (m_Queue.pop(task, std::chrono::milliseconds(1000)))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void wakeAll() { m_Queue.wakeAll(); }
+
+private:
+    MpmcQueue<db::Task> m_Queue;
+};
+
+db::Task make_task(uint64_t seq)
+{
+    db::Task task;
+    task.cmd = common::cmd_t::MESSAGE_SEND;
+    task.seq = seq;
+    task.request.uid = 1;
+    task.request.to_user = "somebody";
+    task.request.token = "0123456789abcdef0123456789abcdef";
+    task.request.message = std::string(100, 'x');
+    return task;
+}
+
+// tasks per second
+template<class Q>
+double throughput(size_t tasks, size_t producers, size_t consumers)
+{
+    Q queue;
+    std::atomic<bool> stop(false);
+    std::atomic<size_t> popped(0);
+    clock_t::time_point finish;
+
+    clock_t::time_point start = clock_t::now();
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < consumers; ++i)
+    {
+        threads.emplace_back([&]()
+        {
+            db::Task task;
+            while (queue.pop(task, stop))
+            {
+                bench::keep(task.seq);
+                if (++popped == tasks)
+                {
+                    finish = clock_t::now();
+                    stop = true;
+                    queue.wakeAll();
+                }
+            }
+        });
+    }
+    for (size_t i = 0; i < producers; ++i)
+    {
+        threads.emplace_back([&, i]()
+        {
+            for (size_t seq = i; seq < tasks; seq += producers)
+            {
+                queue.push(make_task(seq));
+            }
+        });
+    }
+
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+    return tasks / std::chrono::duration<double>(finish - start).count();
+}
+
+// p50 and p99 of wake up, microseconds
+template<class Q>
+std::pair<double, double> wake_up(size_t rounds)
+{
+    Q queue;
+    std::atomic<bool> stop(false);
+    std::vector<double> latencies;
+
+    std::thread consumer([&]()
+    {
+        db::Task task;
+        while (queue.pop(task, stop))
+        {
+            clock_t::time_point pushed(clock_t::duration(task.seq));
+            latencies.push_back(std::chrono::duration<double, std::micro>(clock_t::now() - pushed).count());
+        }
+    });
+
+    for (size_t i = 0; i < rounds; ++i)
+    {
+        // queue is empty for a while, as after quiet period
+        std::this_thread::sleep_for(std::chrono::milliseconds(23));
+        queue.push(make_task(clock_t::now().time_since_epoch().count()));
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    stop = true;
+    queue.wakeAll();
+    consumer.join();
+
+    std::sort(latencies.begin(), latencies.end());
+    return std::make_pair(latencies[latencies.size() / 2], latencies[latencies.size() * 99 / 100]);
+}
+
+}   // namespace
+
+
+int main(int argc, char *argv[])
+{
+    libproperty::Options *opt = libproperty::Options::impl();
+    opt->add("help", "h", "print help and exit", false);
+    opt->add("tasks", "", "tasks of each throughput run", 1000000);
+    opt->add("rounds", "", "pushes into empty queue for wake up time", 200);
+
+    try
+    {
+        opt->parse(argc, argv);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        return -1;
+    }
+
+    if (opt->get<bool>("help"))
+    {
+        std::cout << opt->usage(argv[0]) << std::endl;
+        return 0;
+    }
+
+    size_t tasks = opt->get<int>("tasks");
+    printf("%20s %20s %20s\n", "producers/consumers", "lock_queue, tasks/s", "mpmc, tasks/s");
+    for (size_t threads : {1, 4})
+    {
+        double lock = throughput<LockQueue>(tasks, threads, threads);
+        double mpmc = throughput<LockFreeQueue>(tasks, threads, threads);
+        printf("%18zu/%zu %20.0f %20.0f\n", threads, threads, lock, mpmc);
+    }
+
+    size_t rounds = opt->get<int>("rounds");
+    auto lock = wake_up<LockQueue>(rounds);
+    auto mpmc = wake_up<LockFreeQueue>(rounds);
+    printf("wake up, us: lock_queue p50 %.0f p99 %.0f, mpmc p50 %.0f p99 %.0f\n",
+           lock.first, lock.second, mpmc.first, mpmc.second);
+    return 0;
+}
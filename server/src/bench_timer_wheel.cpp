@@ -0,0 +1,139 @@
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+#include "libproperty/src/libproperty.hpp"
+
+#include "bench.hpp"
+#include "common/timer_wheel.hpp"
+
+
+/*
+ * Operations of TimerWheel on many armed timers, as connection timers of io thread:
+ * schedule, re-arm of armed timer, cancel and expiry (wheel is advanced by hand,
+ * cascades of upper levels are included). Re-arm of asio steady_timer, as each
+ * connection did it with its own timer, is measured for comparison.
+ * Io service is never run, so wheel does not tick by itself.
+ */
+
+namespace
+{
+
+std::vector<TimerWheel::duration_t> random_delays(size_t count, size_t max_delay_sec, unsigned seed)
+{
+    std::mt19937 random(seed);
+    std::vector<TimerWheel::duration_t> delays(count);
+    for (auto &delay : delays)
+    {
+        delay = TimerWheel::duration_t(random() % (max_delay_sec * 1000) + 1);
+    }
+    return delays;
+}
+
+void measure_wheel(size_t count, size_t max_delay_sec)
+{
+    boost::asio::io_service io;
+    TimerWheel wheel(io);
+
+    size_t fired = 0;
+    std::unique_ptr<WheelTimer[]> timers(new WheelTimer[count]);
+    for (size_t i = 0; i < count; ++i)
+    {
+        timers[i].setCallback([&fired]() { ++fired; });
+    }
+
+    auto delays = random_delays(count, max_delay_sec, 1);
+    auto rearm_delays = random_delays(count, max_delay_sec, 2);
+
+    double schedule = bench::ns_per_op(count, [&](size_t i)
+    {
+        wheel.schedule(timers[i], delays[i], boost::shared_ptr<void>());
+    });
+
+    double rearm = bench::ns_per_op(count, [&](size_t i)
+    {
+        wheel.schedule(timers[i], rearm_delays[i], boost::shared_ptr<void>());
+    });
+
+    double cancel = bench::ns_per_op(count, [&](size_t i)
+    {
+        wheel.cancel(timers[i]);
+    });
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        wheel.schedule(timers[i], delays[i], boost::shared_ptr<void>());
+    }
+
+    uint64_t last_tick = wheel.currentTick() + max_delay_sec * 1000 / TimerWheel::tick().count() + 1;
+    bench::clock_t::time_point start = bench::clock_t::now();
+    wheel.advance(last_tick);
+    double expiry = std::chrono::duration<double, std::nano>(bench::clock_t::now() - start).count() / count;
+
+    printf("wheel:  schedule %.1f, re-arm %.1f, cancel %.1f, expiry %.1f Mops/s (%zu of %zu fired)\n",
+           bench::mops(schedule), bench::mops(rearm), bench::mops(cancel), bench::mops(expiry), fired, count);
+}
+
+void measure_asio(size_t count, size_t max_delay_sec)
+{
+    boost::asio::io_service io;
+    std::vector<std::unique_ptr<boost::asio::steady_timer>> timers;
+    timers.reserve(count);
+
+    auto delays = random_delays(count, max_delay_sec, 1);
+    auto rearm_delays = random_delays(count, max_delay_sec, 2);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        timers.emplace_back(new boost::asio::steady_timer(io));
+        timers[i]->expires_from_now(delays[i]);
+        timers[i]->async_wait([](const boost::system::error_code &) {});
+    }
+
+    // re-arm cancels pending wait, its handler is queued with operation_aborted
+    double rearm = bench::ns_per_op(count, [&](size_t i)
+    {
+        timers[i]->expires_from_now(rearm_delays[i]);
+        timers[i]->async_wait([](const boost::system::error_code &) {});
+    });
+
+    printf("asio:   re-arm %.1f Mops/s\n", bench::mops(rearm));
+}
+
+}   // namespace
+
+
+int main(int argc, char *argv[])
+{
+    libproperty::Options *opt = libproperty::Options::impl();
+    opt->add("help", "h", "print help and exit", false);
+    opt->add("timers", "", "count of armed timers", 1000000);
+    opt->add("max_delay_sec", "", "delays of timers are random up to it", 600);
+
+    try
+    {
+        opt->parse(argc, argv);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        return -1;
+    }
+
+    if (opt->get<bool>("help"))
+    {
+        std::cout << opt->usage(argv[0]) << std::endl;
+        return 0;
+    }
+
+    size_t count = opt->get<int>("timers");
+    size_t max_delay_sec = opt->get<int>("max_delay_sec");
+    measure_wheel(count, max_delay_sec);
+    measure_asio(count, max_delay_sec);
+    return 0;
+}
@@ -0,0 +1,150 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+#include <boost/make_shared.hpp>
+
+#include "libproperty/src/libproperty.hpp"
+
+#include "bench.hpp"
+#include "net/client.hpp"
+
+
+/*
+ * Handshakes per second of running server: full ones against resumed ones
+ * (session of previous connection is offered, it is taken from ticket or session cache).
+ * Client is limited to tls 1.2, where ticket comes within handshake: tls 1.3 ticket
+ * comes after it and needs request and response, result would depend on delayed acks then.
+ */
+
+namespace
+{
+
+struct Result
+{
+    std::atomic<size_t> connections{0};
+    std::atomic<size_t> reused{0};
+    std::atomic<size_t> failed{0};
+};
+
+// session: offered, if any, and replaced by session of this connection
+void connect_once(boost::asio::io_service &io, boost::asio::ssl::context &ctx,
+                  const boost::asio::ip::tcp::endpoint &endpoint, SSL_SESSION *&session, Result &result)
+{
+    auto socket = boost::make_shared<TcpClient>(io, ctx);
+    SSL *ssl = socket->ssl_stream().native_handle();
+    if (session)
+    {
+        SSL_set_session(ssl, session);
+    }
+
+    boost::system::error_code ec;
+    socket->lowestLayer().connect(endpoint, ec);
+    if (!ec)
+    {
+        socket->ssl_stream().handshake(boost::asio::ssl::stream_base::client, ec);
+    }
+    if (ec)
+    {
+        ++result.failed;
+        return;
+    }
+
+    ++result.connections;
+    if (SSL_session_reused(ssl))
+    {
+        ++result.reused;
+    }
+
+    if (session)
+    {
+        SSL_SESSION_free(session);
+        session = nullptr;
+    }
+    // connection is freed without shutdown, openssl marks its session as not resumable then,
+    // so copy is kept
+    session = SSL_SESSION_dup(SSL_get_session(ssl));
+}
+
+void run(const boost::asio::ip::tcp::endpoint &endpoint, size_t threads, bool resume, std::chrono::milliseconds duration)
+{
+    boost::asio::ssl::context ctx(boost::asio::ssl::context::sslv23_client);
+    SSL_CTX_set_max_proto_version(ctx.native_handle(), TLS1_2_VERSION);
+    Result result;
+    bench::clock_t::time_point deadline = bench::clock_t::now() + duration;
+
+    std::vector<std::thread> clients;
+    for (size_t i = 0; i < threads; ++i)
+    {
+        clients.emplace_back([&]()
+        {
+            // sockets are used synchronously, io service is never run
+            boost::asio::io_service io;
+            SSL_SESSION *session = nullptr;
+            while (bench::clock_t::now() < deadline)
+            {
+                connect_once(io, ctx, endpoint, session, result);
+                if (!resume && session)
+                {
+                    SSL_SESSION_free(session);
+                    session = nullptr;
+                }
+            }
+            SSL_SESSION_free(session);
+        });
+    }
+
+    for (auto &client : clients)
+    {
+        client.join();
+    }
+
+    printf("%8s: %6.0f connections/s, %zu reused, %zu failed\n", resume ? "resumed" : "full",
+           result.connections.load() * 1000.0 / duration.count(), result.reused.load(), result.failed.load());
+}
+
+}   // namespace
+
+
+int main(int argc, char *argv[])
+{
+    libproperty::Options *opt = libproperty::Options::impl();
+    opt->add("help", "h", "print help and exit", false);
+    opt->add("host", "", "host of server", "127.0.0.1");
+    opt->add("port", "p", "port of server", 7788);
+    opt->add("threads", "t", "count of connecting clients", 8);
+    opt->add("duration_ms", "", "time of each run, milliseconds", 5000);
+
+    try
+    {
+        opt->parse(argc, argv);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        return -1;
+    }
+
+    if (opt->get<bool>("help"))
+    {
+        std::cout << opt->usage(argv[0]) << std::endl;
+        return 0;
+    }
+
+    boost::asio::io_service resolver_io;
+    boost::asio::ip::tcp::resolver resolver(resolver_io);
+    boost::asio::ip::tcp::endpoint endpoint = *resolver.resolve(boost::asio::ip::tcp::resolver::query(
+        opt->get<std::string>("host"), std::to_string(opt->get<int>("port"))));
+
+    std::chrono::milliseconds duration(opt->get<int>("duration_ms"));
+    size_t threads = opt->get<int>("threads");
+    run(endpoint, threads, false, duration);
+    run(endpoint, threads, true, duration);
+    return 0;
+}
@@ -0,0 +1,115 @@
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "libproperty/src/libproperty.hpp"
+
+#include "bench.hpp"
+#include "database.hpp"
+
+
+/*
+ * Directory lookups of InMemoryConnection (by user id, by user name, by chat id)
+ * at growing count of users: time of lookup should not depend on it, besides cache misses.
+ * Scan of vector by name is the way lookups were done before indexes.
+ */
+
+namespace
+{
+
+std::string user_name(size_t i)
+{
+    return "user" + std::to_string(i);
+}
+
+const size_t SCANS = 100;
+
+void measure(InMemoryConnection &db, const std::vector<db::User> &all, size_t lookups)
+{
+    size_t users = all.size();
+
+    // ids are given by autoincrement from 1, in order of creation
+    std::mt19937_64 random(users);
+    std::vector<size_t> picks(lookups);
+    for (auto &pick : picks)
+    {
+        pick = random() % users;
+    }
+
+    double by_id = bench::ns_per_op(lookups, [&](size_t i)
+    {
+        bench::keep(db.lookupUserById(picks[i] + 1).id);
+    });
+
+    double by_name = bench::ns_per_op(lookups, [&](size_t i)
+    {
+        bench::keep(db.lookupUserByName(user_name(picks[i])).size());
+    });
+
+    double chat_by_id = bench::ns_per_op(lookups, [&](size_t i)
+    {
+        bench::keep(db.lookupChatById(picks[i] + 1).id);
+    });
+
+    double scan = bench::ns_per_op(SCANS, [&](size_t i)
+    {
+        std::string name = user_name(picks[i]);
+        for (const auto &user : all)
+        {
+            if (user.name == name)
+            {
+                bench::keep(user.id);
+                break;
+            }
+        }
+    });
+
+    printf("%10zu %12.0f %12.0f %12.0f %12.0f\n", users, by_id, by_name, chat_by_id, scan);
+}
+
+}   // namespace
+
+
+int main(int argc, char *argv[])
+{
+    libproperty::Options *opt = libproperty::Options::impl();
+    opt->add("help", "h", "print help and exit", false);
+    opt->add("max_users", "", "users are added up to this count (10M takes several GB)", 1000000);
+    opt->add("lookups", "", "lookups of each kind at each count of users", 1000000);
+
+    try
+    {
+        opt->parse(argc, argv);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        return -1;
+    }
+
+    if (opt->get<bool>("help"))
+    {
+        std::cout << opt->usage(argv[0]) << std::endl;
+        return 0;
+    }
+
+    size_t max_users = opt->get<int>("max_users");
+    size_t lookups = opt->get<int>("lookups");
+
+    InMemoryConnection db;
+    std::vector<db::User> all;
+    printf("%10s %12s %12s %12s %12s\n", "users", "by id, ns", "by name, ns", "chat id, ns", "scan, ns");
+
+    for (size_t target = 1000; target <= max_users; target *= 10)
+    {
+        while (all.size() < target)
+        {
+            all.push_back(db.createUser(user_name(all.size()), "password", ""));
+        }
+        measure(db, all, std::max(lookups, SCANS));
+    }
+    return 0;
+}
@@ -1,8 +1,13 @@
 #pragma once
 
+#include <array>
+#include <atomic>
 #include <string>
 #include <mutex>
+#include <memory>
 #include <vector>
+#include <shared_mutex>
+#include <unordered_map>
 #include <boost/shared_ptr.hpp>
 
 #include "request.hpp"
@@ -20,21 +25,6 @@ enum class type_t : uint8_t
     MYSQL
 };
 
-struct Task
-{
-    explicit Task() {}
-    Task(const RequestDetails &req) :
-        cmd(req.command),
-        request(req.params)
-    {}
-
-    bool ping = false;
-    common::cmd_t cmd;
-    RequestDetails::Params request;
-    boost::shared_ptr<ApiClient> client;
-    std::string storage;
-};
-
 // NB: see mysql/init.sql
 // TODO: need link chat_id and user_id, who created this chat.
 //       need possibility to create many chats with same name
@@ -64,6 +54,24 @@ struct User
     std::string stpath;         // storage path
 };
 
+struct Task
+{
+    explicit Task() {}
+    Task(const RequestDetails &req) :
+        cmd(req.command),
+        seq(req.seq),
+        request(req.params)
+    {}
+
+    bool ping = false;
+    common::cmd_t cmd;
+    uint64_t seq = 0;
+    RequestDetails::Params request;
+    User user;                          // of session: request is authenticated by token, password is not checked
+    boost::shared_ptr<ApiClient> client;
+    std::string storage;
+};
+
 // many to many link -> chats with users
 struct Chatuser
 {
@@ -101,6 +109,64 @@ struct Message
     std::string message;
 };
 
+/*
+ * Append-only log of one chat messages, ordered by timestamp.
+ * Messages are stored in fixed size segments, so appending never moves
+ * already stored messages, and range by timestamp is a binary search.
+ */
+class MessageLog
+{
+public:
+    void append(db::Message msg)
+    {
+        if (m_Size && msg.ts < at(m_Size - 1).ts)
+        {
+            // clock of another worker thread is a bit behind, keep log ordered
+            msg.ts = at(m_Size - 1).ts;
+        }
+
+        if (m_Size % SEGMENT_SIZE == 0)
+        {
+            m_Segments.emplace_back(new std::vector<db::Message>());
+            m_Segments.back()->reserve(SEGMENT_SIZE);
+        }
+        m_Segments.back()->push_back(std::move(msg));
+        ++m_Size;
+    }
+
+    size_t size() const { return m_Size; }
+
+    db::Message &at(size_t i) { return (*m_Segments[i / SEGMENT_SIZE])[i % SEGMENT_SIZE]; }
+    const db::Message &at(size_t i) const { return (*m_Segments[i / SEGMENT_SIZE])[i % SEGMENT_SIZE]; }
+
+    // position of the first message newer than ts
+    size_t upperBound(uint64_t ts) const
+    {
+        size_t first = 0;
+        size_t count = m_Size;
+        while (count > 0)
+        {
+            size_t step = count / 2;
+            if (at(first + step).ts <= ts)
+            {
+                first += step + 1;
+                count -= step + 1;
+            }
+            else
+            {
+                count = step;
+            }
+        }
+        return first;
+    }
+
+private:
+    static constexpr size_t SEGMENT_SIZE = 1024;
+
+    std::vector<std::unique_ptr<std::vector<db::Message>>> m_Segments;
+    size_t m_Size = 0;
+};
+
 }   // namespace db
 
 std::ostream& operator<<(std::ostream &os, const db::Message &msg);
@@ -112,6 +178,7 @@ public:
     virtual ~AbstractConnection() {}
 
     virtual void updateUserHeartBit(const db::User &user, uint64_t ts) = 0;
+    virtual void updateUserPassword(const db::User &user, const std::string &pass) = 0;
     virtual db::User createUser(const std::string &name, const std::string &pass, const std::string &stpath) = 0;
     virtual db::Chat createChat(const std::string &name, uint64_t uid) = 0;
 
@@ -126,7 +193,7 @@ public:
 
     virtual void saveMessage(const db::Message &msg) = 0;
     virtual std::vector<db::Message> getMessages(uint64_t chatid, const db::get_msg_opt_t &opt) const = 0;
-    virtual std::vector<db::Message> selectMessages(std::function<bool(const db::Message &)> &&pred, const db::get_msg_opt_t &opt) const = 0;
+    virtual std::vector<db::Message> selectMessages(uint64_t chatid, std::function<bool(const db::Message &)> &&pred, const db::get_msg_opt_t &opt) const = 0;
 
 protected:
 };
@@ -138,6 +205,7 @@ public:
     InMemoryConnection() {}
 
     void updateUserHeartBit(const db::User &user, uint64_t ts) override;
+    void updateUserPassword(const db::User &user, const std::string &pass) override;
     db::User createUser(const std::string &name, const std::string &pass, const std::string &stpath) override;
     db::Chat createChat(const std::string &name, uint64_t uid) override;
 
@@ -152,21 +220,58 @@ public:
 
     void saveMessage(const db::Message &msg) override;
     std::vector<db::Message> getMessages(uint64_t chatid, const db::get_msg_opt_t &opt) const override;
-    std::vector<db::Message> selectMessages(std::function<bool(const db::Message &)> &&pred, const db::get_msg_opt_t &opt) const override;
+    std::vector<db::Message> selectMessages(uint64_t chatid, std::function<bool(const db::Message &)> &&pred, const db::get_msg_opt_t &opt) const override;
 
 private:
+    /*
+     * Storage is split into shards, each one with own reader/writer lock.
+     * Users and chats are sharded by id, names index - by hash of name.
+     * Lock order: name shard could be held while locking one user or chat shard,
+     * user and chat shards are never locked together.
+     */
+    static constexpr size_t SHARDS = 64;
+
+    struct UserShard
+    {
+        mutable std::shared_timed_mutex mutex;
+        std::unordered_map<uint64_t, db::User> users;
+        std::unordered_map<uint64_t, std::vector<uint64_t>> chats;      // user id -> chats of user
+    };
+
+    struct ChatShard
+    {
+        mutable std::shared_timed_mutex mutex;
+        std::unordered_map<uint64_t, db::Chat> chats;
+        std::unordered_map<uint64_t, std::vector<uint64_t>> users;      // chat id -> users in chat
+        std::unordered_map<uint64_t, db::MessageLog> messages;          // chat id -> messages
+    };
+
+    struct NameShard
+    {
+        mutable std::shared_timed_mutex mutex;
+        std::unordered_map<std::string, uint64_t> users;                // user names are uniq
+        std::unordered_multimap<std::string, uint64_t> chats;           // self chat could have the same name as group
+    };
+
     struct Storage
     {
-        uint64_t user_autoincrement = 1;
-        uint64_t chat_autoincrement = 1;
+        std::atomic<uint64_t> user_autoincrement{1};
+        std::atomic<uint64_t> chat_autoincrement{1};
 
-        std::vector<db::Chat> chats;            // TODO: is better to use <set>, because id are uniq
-        std::vector<db::User> users;            // TODO: is better to use <set>
-        std::vector<db::Chatuser> chatuser;
-        std::vector<db::Message> messages;
+        std::array<UserShard, SHARDS> users;
+        std::array<ChatShard, SHARDS> chats;
+        std::array<NameShard, SHARDS> names;
     };
+
+private:
+    static UserShard &userShard(uint64_t uid) { return m_Storage.users[uid % SHARDS]; }
+    static ChatShard &chatShard(uint64_t chatid) { return m_Storage.chats[chatid % SHARDS]; }
+    static NameShard &nameShard(const std::string &name) { return m_Storage.names[std::hash<std::string>()(name) % SHARDS]; }
+
+    static void insertChat(const db::Chat &chat, uint64_t uid);
+
+private:
     static Storage m_Storage;
-    static std::mutex m_Mutex;
 };
 
 class MysqlConnection : public AbstractConnection
@@ -175,6 +280,7 @@ public:
     MysqlConnection() {}
 
     void updateUserHeartBit(const db::User &, uint64_t ) override {}
+    void updateUserPassword(const db::User &, const std::string &) override {}
     db::User createUser(const std::string &, const std::string &, const std::string &) override { return {}; }
     db::Chat createChat(const std::string &, uint64_t ) override { return {}; }
 
@@ -189,7 +295,7 @@ public:
 
     void saveMessage(const db::Message &) override {}
     std::vector<db::Message> getMessages(uint64_t, const db::get_msg_opt_t &) const override { return {}; }
-    std::vector<db::Message> selectMessages(std::function<bool(const db::Message &)> &&, const db::get_msg_opt_t &) const override { return {}; }
+    std::vector<db::Message> selectMessages(uint64_t, std::function<bool(const db::Message &)> &&, const db::get_msg_opt_t &) const override { return {}; }
 
 private:
 };
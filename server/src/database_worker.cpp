@@ -5,14 +5,22 @@
 #include "apiclient.hpp"
 #include "apiclient_utils.hpp"
 #include "database_worker.hpp"
+#include "password_hash.hpp"
 #include "common/common.hpp"
 
 
 extern std::atomic<bool> g_NeedStop;
 
 
-DatabaseWorker::DatabaseWorker(db::type_t type,  size_t workers) :
-    m_Workers(workers)
+DatabaseWorker::DatabaseWorker(db::type_t type,  size_t workers, size_t hash_workers, size_t hash_backlog,
+                               std::chrono::seconds session_ttl) :
+    m_Workers(workers),
+    m_Queue(65536),
+    m_HashWorkers(std::max<size_t>(hash_workers, 1)),
+    m_HashBacklog(std::max<size_t>(hash_backlog, 1)),
+    m_Hashing(0),
+    m_HashQueue(m_HashBacklog),
+    m_Sessions(session_ttl)
 {
     if (type == db::type_t::MEMORY)
     {
@@ -26,31 +34,84 @@ DatabaseWorker::DatabaseWorker(db::type_t type,  size_t workers) :
 
 void DatabaseWorker::putTask(db::Task &&task)
 {
-    m_Queue.push(std::move(task));
+    if (task.cmd == common::cmd_t::USER_CREATE || task.cmd == common::cmd_t::USER_LOGIN
+        || (task.user.id == 0 && !task.request.password.empty()))
+    {
+        putHashTask(std::move(task));
+        return;
+    }
+
+    // never block io thread, if queue is full
+    if (!m_Queue.tryPush(std::move(task)))
+    {
+        loge("database queue is full");
+        task.client->sendErrorResponse(task.seq, 503, common::ApiStatusCode::ERR_INTERNAL, "server is overloaded");
+    }
+}
+
+void DatabaseWorker::putHashTask(db::Task &&task)
+/*
+ *  kdf is slow on purpose: storm of logins waits in its own bounded queue,
+ *  above the limit client is asked to retry later
+ */
+{
+    if (++m_Hashing > m_HashBacklog || !m_HashQueue.tryPush(std::move(task)))
+    {
+        --m_Hashing;
+        loge("password hashing queue is full");
+        task.client->sendErrorResponse(task.seq, 429, common::ApiStatusCode::ERR_INTERNAL, "too many logins, try later");
+    }
 }
 
 namespace
 {
 
+bool check_pass(const db::Task &task, const db::User &user, AbstractConnection *conn)
+/*
+ *  hashing threads only; record of crc32 times is replaced by kdf one, when password is known
+ */
+{
+    bool rehash = false;
+    if (!password_hash::verify(task.request.password, user.password, rehash))
+    {
+        task.client->sendErrorResponse(task.seq, 403, common::ApiStatusCode::ERR_CONSTRAINT, "wrong password");
+        return false;
+    }
+
+    if (rehash)
+    {
+        std::string record = password_hash::make(task.request.password);
+        if (!record.empty())
+        {
+            conn->updateUserPassword(user, record);
+        }
+    }
+    return true;
+}
+
 db::User lookup_check_pass(const db::Task &task, AbstractConnection *conn)
 {
+    if (task.user.id != 0)
+    {
+        // token of session is checked on io thread
+        return task.user;
+    }
+
     db::User user = conn->lookupUserById(task.request.uid);
     if (user.id == 0)
     {
-        task.client->sendErrorResponse(409, common::ApiStatusCode::ERR_CONSTRAINT, "user does not exist");
+        task.client->sendErrorResponse(task.seq, 409, common::ApiStatusCode::ERR_CONSTRAINT, "user does not exist");
         return {};
     }
 
-    std::string encrypted_pass = std::to_string(utils::crc32(task.request.password));
-    if (encrypted_pass != user.password)
+    if (!check_pass(task, user, conn))
     {
-        task.client->sendErrorResponse(403, common::ApiStatusCode::ERR_CONSTRAINT, "wrong password");
         return {};
     }
     return user;
 }
 
-db::User lookup_check_pass_by_name(const std::string &name, const db::Task &task, AbstractConnection *conn, bool check_pass)
+db::User lookup_check_pass_by_name(const std::string &name, const db::Task &task, AbstractConnection *conn, bool need_pass)
 {
     std::vector<db::User> users = conn->lookupUserByName(name);
     if (users.size() != 1)
@@ -58,23 +119,18 @@ db::User lookup_check_pass_by_name(const std::string &name, const db::Task &task
         if (users.empty())
         {
             // 401 ?
-            task.client->sendErrorResponse(404, common::ApiStatusCode::ERR_NOT_FOUND, "user does not exist");
+            task.client->sendErrorResponse(task.seq, 404, common::ApiStatusCode::ERR_NOT_FOUND, "user does not exist");
             return {};
         }
-        task.client->sendErrorResponse(500, common::ApiStatusCode::ERR_INTERNAL, "more than one user with that name");
+        task.client->sendErrorResponse(task.seq, 500, common::ApiStatusCode::ERR_INTERNAL, "more than one user with that name");
         return {};
     }
 
     const db::User &user = users[0];
 
-    if (check_pass)
+    if (need_pass && !check_pass(task, user, conn))
     {
-        std::string encrypted_pass = std::to_string(utils::crc32(task.request.password));
-        if (encrypted_pass != user.password)
-        {
-            task.client->sendErrorResponse(403, common::ApiStatusCode::ERR_CONSTRAINT, "wrong password");
-            return {};
-        }
+        return {};
     }
     
     return user;
@@ -144,236 +200,299 @@ void DatabaseWorker::processQueue()
     while (!g_NeedStop)
     {
         db::Task task;
-        if (!m_Queue.getTask(task))
+        if (!m_Queue.pop(task, std::chrono::milliseconds(1000)))
         {
-            std::this_thread::sleep_for(std::chrono::milliseconds(10));
             continue;
         }
+        processTask(task, conn.get());
+    }
+}
 
-        if (task.cmd == common::cmd_t::IDLE)
-        {
-            db::User user = lookup_check_pass(task, conn.get());
-            if (user.id == 0)
-            {
-                continue;
-            }
+void DatabaseWorker::processHashQueue()
+/*
+ *  tasks, which check or make password hash: kdf does not stall other commands
+ */
+{
+    std::unique_ptr<AbstractConnection> conn = m_Db->getConnection();
 
-            conn->updateUserHeartBit(user, time(NULL));
+    while (!g_NeedStop)
+    {
+        db::Task task;
+        if (!m_HashQueue.pop(task, std::chrono::milliseconds(1000)))
+        {
+            continue;
+        }
+        processTask(task, conn.get());
+        --m_Hashing;
+    }
+}
 
-            std::vector<std::vector<db::Message>> msgs_batch;
+void DatabaseWorker::processTask(db::Task &task, AbstractConnection *conn)
+{
+    if (task.cmd == common::cmd_t::IDLE)
+    {
+        db::User user = lookup_check_pass(task, conn);
+        if (user.id == 0)
+        {
+            return;
+        }
 
-            std::vector<db::Chat> chats = conn->lookupChatsForUserId(user.id);
-            for (const auto &chat : chats)
-            {
-                // TODO: it does not see messages sored in one second!
-                //       need flags: read/unread e.t.c.
-
-                db::get_msg_opt_t opt;
-                opt.ts = task.request.ts;
-                //opt.only_unread = true;
-                std::vector<db::Message> msgs = conn->getMessages(chat.id, opt);
-                if (!msgs.empty())
-                {
-                    msgs_batch.emplace_back(msgs);
-                }
-            }
+        conn->updateUserHeartBit(user, time(NULL));
 
-            if (!msgs_batch.empty())
-            {
-                std::vector<apiclient_utils::Message> api_msgs = to_api_format(std::move(msgs_batch), conn.get());
-                task.client->sendMessagesToIdleConn(std::move(api_msgs));
-                continue;
-            }
+        // subscribe before reading history: message saved in between
+        // could come twice, but never will be lost
+        std::vector<db::Chat> chats = conn->lookupChatsForUserId(user.id);
+        m_PubSub.subscribe(user.id, chats, task.client);
 
-            if (task.ping)
-            {
-                task.client->sendMessagesToIdleConn({});
-            }
-        }
-        else if (task.cmd == common::cmd_t::USER_STATUS)
+        std::vector<std::vector<db::Message>> msgs_batch;
+        for (const auto &chat : chats)
         {
-            db::User user = lookup_check_pass(task, conn.get());
-            if (user.id == 0)
-            {
-                continue;
-            }
+            // TODO: it does not see messages sored in one second!
+            //       need flags: read/unread e.t.c.
 
-            db::User user_to = lookup_check_pass_by_name(task.request.user, task, conn.get(), false);
-            if (user_to.id == 0)
+            db::get_msg_opt_t opt;
+            opt.ts = task.request.ts;
+            //opt.only_unread = true;
+            std::vector<db::Message> msgs = conn->getMessages(chat.id, opt);
+            if (!msgs.empty())
             {
-                continue;
+                msgs_batch.emplace_back(msgs);
             }
+        }
 
-            std::string body = apiclient_utils::build_api_ok_response_body(user_to);
-            task.client->sendOkResponse(body);
+        if (!msgs_batch.empty())
+        {
+            std::vector<apiclient_utils::Message> api_msgs = to_api_format(std::move(msgs_batch), conn);
+            task.client->pushMessages(std::move(api_msgs));
         }
-        else if (task.cmd == common::cmd_t::USER_HISTORY)
+    }
+    else if (task.cmd == common::cmd_t::USER_STATUS)
+    {
+        db::User user = lookup_check_pass(task, conn);
+        if (user.id == 0)
         {
-            db::User user_from = lookup_check_pass(task, conn.get());
-            if (user_from.id == 0)
-            {
-                continue;
-            }
-
-            db::User user_to = lookup_check_pass_by_name(task.request.user, task, conn.get(), false);
-            if (user_to.id == 0)
-            {
-                continue;
-            }
-
-            auto f1 = [&user_from, &user_to](const db::Message &msg) -> bool
-            {
-                if (msg.user_from == user_from.id && msg.chat_to == user_to.self_chat_id)
-                {
-                    return true;
-                }
-                return false;
-            };
-            
-            db::get_msg_opt_t opt;
-            opt.max_count = task.request.count * 2; // dirty hack :)
-            std::vector<db::Message> msgs_to = conn->selectMessages(std::move(f1), opt);
-
-            auto f2 = [&user_from, &user_to](const db::Message &msg) -> bool
-            {
-                if (msg.user_from == user_to.id && msg.chat_to == user_from.self_chat_id)
-                {
-                    return true;
-                }
-                return false;
-            };
-            std::vector<db::Message> msgs_from = conn->selectMessages(std::move(f2), opt);
-
-            std::vector<db::Message> mix = mix_from_and_to_messages(std::move(msgs_from), std::move(msgs_to), task.request.count);
-            std::vector<apiclient_utils::Message> api_msgs = to_api_format(std::move(mix), conn.get());
-            task.client->sendMessages(std::move(api_msgs));
+            return;
         }
-        else if (task.cmd == common::cmd_t::MESSAGE_SEND)
+
+        db::User user_to = lookup_check_pass_by_name(task.request.user, task, conn, false);
+        if (user_to.id == 0)
         {
-            db::User user = lookup_check_pass(task, conn.get());
-            if (user.id == 0)
-            {
-                continue;
-            }
+            return;
+        }
 
-            std::vector<db::User> users_to = conn->lookupUserByName(task.request.to_user);
-            if (users_to.size() != 1)
-            {
-                if (users_to.empty())
-                {
-                    task.client->sendErrorResponse(404, common::ApiStatusCode::ERR_NOT_FOUND, "user to does not exist");
-                    continue;
-                }
-                task.client->sendErrorResponse(500, common::ApiStatusCode::ERR_INTERNAL, "more than one user with that name");
-                continue;
-            }
+        user_to.heartbit = std::max(user_to.heartbit, m_PubSub.heartbit(user_to.id));
 
-            const db::User &user_to = users_to[0];
-            db::Message msg(/*from*/user.id, /*to*/user_to.self_chat_id, task.request.message);
+        task.client->sendOkResponse(task.seq, apiclient_utils::build_api_ok_response_body(user_to));
+    }
+    else if (task.cmd == common::cmd_t::USER_HISTORY)
+    {
+        db::User user_from = lookup_check_pass(task, conn);
+        if (user_from.id == 0)
+        {
+            return;
+        }
 
-            // TODO: need milliseconds!
-            msg.ts = time(NULL);
-            conn->saveMessage(msg);
-            task.client->sendOkResponse("{\"status\": 0}");
+        db::User user_to = lookup_check_pass_by_name(task.request.user, task, conn, false);
+        if (user_to.id == 0)
+        {
+            return;
         }
-        else if (task.cmd == common::cmd_t::USER_CREATE)
+
+        auto f1 = [&user_from, &user_to](const db::Message &msg) -> bool
         {
-            std::string encrypted_pass = std::to_string(utils::crc32(task.request.password));
-            db::User user = conn->createUser(task.request.user, encrypted_pass, task.storage);
-            if (user.id == 0)
+            if (msg.user_from == user_from.id && msg.chat_to == user_to.self_chat_id)
             {
-                task.client->sendErrorResponse(409, common::ApiStatusCode::ERR_CONSTRAINT, "user already exists");
-                continue;
+                return true;
             }
-            std::string body = apiclient_utils::build_api_ok_response_body(user);
-            task.client->sendOkResponse(body);
-        }
-        else if (task.cmd == common::cmd_t::USER_LOGIN)
+            return false;
+        };
+        
+        db::get_msg_opt_t opt;
+        opt.max_count = task.request.count * 2; // dirty hack :)
+        std::vector<db::Message> msgs_to = conn->selectMessages(user_to.self_chat_id, std::move(f1), opt);
+
+        auto f2 = [&user_from, &user_to](const db::Message &msg) -> bool
         {
-            db::User user = lookup_check_pass_by_name(task.request.user, task, conn.get(), true);
-            if (user.id == 0)
+            if (msg.user_from == user_to.id && msg.chat_to == user_from.self_chat_id)
             {
-                continue;
+                return true;
             }
+            return false;
+        };
+        std::vector<db::Message> msgs_from = conn->selectMessages(user_from.self_chat_id, std::move(f2), opt);
 
-            std::string body = apiclient_utils::build_api_ok_response_body(user);
-            task.client->sendOkResponse(body);
+        std::vector<db::Message> mix = mix_from_and_to_messages(std::move(msgs_from), std::move(msgs_to), task.request.count);
+        std::vector<apiclient_utils::Message> api_msgs = to_api_format(std::move(mix), conn);
+        task.client->sendMessages(task.seq, std::move(api_msgs));
+    }
+    else if (task.cmd == common::cmd_t::MESSAGE_SEND)
+    {
+        db::User user = lookup_check_pass(task, conn);
+        if (user.id == 0)
+        {
+            return;
         }
-        else if (task.cmd == common::cmd_t::CHAT_CREATE)
+
+        std::vector<db::User> users_to = conn->lookupUserByName(task.request.to_user);
+        if (users_to.size() != 1)
         {
-            db::User user = lookup_check_pass(task, conn.get());
-            if (user.id == 0)
+            if (users_to.empty())
             {
-                continue;
+                task.client->sendErrorResponse(task.seq, 404, common::ApiStatusCode::ERR_NOT_FOUND, "user to does not exist");
+                return;
             }
+            task.client->sendErrorResponse(task.seq, 500, common::ApiStatusCode::ERR_INTERNAL, "more than one user with that name");
+            return;
+        }
 
-            db::Chat chat = conn->createChat(task.request.chat.name, task.request.uid);
-            if (chat.id == 0)
-            {
-                task.client->sendErrorResponse(409, common::ApiStatusCode::ERR_CONSTRAINT, "chat already exists");
-                continue;
-            }
+        const db::User &user_to = users_to[0];
+        db::Message msg(/*from*/user.id, /*to*/user_to.self_chat_id, task.request.message);
 
-            std::string body = apiclient_utils::build_api_ok_response_body(chat);
-            task.client->sendOkResponse(body);
+        // TODO: need milliseconds!
+        msg.ts = time(NULL);
+        conn->saveMessage(msg);
+        publish(msg, conn);
+        task.client->sendOkResponse(task.seq, "{\"status\": 0}");
+    }
+    else if (task.cmd == common::cmd_t::USER_CREATE)
+    {
+        // name is checked before kdf, it is not spent on user, which would not be created
+        if (!conn->lookupUserByName(task.request.user).empty())
+        {
+            task.client->sendErrorResponse(task.seq, 409, common::ApiStatusCode::ERR_CONSTRAINT, "user already exists");
+            return;
         }
-        else if (task.cmd == common::cmd_t::CHAT_ADDUSER)
+
+        std::string record = password_hash::make(task.request.password);
+        if (record.empty())
         {
-            db::User user = lookup_check_pass(task, conn.get());
-            if (user.id == 0)
-            {
-                continue;
-            }
+            task.client->sendErrorResponse(task.seq, 500, common::ApiStatusCode::ERR_INTERNAL, "password is not hashed");
+            return;
+        }
 
-            db::User to_add = lookup_check_pass_by_name(task.request.chat.adduser, task, conn.get(), false);
-            if (to_add.id == 0)
-            {
-                continue;
-            }
+        db::User user = conn->createUser(task.request.user, record, task.storage);
+        if (user.id == 0)
+        {
+            task.client->sendErrorResponse(task.seq, 409, common::ApiStatusCode::ERR_CONSTRAINT, "user already exists");
+            return;
+        }
+        task.client->sendOkResponse(task.seq, apiclient_utils::build_api_ok_response_body(user));
+    }
+    else if (task.cmd == common::cmd_t::USER_LOGIN)
+    {
+        db::User user = lookup_check_pass_by_name(task.request.user, task, conn, true);
+        if (user.id == 0)
+        {
+            return;
+        }
 
-            std::vector<db::Chat> chats = conn->lookupChatByName(task.request.chat.name);
-            if (chats.size() != 1)
-            {
-                task.client->sendErrorResponse(404, common::ApiStatusCode::ERR_NOT_FOUND, "chat does not exist");
-                continue;
-            }
+        // heartbit is not stored while user is idle, see PubSub
+        user.heartbit = std::max(user.heartbit, m_PubSub.heartbit(user.id));
+
+        // password is checked once: next requests of user carry token of session
+        std::string token = m_Sessions.issue(user);
+        task.client->sendOkResponse(task.seq, apiclient_utils::build_api_ok_response_body(user, token));
+    }
+    else if (task.cmd == common::cmd_t::CHAT_CREATE)
+    {
+        db::User user = lookup_check_pass(task, conn);
+        if (user.id == 0)
+        {
+            return;
+        }
 
-            conn->addUserToChat(chats[0], to_add);
+        db::Chat chat = conn->createChat(task.request.chat.name, task.request.uid);
+        if (chat.id == 0)
+        {
+            task.client->sendErrorResponse(task.seq, 409, common::ApiStatusCode::ERR_CONSTRAINT, "chat already exists");
+            return;
+        }
+        m_PubSub.joinChat(chat.id, user.id);
 
-            std::string body = apiclient_utils::build_api_ok_response_body(chats[0]);
-            task.client->sendOkResponse("{\"status\": 0}");
+        task.client->sendOkResponse(task.seq, apiclient_utils::build_api_ok_response_body(chat));
+    }
+    else if (task.cmd == common::cmd_t::CHAT_ADDUSER)
+    {
+        db::User user = lookup_check_pass(task, conn);
+        if (user.id == 0)
+        {
+            return;
         }
-        else if (task.cmd == common::cmd_t::MESSAGE_SEND_CHAT)
+
+        db::User to_add = lookup_check_pass_by_name(task.request.chat.adduser, task, conn, false);
+        if (to_add.id == 0)
         {
-            db::User user = lookup_check_pass(task, conn.get());
-            if (user.id == 0)
-            {
-                continue;
-            }
+            return;
+        }
 
-            std::vector<db::Chat> chats = conn->lookupChatByName(task.request.chat.name);
-            if (chats.size() != 1)
-            {
-                task.client->sendErrorResponse(404, common::ApiStatusCode::ERR_NOT_FOUND, "chat does not exist");
-                continue;
-            }
+        std::vector<db::Chat> chats = conn->lookupChatByName(task.request.chat.name);
+        if (chats.size() != 1)
+        {
+            task.client->sendErrorResponse(task.seq, 404, common::ApiStatusCode::ERR_NOT_FOUND, "chat does not exist");
+            return;
+        }
 
-            db::Message msg(/*from*/user.id, /*to*/chats[0].id, task.request.message);
-            msg.ts = time(NULL);
-            conn->saveMessage(msg);
+        conn->addUserToChat(chats[0], to_add);
+        m_PubSub.joinChat(chats[0].id, to_add.id);
 
-            task.client->sendOkResponse("{\"status\": 0}");
+        task.client->sendOkResponse(task.seq, "{\"status\": 0}");
+    }
+    else if (task.cmd == common::cmd_t::MESSAGE_SEND_CHAT)
+    {
+        db::User user = lookup_check_pass(task, conn);
+        if (user.id == 0)
+        {
+            return;
+        }
+
+        std::vector<db::Chat> chats = conn->lookupChatByName(task.request.chat.name);
+        if (chats.size() != 1)
+        {
+            task.client->sendErrorResponse(task.seq, 404, common::ApiStatusCode::ERR_NOT_FOUND, "chat does not exist");
+            return;
         }
+
+        db::Message msg(/*from*/user.id, /*to*/chats[0].id, task.request.message);
+        msg.ts = time(NULL);
+        conn->saveMessage(msg);
+        publish(msg, conn);
+
+        task.client->sendOkResponse(task.seq, "{\"status\": 0}");
     }
 }
 
 
+void DatabaseWorker::publish(const db::Message &msg, AbstractConnection *conn)
+{
+    std::vector<boost::shared_ptr<ApiClient>> clients = m_PubSub.subscribers(msg.chat_to);
+    if (clients.empty())
+    {
+        return;
+    }
+
+    std::vector<apiclient_utils::Message> api_msgs = to_api_format(std::vector<db::Message>{msg}, conn);
+    for (const auto &client : clients)
+    {
+        client->pushMessages(api_msgs);
+    }
+}
+
 void DatabaseWorker::run()
 {
     for (size_t i = 0; i < m_Workers; ++i)
     {
         m_Threads.push_back(std::thread(std::bind(&DatabaseWorker::processQueue, this)));
     }
+    for (size_t i = 0; i < m_HashWorkers; ++i)
+    {
+        m_HashThreads.push_back(std::thread(std::bind(&DatabaseWorker::processHashQueue, this)));
+    }
+}
+
+void DatabaseWorker::stop()
+{
+    m_Queue.wakeAll();
+    m_HashQueue.wakeAll();
 }
 
 void DatabaseWorker::join()
@@ -382,5 +501,9 @@ void DatabaseWorker::join()
     {
         thread.join();
     }
+    for (auto &thread : m_HashThreads)
+    {
+        thread.join();
+    }
 }
 
@@ -1,25 +1,48 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
 #include <thread>
 
+#include "auth_sessions.hpp"
 #include "database.hpp"
-#include "common/lock_queue.hpp"
+#include "pubsub.hpp"
+#include "common/mpmc_queue.hpp"
 
 
 class DatabaseWorker
 {
 public:
-    DatabaseWorker(db::type_t type,  size_t workers);
+    DatabaseWorker(db::type_t type,  size_t workers, size_t hash_workers, size_t hash_backlog,
+                   std::chrono::seconds session_ttl);
     void putTask(db::Task &&task);
     void run();
+    void stop();
     void join();
 
+    PubSub &pubsub() { return m_PubSub; }
+    AuthSessions &sessions() { return m_Sessions; }
+
 private:
+    void putHashTask(db::Task &&task);
     void processQueue();
+    void processHashQueue();
+    void processTask(db::Task &task, AbstractConnection *conn);
+    void publish(const db::Message &msg, AbstractConnection *conn);
 
 private:
     size_t m_Workers;
-    Queue<db::Task> m_Queue;
+    MpmcQueue<db::Task> m_Queue;
     std::unique_ptr<AbstractDatabase> m_Db;
     std::vector<std::thread> m_Threads;
+
+    // create, login and requests with password: kdf is run by own threads
+    size_t m_HashWorkers;
+    size_t m_HashBacklog;
+    std::atomic<size_t> m_Hashing;          // tasks in queue and in progress
+    MpmcQueue<db::Task> m_HashQueue;
+    std::vector<std::thread> m_HashThreads;
+
+    PubSub m_PubSub;
+    AuthSessions m_Sessions;
 };
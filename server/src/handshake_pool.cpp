@@ -0,0 +1,61 @@
+#include "handshake_pool.hpp"
+
+
+HandshakePool::HandshakePool(size_t threads, size_t backlog) :
+    m_Backlog(backlog),
+    m_InProgress(0),
+    m_Next(0)
+{
+    for (size_t i = 0; i < threads; ++i)
+    {
+        m_Threads.push_back(std::make_unique<IoThread>());
+    }
+}
+
+void HandshakePool::start()
+{
+    for (const auto &thread : m_Threads)
+    {
+        thread->start();
+    }
+}
+
+void HandshakePool::stop()
+{
+    for (const auto &thread : m_Threads)
+    {
+        thread->stop();
+    }
+}
+
+void HandshakePool::join()
+{
+    for (const auto &thread : m_Threads)
+    {
+        thread->join();
+    }
+}
+
+bool HandshakePool::tryAdmit()
+{
+    if (++m_InProgress > m_Backlog)
+    {
+        --m_InProgress;
+        return false;
+    }
+    return true;
+}
+
+void HandshakePool::release()
+{
+    --m_InProgress;
+}
+
+boost::asio::io_service *HandshakePool::pickIo()
+{
+    if (m_Threads.empty())
+    {
+        return nullptr;
+    }
+    return &m_Threads[m_Next++ % m_Threads.size()]->ioService();
+}
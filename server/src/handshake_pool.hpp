@@ -0,0 +1,113 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include <boost/asio/io_service.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/version.hpp>
+
+#include "common/io_thread.hpp"
+
+
+/*
+ * Threads for tls handshakes, so rsa/ecdhe math of a reconnect storm
+ * does not stall io threads with established connections.
+ *
+ * Socket stays registered in reactor of its data io thread, but every step of
+ * handshake (SSL_do_handshake after socket read or write) is executed here:
+ * asio calls intermediate handlers through asio_handler_invoke of the completion
+ * handler (associated executor since boost 1.66), and HandshakeHandler moves
+ * them into handshake thread, as strand::wrap does.
+ */
+class HandshakePool: private boost::noncopyable
+{
+public:
+    template<class Handler>
+    class HandshakeHandler
+    {
+    public:
+        HandshakeHandler(boost::asio::io_service &io, Handler handler) :
+            m_Io(&io),
+            m_Handler(std::move(handler))
+        {
+        }
+
+        template<class... Args>
+        void operator()(Args&&... args)
+        {
+            m_Handler(std::forward<Args>(args)...);
+        }
+
+        boost::asio::io_service &ioService() const { return *m_Io; }
+
+#if BOOST_VERSION < 106600
+        // NB: function is posted inside lambda, otherwise this hook would be called for it again
+        template<class Function>
+        friend void asio_handler_invoke(Function &function, HandshakeHandler *self)
+        {
+            self->m_Io->post([function]() mutable { function(); });
+        }
+
+        template<class Function>
+        friend void asio_handler_invoke(const Function &function, HandshakeHandler *self)
+        {
+            self->m_Io->post([function]() mutable { function(); });
+        }
+#endif
+
+    private:
+        boost::asio::io_service *m_Io;
+        Handler m_Handler;
+    };
+
+public:
+    HandshakePool(size_t threads, size_t backlog);
+
+    void start();
+    void stop();
+    void join();
+
+    // false - too many handshakes are in progress, connection should be rejected
+    bool tryAdmit();
+    void release();
+
+    // nullptr if pool is empty: handshake is done on data io thread
+    boost::asio::io_service *pickIo();
+
+    template<class Handler>
+    static HandshakeHandler<Handler> wrap(boost::asio::io_service &io, Handler handler)
+    {
+        return HandshakeHandler<Handler>(io, std::move(handler));
+    }
+
+private:
+    size_t m_Backlog;
+    std::atomic<size_t> m_InProgress;
+    std::atomic<size_t> m_Next;
+
+    std::vector<std::unique_ptr<IoThread>> m_Threads;
+};
+
+
+#if BOOST_VERSION >= 106600
+namespace boost
+{
+namespace asio
+{
+
+template<class Handler, class Executor>
+struct associated_executor<HandshakePool::HandshakeHandler<Handler>, Executor>
+{
+    typedef io_service::executor_type type;
+
+    static type get(const HandshakePool::HandshakeHandler<Handler> &handler, const Executor & = Executor())
+    {
+        return handler.ioService().get_executor();
+    }
+};
+
+}   // namespace asio
+}   // namespace boost
+#endif
@@ -0,0 +1,259 @@
+#include <sys/resource.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+#include <boost/make_shared.hpp>
+
+#include "rapidjson/document.h"
+
+#include "libproperty/src/libproperty.hpp"
+#include "net/client.hpp"
+
+
+/*
+ * Memory of idle connections of running server: opens `connections` tls connections,
+ * each one sends /v1/idle and stays quiet, then RSS of server (`pid`) is measured
+ * after hibernation (`wait_sec` should be above hibernate_sec of server).
+ * Exit code is not zero, if memory per connection is above `target_kb`.
+ *
+ * Both server and test need open files limit above count of connections,
+ * test raises its soft limit up to the hard one.
+ */
+
+namespace
+{
+
+struct Response
+{
+    int status = 0;
+    std::string body;
+};
+
+// VmRSS of process, KB; 0 - there is no such process
+size_t rss_kb(int pid)
+{
+    FILE *status = fopen(("/proc/" + std::to_string(pid) + "/status").c_str(), "r");
+    if (!status)
+    {
+        return 0;
+    }
+
+    size_t rss = 0;
+    char line[256];
+    while (fgets(line, sizeof(line), status))
+    {
+        if (sscanf(line, "VmRSS: %zu kB", &rss) == 1)
+        {
+            break;
+        }
+    }
+    fclose(status);
+    return rss;
+}
+
+void raise_files_limit()
+{
+    rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0)
+    {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+class IdleConnections
+{
+public:
+    IdleConnections(const std::string &host, int port) :
+        m_Context(boost::asio::ssl::context::sslv23_client)
+    {
+        // this side should not take much memory too
+        SSL_CTX_set_mode(m_Context.native_handle(), SSL_MODE_RELEASE_BUFFERS);
+
+        boost::asio::ip::tcp::resolver resolver(m_Io);
+        m_Endpoint = *resolver.resolve(boost::asio::ip::tcp::resolver::query(host, std::to_string(port)));
+    }
+
+    // false - user could not log in
+    bool login(const std::string &user, const std::string &password)
+    {
+        boost::shared_ptr<TcpClient> socket = connect();
+        std::string credentials = "{\"user\":\"" + user + "\",\"password\":\"" + password + "\"}";
+
+        // user is created by the first run
+        request(*socket, "/v1/user/create", credentials);
+        Response response = request(*socket, "/v1/user/login", credentials);
+
+        rapidjson::Document json;
+        json.Parse(response.body.c_str());
+        if (response.status != 200 || !json.IsObject() || !json.HasMember("id") || !json.HasMember("token"))
+        {
+            std::cerr << "login failed: " << response.status << " " << response.body << std::endl;
+            return false;
+        }
+
+        m_Idle = "{\"uid\":" + std::to_string(json["id"].GetUint64())
+                 + ",\"token\":\"" + json["token"].GetString() + "\"}";
+        return true;
+    }
+
+    // false - connection is not opened or idle request failed
+    bool open()
+    {
+        boost::shared_ptr<TcpClient> socket = connect();
+        Response response = request(*socket, "/v1/idle", m_Idle, false);
+        if (response.status != 200)
+        {
+            std::cerr << "idle failed: " << response.status << std::endl;
+            return false;
+        }
+
+        m_Connections.push_back(socket);
+        return true;
+    }
+
+    size_t count() const { return m_Connections.size(); }
+
+private:
+    boost::shared_ptr<TcpClient> connect()
+    {
+        // sockets are used synchronously, io service is never run
+        auto socket = boost::make_shared<TcpClient>(m_Io, m_Context);
+        socket->lowestLayer().connect(m_Endpoint);
+        socket->ssl_stream().handshake(boost::asio::ssl::stream_base::client);
+        return socket;
+    }
+
+    // with_body: body of idle response is not needed, pings and pushes follow it
+    Response request(TcpClient &socket, const std::string &resource, const std::string &body, bool with_body = true)
+    {
+        socket.write("POST " + resource + " HTTP/1.1\r\n"
+                     "Host: localhost\r\n"
+                     "Content-Type: application/json\r\n"
+                     "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                     "\r\n" + body);
+
+        boost::asio::streambuf buffer;
+        size_t head_size = boost::asio::read_until(socket.ssl_stream(), buffer, "\r\n\r\n");
+
+        std::string head(boost::asio::buffers_begin(buffer.data()), boost::asio::buffers_begin(buffer.data()) + head_size);
+        buffer.consume(head_size);
+
+        Response response;
+        sscanf(head.c_str(), "HTTP/1.1 %d", &response.status);
+
+        const char content_length[] = "Content-Length:";
+        size_t pos = head.find(content_length);
+        if (with_body && pos != std::string::npos)
+        {
+            size_t length = std::stoul(head.substr(pos + sizeof(content_length) - 1));
+            if (buffer.size() < length)
+            {
+                boost::asio::read(socket.ssl_stream(), buffer, boost::asio::transfer_exactly(length - buffer.size()));
+            }
+            response.body.assign(boost::asio::buffers_begin(buffer.data()), boost::asio::buffers_begin(buffer.data()) + length);
+        }
+        return response;
+    }
+
+private:
+    boost::asio::io_service m_Io;
+    boost::asio::ssl::context m_Context;
+    boost::asio::ip::tcp::endpoint m_Endpoint;
+    std::string m_Idle;                 // body of idle request
+    std::vector<boost::shared_ptr<TcpClient>> m_Connections;
+};
+
+}   // namespace
+
+
+int main(int argc, char *argv[])
+{
+    libproperty::Options *opt = libproperty::Options::impl();
+    opt->add("help", "h", "print help and exit", false);
+    opt->add("host", "", "host of server", "127.0.0.1");
+    opt->add("port", "p", "port of server", 7788);
+    opt->add("pid", "", "pid of server, its RSS is measured", 0);
+    opt->add("connections", "c", "count of idle connections", 100000);
+    opt->add("wait_sec", "", "wait for hibernation after all connections are opened, seconds", 40);
+    opt->add("target_kb", "", "max memory of server per idle connection, KB", 60);
+    opt->add("user", "u", "user of idle connections, it is created if needed", "idle_rss_test");
+    opt->add("password", "", "password of user", "idle_rss_test");
+
+    try
+    {
+        opt->parse(argc, argv);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        return -1;
+    }
+
+    if (opt->get<bool>("help"))
+    {
+        std::cout << opt->usage(argv[0]) << std::endl;
+        return 0;
+    }
+
+    int pid = opt->get<int>("pid");
+    if (rss_kb(pid) == 0)
+    {
+        std::cerr << "no server with pid " << pid << std::endl;
+        return -1;
+    }
+
+    raise_files_limit();
+
+    try
+    {
+        IdleConnections idle(opt->get<std::string>("host"), opt->get<int>("port"));
+        if (!idle.login(opt->get<std::string>("user"), opt->get<std::string>("password")))
+        {
+            return 1;
+        }
+
+        /*
+         * Buffers released by hibernation stay in heap of malloc and are reused by next connections,
+         * so the first half of connections is only warm up: cost of connection is growth of RSS,
+         * when the second half is opened and hibernated.
+         */
+        size_t connections = opt->get<int>("connections");
+        size_t before = 0;
+        for (size_t target : {connections / 2, connections})
+        {
+            before = rss_kb(pid);
+            while (idle.count() < target)
+            {
+                if (!idle.open())
+                {
+                    return 1;
+                }
+            }
+
+            std::cout << "idle_rss_test: " << idle.count() << " connections opened, waiting for hibernation" << std::endl;
+            std::this_thread::sleep_for(std::chrono::seconds(opt->get<int>("wait_sec")));
+        }
+
+        size_t after = rss_kb(pid);
+        size_t opened = connections - connections / 2;
+        size_t per_connection = after > before ? (after - before) / opened : 0;
+        std::cout << "idle_rss_test: server RSS " << before << " KB -> " << after << " KB, "
+                  << per_connection << " KB per idle connection" << std::endl;
+
+        return per_connection <= size_t(opt->get<int>("target_kb")) ? 0 : 1;
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "idle_rss_test: " << e.what() << std::endl;
+        return 1;
+    }
+}
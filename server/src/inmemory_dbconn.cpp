@@ -1,3 +1,5 @@
+#include <algorithm>
+
 #include "database.hpp"
 
 #include "o2logger/src/o2logger.hpp"
@@ -6,19 +8,40 @@ using namespace o2logger;
 
 
 InMemoryConnection::Storage InMemoryConnection::m_Storage;
-std::mutex InMemoryConnection::m_Mutex;
+
+void InMemoryConnection::insertChat(const db::Chat &chat, uint64_t uid)
+{
+    ChatShard &shard = chatShard(chat.id);
+    std::lock_guard<std::shared_timed_mutex> lock(shard.mutex);
+
+    shard.chats[chat.id] = chat;
+    if (uid > 0)
+    {
+        shard.users[chat.id].push_back(uid);
+    }
+}
 
 void InMemoryConnection::updateUserHeartBit(const db::User &user, uint64_t ts)
 {
-    std::lock_guard<std::mutex> lock(m_Mutex);
+    UserShard &shard = userShard(user.id);
+    std::lock_guard<std::shared_timed_mutex> lock(shard.mutex);
 
-    for (auto &u : m_Storage.users)
+    auto it = shard.users.find(user.id);
+    if (it != shard.users.end())
     {
-        if (u.id == user.id)
-        {
-            u.heartbit = ts;
-            return;
-        }
+        it->second.heartbit = ts;
+    }
+}
+
+void InMemoryConnection::updateUserPassword(const db::User &user, const std::string &pass)
+{
+    UserShard &shard = userShard(user.id);
+    std::lock_guard<std::shared_timed_mutex> lock(shard.mutex);
+
+    auto it = shard.users.find(user.id);
+    if (it != shard.users.end())
+    {
+        it->second.password = pass;
     }
 }
 
@@ -31,77 +54,89 @@ db::User InMemoryConnection::createUser(const std::string &name, const std::stri
     commit
 */
 {
-    std::lock_guard<std::mutex> lock(m_Mutex);
+    NameShard &names = nameShard(name);
+    std::lock_guard<std::shared_timed_mutex> lock(names.mutex);
 
-    for (const auto &user : m_Storage.users)
+    if (names.users.count(name))
     {
-        if (user.name == name)
-        {
-            return {};
-        }
+        return {};
     }
 
     uint64_t chat_id = m_Storage.chat_autoincrement++;
     uint64_t user_id = m_Storage.user_autoincrement++;
 
-    m_Storage.chats.emplace_back(db::Chat(chat_id, name));
     db::User user(user_id, chat_id, name, pass, stpath);
-    
-    m_Storage.users.emplace_back(user);
+    {
+        UserShard &shard = userShard(user_id);
+        std::lock_guard<std::shared_timed_mutex> user_lock(shard.mutex);
+
+        shard.users[user_id] = user;
+        shard.chats[user_id].push_back(chat_id);
+    }
+
+    insertChat(db::Chat(chat_id, name), user_id);
 
-    m_Storage.chatuser.emplace_back(db::Chatuser(chat_id, user_id));
+    // user could be found by name only when he is completely stored
+    names.users[name] = user_id;
+    names.chats.emplace(name, chat_id);
     return user;
 }
 
 db::Chat InMemoryConnection::createChat(const std::string &name, uint64_t uid)
 {
-    std::lock_guard<std::mutex> lock(m_Mutex);
+    NameShard &names = nameShard(name);
+    std::lock_guard<std::shared_timed_mutex> lock(names.mutex);
 
-    for (const auto &chat : m_Storage.chats)
+    if (names.chats.count(name))
     {
-        if (chat.name == name)
-        {
-            return {};
-        }
+        return {};
     }
 
     uint64_t chat_id = m_Storage.chat_autoincrement++;
 
     db::Chat chat(chat_id, name);
-    m_Storage.chats.emplace_back(chat);
+    insertChat(chat, uid);
 
     if (uid > 0)
     {
-        m_Storage.chatuser.emplace_back(db::Chatuser(chat_id, uid));
+        UserShard &shard = userShard(uid);
+        std::lock_guard<std::shared_timed_mutex> user_lock(shard.mutex);
+        shard.chats[uid].push_back(chat_id);
     }
 
+    names.chats.emplace(name, chat_id);
     return chat;
 }
 
 std::vector<db::User> InMemoryConnection::lookupUserByName(const std::string &name) const
 {
-    std::vector<db::User> ret;
-    std::lock_guard<std::mutex> lock(m_Mutex);
-
-    for (const auto &user : m_Storage.users)
+    uint64_t uid = 0;
     {
-        if (user.name == name)
+        const NameShard &names = nameShard(name);
+        std::shared_lock<std::shared_timed_mutex> lock(names.mutex);
+
+        auto it = names.users.find(name);
+        if (it == names.users.end())
         {
-            ret.push_back(user);
+            return {};
         }
+        uid = it->second;
     }
+
+    std::vector<db::User> ret;
+    ret.push_back(lookupUserById(uid));
     return ret;
 }
 
 db::User InMemoryConnection::lookupUserById(uint64_t id) const
 {
-    std::lock_guard<std::mutex> lock(m_Mutex);
-    for (const auto &user : m_Storage.users)
+    const UserShard &shard = userShard(id);
+    std::shared_lock<std::shared_timed_mutex> lock(shard.mutex);
+
+    auto it = shard.users.find(id);
+    if (it != shard.users.end())
     {
-        if (user.id == id)
-        {
-            return user;
-        }
+        return it->second;
     }
     return {};
 }
@@ -110,50 +145,57 @@ std::vector<db::Chat> InMemoryConnection::lookupChatsForUserId(uint64_t uid) con
 {
     std::vector<uint64_t> chats;
     {
-        std::lock_guard<std::mutex> lock(m_Mutex);
-        for (const auto &chatuser : m_Storage.chatuser)
+        const UserShard &shard = userShard(uid);
+        std::shared_lock<std::shared_timed_mutex> lock(shard.mutex);
+
+        auto it = shard.chats.find(uid);
+        if (it == shard.chats.end())
         {
-            if (chatuser.uid == uid)
-            {
-                chats.push_back(chatuser.chatid);
-            }
+            return {};
         }
+        chats = it->second;
     }
 
     std::vector<db::Chat> ret;
+    ret.reserve(chats.size());
     for (uint64_t chatid : chats)
     {
-        db::Chat chat = lookupChatById(chatid);
-        ret.push_back(chat);
+        ret.push_back(lookupChatById(chatid));
     }
-
     return ret;
 }
 
 std::vector<db::Chat> InMemoryConnection::lookupChatByName(const std::string &name) const
 {
-    std::vector<db::Chat> ret;
-    std::lock_guard<std::mutex> lock(m_Mutex);
-
-    for (const auto &chat : m_Storage.chats)
+    std::vector<uint64_t> chats;
     {
-        if (chat.name == name)
+        const NameShard &names = nameShard(name);
+        std::shared_lock<std::shared_timed_mutex> lock(names.mutex);
+
+        auto range = names.chats.equal_range(name);
+        for (auto it = range.first; it != range.second; ++it)
         {
-            ret.push_back(chat);
+            chats.push_back(it->second);
         }
     }
+
+    std::vector<db::Chat> ret;
+    for (uint64_t chatid : chats)
+    {
+        ret.push_back(lookupChatById(chatid));
+    }
     return ret;
 }
 
 db::Chat InMemoryConnection::lookupChatById(uint64_t chatid) const
 {
-    std::lock_guard<std::mutex> lock(m_Mutex);
-    for (const auto &chat : m_Storage.chats)
+    const ChatShard &shard = chatShard(chatid);
+    std::shared_lock<std::shared_timed_mutex> lock(shard.mutex);
+
+    auto it = shard.chats.find(chatid);
+    if (it != shard.chats.end())
     {
-        if (chat.id == chatid)
-        {
-            return chat;
-        }
+        return it->second;
     }
     return {};
 }
@@ -162,111 +204,110 @@ std::vector<db::User> InMemoryConnection::lookupUsersForChatId(uint64_t chatid)
 {
     std::vector<uint64_t> uids;
     {
-        std::lock_guard<std::mutex> lock(m_Mutex);
-        for (const auto &chatuser : m_Storage.chatuser)
+        const ChatShard &shard = chatShard(chatid);
+        std::shared_lock<std::shared_timed_mutex> lock(shard.mutex);
+
+        auto it = shard.users.find(chatid);
+        if (it == shard.users.end())
         {
-            if (chatuser.chatid == chatid)
-            {
-                uids.push_back(chatuser.uid);
-            }
+            return {};
         }
+        uids = it->second;
     }
 
     std::vector<db::User> ret;
-    for (uint64_t uid: uids)
+    ret.reserve(uids.size());
+    for (uint64_t uid : uids)
     {
-        db::User user = lookupUserById(uid);
-        ret.push_back(user);
+        ret.push_back(lookupUserById(uid));
     }
-
     return ret;
 }
 
 void InMemoryConnection::addUserToChat(const db::Chat &chat, const db::User &user)
 {
-    std::lock_guard<std::mutex> lock(m_Mutex);
-
-    for (const auto &chatuser : m_Storage.chatuser)
     {
-        if (chatuser.chatid == chat.id && chatuser.uid == user.id)
+        UserShard &shard = userShard(user.id);
+        std::lock_guard<std::shared_timed_mutex> lock(shard.mutex);
+
+        std::vector<uint64_t> &chats = shard.chats[user.id];
+        if (std::find(chats.begin(), chats.end(), chat.id) != chats.end())
         {
             return;
         }
+        chats.push_back(chat.id);
     }
 
-    m_Storage.chatuser.emplace_back(db::Chatuser(chat.id, user.id));
+    ChatShard &shard = chatShard(chat.id);
+    std::lock_guard<std::shared_timed_mutex> lock(shard.mutex);
+    shard.users[chat.id].push_back(user.id);
 }
 
 void InMemoryConnection::saveMessage(const db::Message &msg)
 {
-    std::lock_guard<std::mutex> lock(m_Mutex);
-    m_Storage.messages.push_back(msg);
+    ChatShard &shard = chatShard(msg.chat_to);
+    std::lock_guard<std::shared_timed_mutex> lock(shard.mutex);
+    shard.messages[msg.chat_to].append(msg);
 }
 
 std::vector<db::Message> InMemoryConnection::getMessages(uint64_t chatid, const db::get_msg_opt_t &opt) const
 // go from recent messages to oldest
 {
     std::vector<db::Message> ret;
-    std::lock_guard<std::mutex> lock(m_Mutex);
 
-    if (m_Storage.messages.empty())
+    const ChatShard &shard = chatShard(chatid);
+    std::shared_lock<std::shared_timed_mutex> lock(shard.mutex);
+
+    auto it = shard.messages.find(chatid);
+    if (it == shard.messages.end())
     {
         return {};
     }
 
-    for (size_t i = m_Storage.messages.size() - 1; ; --i)
-    {
-        if (m_Storage.messages[i].chat_to == chatid)
-        {
-            if (m_Storage.messages[i].ts > opt.ts)
-            {
-                ret.push_back(m_Storage.messages[i]);
-                m_Storage.messages[i].flags = db::Message::flags_t::READ;
-            }
-        }
+    const db::MessageLog &log = it->second;
 
-        if (opt.max_count && ret.size() >= opt.max_count)
-        {
-            break;
-        }
+    size_t first = log.upperBound(opt.ts);
+    size_t last = log.size();
+    if (opt.max_count && last - first > opt.max_count)
+    {
+        first = last - opt.max_count;
+    }
 
-        if (i == 0)
-        {
-            break;
-        }
+    ret.reserve(last - first);
+    for (size_t i = last; i > first; --i)
+    {
+        ret.push_back(log.at(i - 1));
     }
 
     return ret;
 }
 
-std::vector<db::Message> InMemoryConnection::selectMessages(std::function<bool(const db::Message &)> &&pred, const db::get_msg_opt_t &opt) const
+std::vector<db::Message> InMemoryConnection::selectMessages(uint64_t chatid, std::function<bool(const db::Message &)> &&pred, const db::get_msg_opt_t &opt) const
 {
     std::vector<db::Message> ret;
-    std::lock_guard<std::mutex> lock(m_Mutex);
 
-    if (m_Storage.messages.empty())
+    const ChatShard &shard = chatShard(chatid);
+    std::shared_lock<std::shared_timed_mutex> lock(shard.mutex);
+
+    auto it = shard.messages.find(chatid);
+    if (it == shard.messages.end())
     {
         return {};
     }
 
-    for (size_t i = m_Storage.messages.size() - 1; ; --i)
+    const db::MessageLog &log = it->second;
+    for (size_t i = log.size(); i > 0; --i)
     {
-        if (pred(m_Storage.messages[i]))
+        if (pred(log.at(i - 1)))
         {
-            ret.push_back(m_Storage.messages[i]);
+            ret.push_back(log.at(i - 1));
         }
 
         if (opt.max_count && ret.size() >= opt.max_count)
         {
             break;
         }
-
-        if (i == 0)
-        {
-            break;
-        }
     }
 
     return ret;
 }
-
@@ -35,10 +35,28 @@ int main(int argc, char *argv[])
     opt->add("port", "p", "port to listen to (1025..65536)", 7788);
     opt->add("loglevel", "l", "loglevel (1..5)", 0);
     opt->add("sert", "", "path to .pem file", "");
+    opt->add("ticket_rotate", "", "how often tls session ticket key is changed, seconds", 3600);
     opt->add("syslog", "", "write logs into syslog", false);
     opt->add("run_as", "", "user which should be process owner", "");
     opt->add("io_workers", "", "count of threads to process io", 8);
+    opt->add("reuseport", "", "accept connections in each io thread (SO_REUSEPORT)", false);
+    opt->add("handshake_workers", "", "count of threads for tls handshakes (0 - handshake in io threads)", 2);
+    opt->add("handshake_backlog", "", "max count of handshakes in progress, new connections are closed above it", 1000);
+    opt->add("handshake_timeout_sec", "", "time for tls handshake of new connection, seconds", 10);
+    opt->add("session_pool", "", "closed connections kept for reuse, per io thread", 256);
+    opt->add("hibernate_sec", "", "idle connection without pushes releases its buffers after that, seconds", 30);
+    opt->add("read_timeout_sec", "", "time for new connection to send request, seconds (0 - no limit)", 10);
+    opt->add("idle_timeout_sec", "", "keep-alive connection without requests is closed after that, seconds (0 - no limit)", 60);
+    opt->add("pipeline_depth", "", "max count of pipelined requests of connection, processed at the same time", 16);
+    opt->add("websocket_deflate", "", "permessage-deflate for websocket connections, if client offers it", true);
+    opt->add("write_coalesce_us", "", "max delay of write to merge it with following ones, microseconds", 0);
+    opt->add("max_outbound_kb", "", "limit of data, not read by client yet, kilobytes", 1024);
+    opt->add("slow_reader", "", "what to do with pushes above the limit (drop, resync, disconnect)", "resync");
+    opt->add("io_balance", "", "how to choose io thread for connection (random, least, p2c)", "p2c");
     opt->add("pass_len", "", "how string should be password", 8);
+    opt->add("hash_workers", "", "count of threads for password hashing (create, login)", 2);
+    opt->add("hash_backlog", "", "max count of logins, which wait for hashing, above it they get 429", 256);
+    opt->add("session_ttl_sec", "", "session token of login is valid for this time after its last use, seconds", 3600);
 
     try
     {
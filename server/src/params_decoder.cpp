@@ -0,0 +1,283 @@
+#include <cstring>
+
+#include <rapidjson/reader.h>
+
+#include "params_decoder.hpp"
+
+
+namespace
+{
+
+// body parameters of route schema, errors are reported in this order
+struct ParamField
+{
+    common::param_t param;
+    const char *name;
+    size_t size;
+    bool is_string;
+};
+
+#define PARAM_FIELD(param, name, is_string) { param, name, sizeof(name) - 1, is_string }
+
+const ParamField PARAM_FIELDS[] = {
+    PARAM_FIELD(common::P_PASSWORD, "password", true),
+    PARAM_FIELD(common::P_USER,     "user",     true),
+    PARAM_FIELD(common::P_UID,      "uid",      false),
+    PARAM_FIELD(common::P_CHATNAME, "chatname", true),
+    PARAM_FIELD(common::P_ADDUSER,  "adduser",  true),
+    PARAM_FIELD(common::P_MESSAGE,  "message",  true),
+    PARAM_FIELD(common::P_TO,       "to",       true),
+    PARAM_FIELD(common::P_HEARTBIT, "heartbit", false),
+    PARAM_FIELD(common::P_COUNT,    "count",    false),
+    PARAM_FIELD(common::P_TOKEN,    "token",    true),
+};
+
+#undef PARAM_FIELD
+
+std::string *string_param(RequestDetails::Params &params, common::param_t param)
+{
+    switch (param)
+    {
+        case common::P_PASSWORD: return &params.password;
+        case common::P_USER:     return &params.user;
+        case common::P_CHATNAME: return &params.chat.name;
+        case common::P_ADDUSER:  return &params.chat.adduser;
+        case common::P_MESSAGE:  return &params.message;
+        case common::P_TO:       return &params.to_user;
+        case common::P_TOKEN:    return &params.token;
+        default:                 return nullptr;
+    }
+}
+
+uint64_t *uint_param(RequestDetails::Params &params, common::param_t param)
+{
+    switch (param)
+    {
+        case common::P_UID:      return &params.uid;
+        case common::P_HEARTBIT: return &params.ts;
+        case common::P_COUNT:    return &params.count;
+        default:                 return nullptr;
+    }
+}
+
+/*
+ * In situ stream over buffer, which is not zero terminated (body in receive buffer):
+ * its end is seen by reader as '\0'. Decoded strings are written over source,
+ * they are never longer than their json form.
+ */
+class InsituBufferStream
+{
+public:
+    typedef char Ch;
+
+    InsituBufferStream(char *data, size_t size) :
+        m_Src(data),
+        m_Dst(nullptr),
+        m_Begin(data),
+        m_End(data + size)
+    {
+    }
+
+    Ch Peek() const { return m_Src != m_End ? *m_Src : '\0'; }
+    Ch Take() { return m_Src != m_End ? *m_Src++ : '\0'; }
+    size_t Tell() const { return m_Src - m_Begin; }
+
+    Ch *PutBegin() { return m_Dst = m_Src; }
+    void Put(Ch c) { *m_Dst++ = c; }
+    size_t PutEnd(Ch *begin) { return m_Dst - begin; }
+    void Flush() {}
+
+private:
+    char *m_Src;
+    char *m_Dst;
+    char *m_Begin;
+    char *m_End;
+};
+
+/*
+ * Takes top level members, which are in schema; the first one wins, as FindMember of document.
+ * Nested objects and arrays are skipped, as member value they are of wrong type.
+ */
+class ParamsHandler: public rapidjson::BaseReaderHandler<rapidjson::UTF8<>, ParamsHandler>
+{
+public:
+    ParamsHandler(RequestDetails::Params &params, uint16_t schema) :
+        m_Params(params),
+        m_Schema(schema)
+    {
+    }
+
+    bool Key(const char *str, rapidjson::SizeType len, bool)
+    {
+        m_Field = nullptr;
+        if (m_Depth != 1)
+        {
+            return true;
+        }
+
+        for (const ParamField &field : PARAM_FIELDS)
+        {
+            if ((m_Schema & field.param) && field.size == len && memcmp(field.name, str, len) == 0)
+            {
+                if (!(m_Seen & field.param))
+                {
+                    m_Field = &field;
+                    m_Seen |= field.param;
+                }
+                break;
+            }
+        }
+        return true;
+    }
+
+    bool String(const char *str, rapidjson::SizeType len, bool)
+    {
+        const ParamField *field = takeField();
+        if (!field)
+        {
+            return true;
+        }
+
+        if (!field->is_string)
+        {
+            m_Invalid |= field->param;
+        }
+        else if (len == 0)
+        {
+            m_Empty |= field->param;
+        }
+        else
+        {
+            string_param(m_Params, field->param)->assign(str, len);
+        }
+        return true;
+    }
+
+    // json number, which is IsUint() in document
+    bool Uint(unsigned u)
+    {
+        const ParamField *field = takeField();
+        if (!field)
+        {
+            return true;
+        }
+
+        if (field->is_string)
+        {
+            m_Invalid |= field->param;
+        }
+        else
+        {
+            *uint_param(m_Params, field->param) = u;
+        }
+        return true;
+    }
+
+    // null, bool, negative, 64 bit or double number
+    bool Default()
+    {
+        const ParamField *field = takeField();
+        if (field)
+        {
+            m_Invalid |= field->param;
+        }
+        return true;
+    }
+
+    bool StartObject()
+    {
+        Default();
+        ++m_Depth;
+        return true;
+    }
+
+    bool EndObject(rapidjson::SizeType)
+    {
+        --m_Depth;
+        return true;
+    }
+
+    bool StartArray()
+    {
+        Default();
+        ++m_Depth;
+        return true;
+    }
+
+    bool EndArray(rapidjson::SizeType)
+    {
+        --m_Depth;
+        return true;
+    }
+
+    // error of the first required parameter, which is not given properly
+    std::string error(uint16_t required) const
+    {
+        for (const ParamField &field : PARAM_FIELDS)
+        {
+            if (!(required & field.param))
+            {
+                continue;
+            }
+
+            if (!(m_Seen & field.param))
+            {
+                return std::string("bad request, ") + field.name + " required";
+            }
+            if (m_Invalid & field.param)
+            {
+                return std::string("bad request, ") + field.name + (field.is_string ? " is not string" : " is not uint");
+            }
+            if (m_Empty & field.param)
+            {
+                return std::string("bad request, ") + field.name + " is empty";
+            }
+        }
+        return "";
+    }
+
+private:
+    const ParamField *takeField()
+    {
+        const ParamField *field = m_Depth == 1 ? m_Field : nullptr;
+        m_Field = nullptr;
+        return field;
+    }
+
+private:
+    RequestDetails::Params &m_Params;
+    uint16_t m_Schema;
+
+    int m_Depth = 0;
+    const ParamField *m_Field = nullptr;    // value of this member is expected
+    uint16_t m_Seen = 0;
+    uint16_t m_Invalid = 0;
+    uint16_t m_Empty = 0;
+};
+
+}   // namespace
+
+
+std::string decode_params(RequestDetails::Params &params, char *json, size_t size, const common::Route &route)
+{
+    // optional credentials of previous request on connection must not be taken for these ones
+    params.password.clear();
+    params.token.clear();
+
+    ParamsHandler handler(params, route.required | route.optional);
+    InsituBufferStream stream(json, size);
+
+    rapidjson::Reader reader;
+    if (reader.Parse<rapidjson::kParseInsituFlag>(stream, handler).IsError())
+    {
+        return "bad request, invalid json";
+    }
+
+    if ((route.optional & common::P_CREDENTIALS) == common::P_CREDENTIALS
+        && params.token.empty() && params.password.empty())
+    {
+        return "bad request, token or password required";
+    }
+
+    return handler.error(route.required);
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#include "common/common.hpp"
+#include "request.hpp"
+
+
+/*
+ * Body of request is decoded by rapidjson SAX reader right into Params:
+ * no document is built, only parameters of route schema are taken.
+ * Parsing is in situ, so strings are not copied into reader stack,
+ * json is changed by it and is not usable after that.
+ *
+ * returns error for client, empty - ok
+ */
+std::string decode_params(RequestDetails::Params &params, char *json, size_t size, const common::Route &route);
@@ -0,0 +1,164 @@
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+
+#include "common/utils.hpp"
+#include "password_hash.hpp"
+
+
+namespace password_hash
+{
+
+namespace
+{
+
+const char PREFIX[] = "scrypt$";
+
+// N = 2^14, r = 8: 16 MB of memory per hash, as recommended for interactive logins
+const int LOG_N = 14;
+const int R = 8;
+const int P = 1;
+
+const size_t SALT_SIZE = 16;
+const size_t KEY_SIZE = 32;
+
+// limit for records of other parameters, which are accepted
+const uint64_t MAX_MEMORY = 64 * 1024 * 1024;
+
+struct Params
+{
+    int log_n = 0;
+    int r = 0;
+    int p = 0;
+    std::vector<unsigned char> salt;
+    std::vector<unsigned char> key;
+};
+
+std::string to_hex(const std::vector<unsigned char> &data)
+{
+    static const char digits[] = "0123456789abcdef";
+
+    std::string hex(2 * data.size(), '\0');
+    for (size_t i = 0; i < data.size(); ++i)
+    {
+        hex[2 * i] = digits[data[i] >> 4];
+        hex[2 * i + 1] = digits[data[i] & 0xf];
+    }
+    return hex;
+}
+
+bool from_hex(const std::string &hex, std::vector<unsigned char> &data)
+{
+    auto digit = [](char c) -> int
+    {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        return -1;
+    };
+
+    if (hex.empty() || hex.size() % 2 != 0)
+    {
+        return false;
+    }
+
+    data.resize(hex.size() / 2);
+    for (size_t i = 0; i < data.size(); ++i)
+    {
+        int hi = digit(hex[2 * i]);
+        int lo = digit(hex[2 * i + 1]);
+        if (hi < 0 || lo < 0)
+        {
+            return false;
+        }
+        data[i] = static_cast<unsigned char>(hi << 4 | lo);
+    }
+    return true;
+}
+
+bool parse(const std::string &record, Params &params)
+{
+    std::vector<std::string> fields;
+    size_t pos = sizeof(PREFIX) - 1;
+    while (pos <= record.size())
+    {
+        size_t end = record.find('$', pos);
+        if (end == std::string::npos)
+        {
+            end = record.size();
+        }
+        fields.push_back(record.substr(pos, end - pos));
+        pos = end + 1;
+    }
+
+    if (fields.size() != 5)
+    {
+        return false;
+    }
+
+    params.log_n = atoi(fields[0].c_str());
+    params.r = atoi(fields[1].c_str());
+    params.p = atoi(fields[2].c_str());
+
+    return params.log_n > 0 && params.log_n < 32 && params.r > 0 && params.p > 0
+           && from_hex(fields[3], params.salt) && from_hex(fields[4], params.key);
+}
+
+bool derive(const std::string &password, const Params &params, std::vector<unsigned char> &key)
+{
+    return EVP_PBE_scrypt(password.data(), password.size(),
+                          params.salt.data(), params.salt.size(),
+                          uint64_t(1) << params.log_n, params.r, params.p, MAX_MEMORY,
+                          key.data(), key.size()) == 1;
+}
+
+}   // namespace
+
+
+std::string make(const std::string &password)
+{
+    Params params;
+    params.log_n = LOG_N;
+    params.r = R;
+    params.p = P;
+    params.salt.resize(SALT_SIZE);
+    params.key.resize(KEY_SIZE);
+
+    if (RAND_bytes(params.salt.data(), params.salt.size()) != 1 || !derive(password, params, params.key))
+    {
+        return "";
+    }
+
+    return PREFIX + std::to_string(params.log_n) + "$" + std::to_string(params.r) + "$" + std::to_string(params.p)
+           + "$" + to_hex(params.salt) + "$" + to_hex(params.key);
+}
+
+bool verify(const std::string &password, const std::string &record, bool &rehash)
+{
+    if (record.compare(0, sizeof(PREFIX) - 1, PREFIX) != 0)
+    {
+        // record of crc32 times
+        rehash = true;
+        return std::to_string(utils::crc32(password)) == record;
+    }
+
+    Params params;
+    if (!parse(record, params))
+    {
+        return false;
+    }
+
+    std::vector<unsigned char> key(params.key.size());
+    if (!derive(password, params, key) || CRYPTO_memcmp(key.data(), params.key.data(), key.size()) != 0)
+    {
+        return false;
+    }
+
+    rehash = params.log_n != LOG_N || params.r != R || params.p != P;
+    return true;
+}
+
+}   // namespace password_hash
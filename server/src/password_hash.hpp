@@ -0,0 +1,24 @@
+#pragma once
+
+#include <string>
+
+
+/*
+ * Passwords are stored as scrypt (memory-hard kdf of openssl) records:
+ * "scrypt$<log2 N>$<r>$<p>$<salt hex>$<key hex>", salt is random for every record.
+ * One hash takes tens of milliseconds and 16 MB of memory on purpose,
+ * so it is called only by hashing threads of DatabaseWorker.
+ *
+ * Records of crc32 times (decimal number) are still verified,
+ * they should be rehashed after successful login.
+ */
+namespace password_hash
+{
+
+// empty - kdf failed
+std::string make(const std::string &password);
+
+// rehash: record is correct, but it is crc32 one or made with other kdf parameters
+bool verify(const std::string &password, const std::string &record, bool &rehash);
+
+}   // namespace password_hash
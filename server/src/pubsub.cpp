@@ -0,0 +1,149 @@
+#include <algorithm>
+
+#include "pubsub.hpp"
+
+
+void PubSub::subscribe(uint64_t uid, const std::vector<db::Chat> &chats, const boost::shared_ptr<ApiClient> &client)
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    Subscriber &subscriber = m_Users[uid];
+    subscriber.connections.push_back(Connection{client.get(), client});
+
+    for (const auto &chat : chats)
+    {
+        if (std::find(subscriber.chats.begin(), subscriber.chats.end(), chat.id) != subscriber.chats.end())
+        {
+            continue;
+        }
+        subscriber.chats.push_back(chat.id);
+        m_Chats[chat.id].push_back(uid);
+    }
+}
+
+void PubSub::unsubscribe(uint64_t uid, const ApiClient *client)
+/*
+ *  could be called from ApiClient destructor,
+ *  so do not lock weak pointers here
+ */
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    auto it = m_Users.find(uid);
+    if (it == m_Users.end())
+    {
+        return;
+    }
+
+    std::vector<Connection> &connections = it->second.connections;
+    connections.erase(std::remove_if(connections.begin(), connections.end(),
+                        [client](const Connection &c)
+                        {
+                            return c.ptr == client || c.client.expired();
+                        }),
+                      connections.end());
+
+    if (connections.empty())
+    {
+        dropUser(uid);
+    }
+}
+
+void PubSub::joinChat(uint64_t chatid, uint64_t uid)
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    auto it = m_Users.find(uid);
+    if (it == m_Users.end())
+    {
+        // user is offline, he will subscribe on next idle
+        return;
+    }
+
+    std::vector<uint64_t> &chats = it->second.chats;
+    if (std::find(chats.begin(), chats.end(), chatid) != chats.end())
+    {
+        return;
+    }
+    chats.push_back(chatid);
+    m_Chats[chatid].push_back(uid);
+}
+
+std::vector<boost::shared_ptr<ApiClient>> PubSub::subscribers(uint64_t chatid)
+{
+    std::vector<boost::shared_ptr<ApiClient>> ret;
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    auto chat = m_Chats.find(chatid);
+    if (chat == m_Chats.end())
+    {
+        return ret;
+    }
+
+    for (uint64_t uid : chat->second)
+    {
+        auto user = m_Users.find(uid);
+        if (user == m_Users.end())
+        {
+            continue;
+        }
+
+        for (const auto &connection : user->second.connections)
+        {
+            // NB: locked pointers live in 'ret' until the mutex is released,
+            //     so ApiClient destructor never runs under the lock
+            boost::shared_ptr<ApiClient> client = connection.client.lock();
+            if (client)
+            {
+                ret.push_back(std::move(client));
+            }
+        }
+    }
+
+    return ret;
+}
+
+uint64_t PubSub::heartbit(uint64_t uid) const
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    if (m_Users.count(uid))
+    {
+        return time(NULL);
+    }
+
+    auto it = m_LastSeen.find(uid);
+    if (it != m_LastSeen.end())
+    {
+        return it->second;
+    }
+    return 0;
+}
+
+void PubSub::dropUser(uint64_t uid)
+{
+    auto it = m_Users.find(uid);
+    if (it == m_Users.end())
+    {
+        return;
+    }
+
+    for (uint64_t chatid : it->second.chats)
+    {
+        auto chat = m_Chats.find(chatid);
+        if (chat == m_Chats.end())
+        {
+            continue;
+        }
+
+        std::vector<uint64_t> &uids = chat->second;
+        uids.erase(std::remove(uids.begin(), uids.end(), uid), uids.end());
+        if (uids.empty())
+        {
+            m_Chats.erase(chat);
+        }
+    }
+
+    m_Users.erase(it);
+    m_LastSeen[uid] = time(NULL);
+}
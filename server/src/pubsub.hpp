@@ -0,0 +1,53 @@
+#pragma once
+
+#include <mutex>
+#include <vector>
+#include <unordered_map>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/weak_ptr.hpp>
+
+#include "database.hpp"
+
+
+class ApiClient;
+
+/*
+ * Registry of idle connections, subscribed to chats.
+ * Database worker publishes every saved message into chat,
+ * and each subscriber gets it pushed on his own io thread.
+ */
+class PubSub
+{
+public:
+    void subscribe(uint64_t uid, const std::vector<db::Chat> &chats, const boost::shared_ptr<ApiClient> &client);
+    void unsubscribe(uint64_t uid, const ApiClient *client);
+    void joinChat(uint64_t chatid, uint64_t uid);
+
+    std::vector<boost::shared_ptr<ApiClient>> subscribers(uint64_t chatid);
+
+    // now - if user has idle connect, otherwise time when last one was closed
+    uint64_t heartbit(uint64_t uid) const;
+
+private:
+    struct Connection
+    {
+        const ApiClient *ptr;                   // to find connection, even if it is in destructor
+        boost::weak_ptr<ApiClient> client;
+    };
+
+    struct Subscriber
+    {
+        std::vector<Connection> connections;
+        std::vector<uint64_t> chats;
+    };
+
+private:
+    void dropUser(uint64_t uid);
+
+private:
+    mutable std::mutex m_Mutex;
+    std::unordered_map<uint64_t, std::vector<uint64_t>> m_Chats;    // chat id -> online users
+    std::unordered_map<uint64_t, Subscriber> m_Users;               // user id -> idle connections
+    std::unordered_map<uint64_t, uint64_t> m_LastSeen;
+};
@@ -10,6 +10,16 @@ struct RequestDetails
 {
     RequestDetails() {}
 
+    // idle connection needs only uid, command and session id
+    void shrinkForIdle()
+    {
+        for (std::string *s : { &params.message, &params.to_user, &params.user, &params.password, &params.token,
+                                &params.chat.name, &params.chat.adduser, &remote_address, &resource, &method })
+        {
+            std::string().swap(*s);
+        }
+    }
+
     struct Params
     {
         uint64_t uid = 0;
@@ -21,6 +31,7 @@ struct RequestDetails
 
         std::string user;           // lookup user by name
         std::string password;
+        std::string token;          // of session, instead of password
 
         struct chat
         {
@@ -30,6 +41,7 @@ struct RequestDetails
     } params;
     
     common::cmd_t command;
+    uint64_t seq = 0;               // of request on connection, responses are written in this order
     std::string remote_address;
     std::string resource;
     std::string method;
@@ -11,6 +11,7 @@
 
 #include <boost/make_shared.hpp>
 
+#include <algorithm>
 #include <chrono>
 #include <queue>
 #include <thread>
@@ -27,41 +28,133 @@ using namespace o2logger;
 std::atomic<bool> g_NeedStop(false);
 
 
+namespace
+{
+
+typedef boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> reuse_port;
+
+void open_acceptor(boost::asio::ip::tcp::acceptor &acceptor, int port, bool reuseport)
+{
+    boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::tcp::v4(), port);
+
+    acceptor.open(endpoint.protocol());
+    acceptor.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+    if (reuseport)
+    {
+        acceptor.set_option(reuse_port(true));
+    }
+    ::fcntl(acceptor.native(), F_SETFD, FD_CLOEXEC);
+    acceptor.bind(endpoint);
+    acceptor.listen(2048);
+}
+
+const int LOAD_DUMP_INTERVAL_SEC = 60;
+
+void reject(boost::shared_ptr<TcpClient> socket)
+/*
+ *  client speaks tls, plain text answer would be a protocol error for it: connection is just closed
+ */
+{
+    socket->close();
+}
+
+}   // namespace
+
+
+OutboundPolicy::slow_reader_t Server::parseSlowReader(const std::string &name)
+{
+    if (name == "drop")
+    {
+        return OutboundPolicy::slow_reader_t::DROP;
+    }
+    if (name == "disconnect")
+    {
+        return OutboundPolicy::slow_reader_t::DISCONNECT;
+    }
+    if (name != "resync")
+    {
+        logw("unknown slow_reader: ", name, ", resync will be used");
+    }
+    return OutboundPolicy::slow_reader_t::RESYNC;
+}
+
+Server::balance_t Server::parseBalance(const std::string &name)
+{
+    if (name == "random")
+    {
+        return balance_t::RANDOM;
+    }
+    if (name == "least")
+    {
+        return balance_t::LEAST_LOADED;
+    }
+    if (name != "p2c")
+    {
+        logw("unknown io_balance: ", name, ", p2c will be used");
+    }
+    return balance_t::TWO_CHOICES;
+}
+
 Server::Server(int port, int io_thread_pool_size) :
+    m_Port(port),
     m_IoPoolSize(io_thread_pool_size),
-    m_MainIo(std::make_unique<IoThread>(libproperty::Options::impl()->get<std::string>("sert"))),
+    m_ReusePort(libproperty::Options::impl()->get<bool>("reuseport")),
+    m_WriteCoalesce(libproperty::Options::impl()->get<int>("write_coalesce_us")),
+    m_HandshakeWorkers(libproperty::Options::impl()->get<int>("handshake_workers")),
+    m_HandshakeBacklog(libproperty::Options::impl()->get<int>("handshake_backlog")),
+    m_SessionPoolSize(libproperty::Options::impl()->get<int>("session_pool")),
+    m_Balance(parseBalance(libproperty::Options::impl()->get<std::string>("io_balance"))),
+    m_TicketRotateSec(libproperty::Options::impl()->get<int>("ticket_rotate")),
+    m_Tls(libproperty::Options::impl()->get<std::string>("sert"), 2 * m_TicketRotateSec),
+    m_MainIo(std::make_unique<IoThread>()),
     m_Signals(m_MainIo->ioService()),
     m_HupSignals(m_MainIo->ioService()),
     m_Acceptor(m_MainIo->ioService()),
-    m_Db(db::type_t::MEMORY, 5)
+    m_LoadTimer(m_MainIo->ioService()),
+    m_TicketTimer(m_MainIo->ioService()),
+    m_Db(db::type_t::MEMORY, 5,
+         libproperty::Options::impl()->get<int>("hash_workers"),
+         libproperty::Options::impl()->get<int>("hash_backlog"),
+         std::chrono::seconds(libproperty::Options::impl()->get<int>("session_ttl_sec")))
 {
     m_Signals.add(SIGINT);
     m_Signals.add(SIGTERM);
     m_Signals.add(SIGQUIT);
     m_Signals.async_wait(std::bind(&Server::handleStop, this));
 
+    m_Outbound.max_bytes = libproperty::Options::impl()->get<int>("max_outbound_kb") * 1024;
+    m_Outbound.on_overflow = parseSlowReader(libproperty::Options::impl()->get<std::string>("slow_reader"));
+
     m_HupSignals.add(SIGHUP);
     m_HupSignals.async_wait(std::bind(&Server::handleHUP, this));
 
-    boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::tcp::v4(), port);
-
-    m_Acceptor.open(endpoint.protocol());
-    m_Acceptor.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
-    ::fcntl(m_Acceptor.native(), F_SETFD, FD_CLOEXEC);
-    m_Acceptor.bind(endpoint);
-    m_Acceptor.listen(2048);
+    if (!m_ReusePort)
+    {
+        open_acceptor(m_Acceptor, m_Port, false);
+    }
 }
 
 Server::~Server()
 {
+    // connections hold references to io threads and database worker
+    m_ThreadAcceptors.clear();
+    m_Handshakes.reset();
+    m_SessionPools.clear();
+    m_IoThreads.clear();
 }
 
 void Server::handleStop()
 {
     logi("stopped by signal");
     g_NeedStop = true;
+    m_Db.stop();
     m_MainIo->ioService().stop();
 
+    if (m_Handshakes)
+    {
+        m_Handshakes->stop();
+    }
+
     for (const auto &thread : m_IoThreads)
     {
         thread->stop();
@@ -70,7 +163,8 @@ void Server::handleStop()
 
 void Server::handleHUP()
 {
-    logi("sighup ignored");
+    logi("sighup: reload is not supported, dump io threads load");
+    dumpLoad();
 
     // TODO:
     // Config::reload();
@@ -81,48 +175,184 @@ void Server::run()
 {
     m_MainIo->start();
 
+    m_SessionPools.clear();
     m_IoThreads.clear();
     for (size_t i = 0; i < m_IoPoolSize; ++i)
     {
-        m_IoThreads.push_back(std::make_unique<IoThread>(libproperty::Options::impl()->get<std::string>("sert")));
+        m_IoThreads.push_back(std::make_unique<IoThread>());
+        m_SessionPools.push_back(std::make_unique<SessionPool>(m_IoThreads.back()->ioService(), m_Tls.context(), m_SessionPoolSize));
         m_IoThreads.back()->start();
     }
 
+    m_Handshakes = std::make_unique<HandshakePool>(m_HandshakeWorkers, m_HandshakeBacklog);
+    m_Handshakes->start();
+
     m_Db.run();
 
-    startAccept();
+    if (m_ReusePort)
+    {
+        // kernel spreads new connections between listening sockets
+        m_ThreadAcceptors.clear();
+        for (size_t i = 0; i < m_IoThreads.size(); ++i)
+        {
+            m_ThreadAcceptors.push_back(std::make_unique<boost::asio::ip::tcp::acceptor>(m_IoThreads[i]->ioService()));
+            open_acceptor(*m_ThreadAcceptors.back(), m_Port, true);
+            startAccept(i);
+        }
+    }
+    else
+    {
+        startAccept();
+    }
+
+    startLoadTimer();
+    startTicketTimer();
 
     logi("chat server started");
 
     m_Db.join();
     m_MainIo->join();
+    m_Handshakes->join();
     for (const auto &thread : m_IoThreads)
     {
         thread->join();
     }
 }
 
-void Server::startAccept()
+size_t Server::pickIoThread()
 {
     static unsigned int seedp = 42;
-    auto &io_thread = m_IoThreads.at(rand_r(&seedp) % m_IoThreads.size());
-    boost::shared_ptr<TcpClient> socket = boost::make_shared<TcpClient>(
-        io_thread->ioService(), io_thread->sslContext());
+    size_t count = m_IoThreads.size();
 
-    auto handler = [this, socket](const boost::system::error_code &e)
+    switch (m_Balance)
     {
-        if (!e)
+    case balance_t::RANDOM:
+        return rand_r(&seedp) % count;
+
+    case balance_t::LEAST_LOADED:
+    {
+        auto it = std::min_element(m_IoThreads.begin(), m_IoThreads.end(),
+            [](const std::unique_ptr<IoThread> &a, const std::unique_ptr<IoThread> &b)
+            {
+                return a->loadScore() < b->loadScore();
+            });
+        return it - m_IoThreads.begin();
+    }
+
+    case balance_t::TWO_CHOICES:
+        break;
+    }
+
+    // NB: scores are read without synchronization and may be slightly stale,
+    //     random pair keeps new connections from herding onto one thread
+    if (count == 1)
+    {
+        return 0;
+    }
+    size_t first = rand_r(&seedp) % count;
+    size_t second = rand_r(&seedp) % (count - 1);
+    if (second >= first)
+    {
+        ++second;
+    }
+
+    return m_IoThreads[first]->loadScore() <= m_IoThreads[second]->loadScore() ? first : second;
+}
+
+void Server::startLoadTimer()
+{
+    m_LoadTimer.expires_from_now(std::chrono::seconds(LOAD_DUMP_INTERVAL_SEC));
+    m_LoadTimer.async_wait([this](const boost::system::error_code &e)
         {
-            boost::system::error_code tmp;
-            socket->makeConnected(tmp);
-            if (!tmp)
+            if (e == boost::asio::error::operation_aborted)
             {
-                boost::shared_ptr<ApiClient> c = boost::make_shared<ApiClient>(socket, m_Db);
-                c->serveSslClient();
+                return;
             }
-        }
+            dumpLoad();
+            startLoadTimer();
+        });
+}
+
+void Server::startTicketTimer()
+{
+    m_TicketTimer.expires_from_now(std::chrono::seconds(m_TicketRotateSec));
+    m_TicketTimer.async_wait([this](const boost::system::error_code &e)
+        {
+            if (e == boost::asio::error::operation_aborted)
+            {
+                return;
+            }
+            m_Tls.rotateTicketKey();
+            startTicketTimer();
+        });
+}
+
+void Server::dumpLoad() const
+{
+    for (size_t i = 0; i < m_IoThreads.size(); ++i)
+    {
+        const IoThread &io_thread = *m_IoThreads[i];
+        const SessionPool &pool = *m_SessionPools[i];
+        logi("io thread ", i, ": connections ", io_thread.connections(),
+             ", busy ", io_thread.busyUsPerSec() / 1000, " ms/s",
+             ", sessions created ", pool.created(), ", reused ", pool.reused(), ", idle ", pool.idle());
+    }
+
+    logi("slow readers: dropped ", m_Outbound.dropped.load(), ", resync ", m_Outbound.resynced.load(),
+         ", disconnected ", m_Outbound.disconnected.load());
+}
+
+void Server::startAccept()
+{
+    size_t thread_id = pickIoThread();
+    IoThread &io_thread = *m_IoThreads[thread_id];
+    boost::shared_ptr<TcpClient> socket = m_SessionPools[thread_id]->acquire();
+
+    auto handler = [this, socket, &io_thread](const boost::system::error_code &e)
+    {
+        serveAccepted(e, socket, io_thread);
         startAccept();
     };
 
     m_Acceptor.async_accept(socket->lowestLayer(), handler);
 }
+
+void Server::startAccept(size_t thread_id)
+{
+    boost::shared_ptr<TcpClient> socket = m_SessionPools.at(thread_id)->acquire();
+
+    auto handler = [this, socket, thread_id](const boost::system::error_code &e)
+    {
+        serveAccepted(e, socket, *m_IoThreads.at(thread_id));
+        startAccept(thread_id);
+    };
+
+    m_ThreadAcceptors.at(thread_id)->async_accept(socket->lowestLayer(), handler);
+}
+
+void Server::serveAccepted(const boost::system::error_code &e, boost::shared_ptr<TcpClient> socket, IoThread &io_thread)
+{
+    if (e)
+    {
+        return;
+    }
+
+    boost::system::error_code tmp;
+    socket->makeConnected(tmp);
+    if (tmp)
+    {
+        return;
+    }
+
+    if (!m_Handshakes->tryAdmit())
+    {
+        logd1("too many handshakes in progress, connection rejected");
+        reject(socket);
+        return;
+    }
+
+    socket->setCoalesceDelay(m_WriteCoalesce);
+
+    boost::shared_ptr<ApiClient> c = boost::make_shared<ApiClient>(socket, m_Db, io_thread, m_Outbound);
+    c->serveSslClient(*m_Handshakes);
+}
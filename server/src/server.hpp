@@ -2,9 +2,14 @@
 
 #include <boost/noncopyable.hpp>
 #include <boost/make_shared.hpp>
+#include <boost/asio/steady_timer.hpp>
 
 #include "net/client.hpp"
 #include "database_worker.hpp"
+#include "tls_context.hpp"
+#include "handshake_pool.hpp"
+#include "session_pool.hpp"
+#include "apiclient.hpp"
 #include "common/io_thread.hpp"
 
 
@@ -18,20 +23,54 @@ public:
 
 private:
     void startAccept();
+    void startAccept(size_t thread_id);
+    void serveAccepted(const boost::system::error_code &e, boost::shared_ptr<TcpClient> socket, IoThread &io_thread);
+    size_t pickIoThread();
+    void startLoadTimer();
+    void startTicketTimer();
+    void dumpLoad() const;
     void handleStop();
     void handleHUP();
 
     void loop();
 
 private:
+    enum class balance_t : uint8_t
+    {
+        RANDOM,
+        LEAST_LOADED,
+        TWO_CHOICES         // less loaded of two random threads
+    };
+
+private:
+    static balance_t parseBalance(const std::string &name);
+    static OutboundPolicy::slow_reader_t parseSlowReader(const std::string &name);
+
+private:
+    int m_Port;
     int m_IoPoolSize;
+    bool m_ReusePort;       // each io thread accepts on its own SO_REUSEPORT socket
+    std::chrono::microseconds m_WriteCoalesce;  // how long first write waits for others
+    size_t m_HandshakeWorkers;
+    size_t m_HandshakeBacklog;
+    size_t m_SessionPoolSize;
+    balance_t m_Balance;
+    uint32_t m_TicketRotateSec;
+
+    TlsContext m_Tls;
+    OutboundPolicy m_Outbound;
 
     std::unique_ptr<IoThread> m_MainIo;
     std::vector<std::unique_ptr<IoThread>> m_IoThreads;
+    std::unique_ptr<HandshakePool> m_Handshakes;
+    std::vector<std::unique_ptr<SessionPool>> m_SessionPools;  // one per io thread
 
     boost::asio::signal_set m_Signals;
     boost::asio::signal_set m_HupSignals;
     boost::asio::ip::tcp::acceptor m_Acceptor;
+    std::vector<std::unique_ptr<boost::asio::ip::tcp::acceptor>> m_ThreadAcceptors;
+    boost::asio::steady_timer m_LoadTimer;
+    boost::asio::steady_timer m_TicketTimer;
 
     DatabaseWorker m_Db;
 };
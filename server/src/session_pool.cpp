@@ -0,0 +1,78 @@
+#include "session_pool.hpp"
+
+
+SessionPool::SessionPool(boost::asio::io_service &io, boost::asio::ssl::context &ctx, size_t max_idle) :
+    m_Io(io),
+    m_Ctx(ctx),
+    m_State(std::make_shared<State>())
+{
+    m_State->max_idle = max_idle;
+    m_State->idle.reserve(max_idle);
+}
+
+SessionPool::~SessionPool()
+{
+    // sockets should not outlive io service, live connections are deleted on release
+    std::vector<std::unique_ptr<TcpClient>> idle;
+    {
+        std::lock_guard<std::mutex> lock(m_State->mutex);
+        m_State->closed = true;
+        idle.swap(m_State->idle);
+    }
+}
+
+boost::shared_ptr<TcpClient> SessionPool::acquire()
+{
+    std::unique_ptr<TcpClient> socket;
+    {
+        std::lock_guard<std::mutex> lock(m_State->mutex);
+        if (!m_State->idle.empty())
+        {
+            socket = std::move(m_State->idle.back());
+            m_State->idle.pop_back();
+        }
+    }
+
+    if (socket)
+    {
+        ++m_State->reused;
+    }
+    else
+    {
+        socket = std::make_unique<TcpClient>(m_Io, m_Ctx);
+        ++m_State->created;
+    }
+
+    std::shared_ptr<State> state = m_State;
+    return boost::shared_ptr<TcpClient>(socket.release(), [state](TcpClient *socket)
+    {
+        release(state, socket);
+    });
+}
+
+size_t SessionPool::idle() const
+{
+    std::lock_guard<std::mutex> lock(m_State->mutex);
+    return m_State->idle.size();
+}
+
+void SessionPool::release(const std::shared_ptr<State> &state, TcpClient *socket)
+{
+    // deleted after lock is released, if it is not taken back
+    std::unique_ptr<TcpClient> holder(socket);
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        if (state->closed || state->idle.size() >= state->max_idle)
+        {
+            return;
+        }
+    }
+
+    holder->recycle();
+
+    std::lock_guard<std::mutex> lock(state->mutex);
+    if (!state->closed && state->idle.size() < state->max_idle)
+    {
+        state->idle.push_back(std::move(holder));
+    }
+}
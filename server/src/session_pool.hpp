@@ -0,0 +1,57 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/ssl/context.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include "net/client.hpp"
+
+
+/*
+ * Closed connections of io thread are kept here and reused by next accepts:
+ * socket object, receive buffer, handler memory and write queue keep
+ * their memory. Ssl stream is not reused, it is recreated by recycle()
+ * (asio gives no way to drop records of previous connection), so openssl
+ * state of tls connection is still allocated per connection.
+ *
+ * Connection returns into pool, when its last shared_ptr is released
+ * (from any thread). Pool state is shared with deleters of given connections,
+ * so they could outlive Server.
+ */
+class SessionPool: private boost::noncopyable
+{
+public:
+    SessionPool(boost::asio::io_service &io, boost::asio::ssl::context &ctx, size_t max_idle);
+    ~SessionPool();
+
+    boost::shared_ptr<TcpClient> acquire();
+
+    uint64_t created() const { return m_State->created; }
+    uint64_t reused() const { return m_State->reused; }
+    size_t idle() const;
+
+private:
+    struct State
+    {
+        std::mutex mutex;
+        std::vector<std::unique_ptr<TcpClient>> idle;
+        size_t max_idle = 0;
+        bool closed = false;
+
+        std::atomic<uint64_t> created{0};
+        std::atomic<uint64_t> reused{0};
+    };
+
+    static void release(const std::shared_ptr<State> &state, TcpClient *socket);
+
+private:
+    boost::asio::io_service &m_Io;
+    boost::asio::ssl::context &m_Ctx;
+    std::shared_ptr<State> m_State;
+};
@@ -0,0 +1,159 @@
+#include <cstring>
+#include <stdexcept>
+
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#include <openssl/params.h>
+#else
+#include <openssl/hmac.h>
+#endif
+
+#include "tls_context.hpp"
+
+#include "o2logger/src/o2logger.hpp"
+using namespace o2logger;
+
+
+namespace
+{
+
+const unsigned char SESSION_ID_CONTEXT[] = "chatserver";
+const long SESSION_CACHE_SIZE = 100000;
+
+// app data of SSL_CTX belongs to asio (its verify callback, which is deleted with context)
+int context_index()
+{
+    static const int index = SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+    return index;
+}
+
+// false - key is not set
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+bool init_hmac(EVP_MAC_CTX *hmac, const unsigned char *key, size_t size)
+{
+    char digest[] = "SHA256";
+    OSSL_PARAM params[] = {
+        OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, const_cast<unsigned char *>(key), size),
+        OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, digest, 0),
+        OSSL_PARAM_construct_end()
+    };
+    return EVP_MAC_CTX_set_params(hmac, params) == 1;
+}
+#else
+bool init_hmac(HMAC_CTX *hmac, const unsigned char *key, size_t size)
+{
+    return HMAC_Init_ex(hmac, key, size, EVP_sha256(), nullptr) == 1;
+}
+#endif
+
+}   // namespace
+
+
+TlsContext::TlsContext(const std::string &sert, uint32_t session_timeout_sec) :
+    m_Context(boost::asio::ssl::context::sslv23)
+{
+    m_Context.set_options(boost::asio::ssl::context::default_workarounds
+        | boost::asio::ssl::context::no_sslv2
+        | boost::asio::ssl::context::single_dh_use);
+
+    if (!sert.empty())
+    {
+        m_Context.use_certificate_chain_file(sert);
+        m_Context.use_private_key_file(sert, boost::asio::ssl::context::pem);
+    }
+
+    SSL_CTX *ctx = m_Context.native_handle();
+
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_set_session_id_context(ctx, SESSION_ID_CONTEXT, sizeof(SESSION_ID_CONTEXT) - 1);
+    SSL_CTX_sess_set_cache_size(ctx, SESSION_CACHE_SIZE);
+    SSL_CTX_set_timeout(ctx, session_timeout_sec);
+
+    // record buffers of quiet connection are freed, most of connections are idle ones
+    SSL_CTX_set_mode(ctx, SSL_MODE_RELEASE_BUFFERS);
+
+    generate(m_Current);
+    generate(m_Previous);
+
+    SSL_CTX_set_ex_data(ctx, context_index(), this);
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, &TlsContext::ticketKeyCallback);
+#else
+    SSL_CTX_set_tlsext_ticket_key_cb(ctx, &TlsContext::ticketKeyCallback);
+#endif
+}
+
+void TlsContext::rotateTicketKey()
+{
+    TicketKey key;
+    generate(key);
+
+    std::lock_guard<std::mutex> lock(m_KeysMutex);
+    m_Previous = m_Current;
+    m_Current = key;
+
+    logd1("session ticket key rotated");
+}
+
+void TlsContext::generate(TicketKey &key)
+{
+    if (RAND_bytes(key.name, sizeof(key.name)) != 1
+        || RAND_bytes(key.aes, sizeof(key.aes)) != 1
+        || RAND_bytes(key.hmac, sizeof(key.hmac)) != 1)
+    {
+        throw std::runtime_error("can't generate session ticket key");
+    }
+}
+
+int TlsContext::ticketKeyCallback(SSL *ssl, unsigned char *name, unsigned char *iv,
+                                  EVP_CIPHER_CTX *cipher, ticket_hmac_t *hmac, int enc)
+/*
+ *  returns: -1 - error, 0 - ticket is unknown (full handshake),
+ *           1 - ticket accepted, 2 - ticket accepted, but should be renewed
+ */
+{
+    TlsContext *self = static_cast<TlsContext *>(SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), context_index()));
+
+    std::lock_guard<std::mutex> lock(self->m_KeysMutex);
+
+    if (enc)
+    {
+        const TicketKey &key = self->m_Current;
+        if (RAND_bytes(iv, EVP_MAX_IV_LENGTH) != 1)
+        {
+            return -1;
+        }
+        memcpy(name, key.name, sizeof(key.name));
+        if (EVP_EncryptInit_ex(cipher, EVP_aes_256_cbc(), nullptr, key.aes, iv) != 1
+            || !init_hmac(hmac, key.hmac, sizeof(key.hmac)))
+        {
+            return -1;
+        }
+        return 1;
+    }
+
+    const TicketKey *key = nullptr;
+    int ret = 1;
+    if (!memcmp(name, self->m_Current.name, sizeof(self->m_Current.name)))
+    {
+        key = &self->m_Current;
+    }
+    else if (!memcmp(name, self->m_Previous.name, sizeof(self->m_Previous.name)))
+    {
+        key = &self->m_Previous;
+        ret = 2;
+    }
+    else
+    {
+        return 0;
+    }
+
+    if (!init_hmac(hmac, key->hmac, sizeof(key->hmac))
+        || EVP_DecryptInit_ex(cipher, EVP_aes_256_cbc(), nullptr, key->aes, iv) != 1)
+    {
+        return -1;
+    }
+    return ret;
+}
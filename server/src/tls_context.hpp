@@ -0,0 +1,54 @@
+#pragma once
+
+#include <mutex>
+#include <string>
+
+#include <boost/asio/ssl.hpp>
+#include <boost/noncopyable.hpp>
+
+#include <openssl/ssl.h>
+
+
+/*
+ * Server ssl context, shared by all io threads.
+ * Resumption is possible both by session id (openssl internal cache, it is locked
+ * by openssl itself) and by session tickets. Ticket keys are rotated by rotateTicketKey(),
+ * tickets of previous key are still accepted and reissued with current one.
+ */
+class TlsContext: private boost::noncopyable
+{
+public:
+    TlsContext(const std::string &sert, uint32_t session_timeout_sec);
+
+    boost::asio::ssl::context &context() { return m_Context; }
+
+    void rotateTicketKey();
+
+private:
+    struct TicketKey
+    {
+        unsigned char name[16];
+        unsigned char aes[32];
+        unsigned char hmac[32];
+    };
+
+    // HMAC_CTX and its callback are deprecated by openssl 3
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    typedef EVP_MAC_CTX ticket_hmac_t;
+#else
+    typedef HMAC_CTX ticket_hmac_t;
+#endif
+
+private:
+    static int ticketKeyCallback(SSL *ssl, unsigned char *name, unsigned char *iv,
+                                 EVP_CIPHER_CTX *cipher, ticket_hmac_t *hmac, int enc);
+
+    static void generate(TicketKey &key);
+
+private:
+    boost::asio::ssl::context m_Context;
+
+    std::mutex m_KeysMutex;
+    TicketKey m_Current;
+    TicketKey m_Previous;
+};